@@ -5,12 +5,31 @@
 """A binary unigram and ngram dictionary."""
 
 import math
+import os
+import random
+import string
 from collections import defaultdict
 import corrector
 import byteutils
 
 CACHE_ENABLED = True
 
+SECTIONS_MAGIC = 'MSTD'
+SECTION_UNIGRAM_MAX_WEIGHTS = 1
+SECTION_MISSPELLINGS = 2
+SECTION_TRIGRAM_INDEX = 3
+SECTION_TOP_COMPLETIONS = 4
+SECTION_BLOOM_FILTER = 5
+BLOOM_BLOCK_SIZE = 64
+TOP_COMPLETIONS_SIZE = 8
+
+def fnv_hash(word):
+    """Return the 32 bit FNV-1a hash of a word"""
+    h = 2166136261
+    for c in word:
+        h = ((h ^ ord(c)) * 16777619) & 0xffffffff
+    return h
+
 class BinaryDictionary(object):
     """A binary dictionary of unigrams and ngrams,
     represented as a byte array.
@@ -47,6 +66,79 @@ class BinaryDictionary(object):
     5,6,7   : child1 address
     8,9,10  : child2 address
     ...     : childn address
+    ========================================================
+    Sections (optional, following the n-gram nodes)
+    --------------------------------------------------------
+    ...     : section contents, followed by one directory
+              entry per section:
+    0       : section id
+    1,2,3   : section address
+    4,5,6   : section size
+    ========================================================
+    Footer (last 8 bytes, only if there are sections)
+    --------------------------------------------------------
+    0       : number of sections
+    1,2,3   : address of the first directory entry
+    4..7    : 'MSTD'
+    ========================================================
+    Unigram max weights section (id 1)
+    --------------------------------------------------------
+    One byte per byte of the unigram trie: the byte at
+    index node - 6 holds the maximum weight of a final
+    node in the subtree of the unigram node, including
+    the node itself.
+    ========================================================
+    Misspellings section (id 2)
+    --------------------------------------------------------
+    0,1,2   : number of slots (a power of two)
+    3,4,5   : slot1 entry address, relative to the section,
+              or 0 if the slot is empty
+    ...     : slotn entry address
+    An open addressing hash table of misspellings, where
+    a misspelling with FNV-1a hash h is in the first non
+    empty slot from h mod the number of slots. Entries:
+    0,1,2   : address of the correction (i.e. address of
+              the tail node of a word in unigram trie)
+    3       : length of the misspelling
+    ...     : misspelling
+    .       : length of the correction
+    ...     : correction
+    ========================================================
+    Trigram index section (id 3)
+    --------------------------------------------------------
+    0,1,2   : number of trigrams
+    0,1,2   : trigram1
+    3,4,5   : trigram1 posting list address, relative to
+              the section
+    6,7,8   : trigram1 number of postings
+    ...     : trigramn, sorted in increasing order
+    An inverted index of the character trigrams of the
+    words padded with '$', e.g. '$hi', 'hi$' for 'hi'. A
+    posting list holds the addresses of the tail nodes
+    of the words containing the trigram, in increasing
+    order, as differences to the previous address
+    encoded as varints (7 bits per byte, the high bit
+    being set on all but the last byte), each followed
+    by the length of the word.
+    ========================================================
+    Top completions section (id 4)
+    --------------------------------------------------------
+    0       : maximum number of completions per node (k)
+    1,2,3   : number of nodes
+    0,1,2   : node1 address, in the unigram trie
+    3       : node1 number of completions (at most k)
+    4,5,6   : node1 completion1 address
+    ...     : node1 completionk address
+    ...     : noden, sorted by increasing address
+    The heaviest words below the unigram nodes with the
+    largest subtrees, by decreasing weight.
+    ========================================================
+    Bloom filter section (id 5)
+    --------------------------------------------------------
+    0       : number of bits set per word (k)
+    1,2,3   : number of blocks
+    ...     : blocks of 64 bytes (512 bits)
+    A Bloom filter of the words, cf. encode_bloom_filter().
     """
 
     def __init__(self):
@@ -55,6 +147,9 @@ class BinaryDictionary(object):
         self.ngram_cache = {}
         self.bytes = bytearray(24*1024*1024)
         self.ngrams_offset = -1
+        self.unigrams_end = 6
+        self.max_weights = {}
+        self.sections = []
 
     @staticmethod
     def from_file(filename):
@@ -71,18 +166,21 @@ class BinaryDictionary(object):
     def write_to_file(self, filename):
         """Write the dictionary to a file.
 
+        The dictionary is written to a temporary file, which is then
+        renamed to the output file, since a dictionary file may be
+        mapped by the processes querying it, which would crash if it
+        were rewritten in place.
+
         :param filename: the output filename where the
                          dictionary should be written to
         """
-        f = open(filename,"wb")
-        trimmed = bytearray()
-        pos = 0
-        chunk_size = 2048
-        while pos < self.pos:
-            trimmed.extend(self.bytes[pos:pos+chunk_size])
-            pos += chunk_size
-        f.write(trimmed)
+        if self.sections:
+            self.__add_sections_directory()
+        temp = filename + '.tmp'
+        f = open(temp,"wb")
+        f.write(self.bytes[0:self.pos])
         f.close()
+        os.rename(temp, filename)
 
     def encode_unigrams(self, root_node):
         """Serialize the unigram trie into the byte array
@@ -99,6 +197,7 @@ class BinaryDictionary(object):
         self.bytes[5] = 0
         self.pos = 6
         self.__add_unigram_node(root_node, chr(0), 0)
+        self.unigrams_end = self.pos
 
     def __add_unigram_node(self, node, value, parent_address):
         """Add a unigram node to the byte array
@@ -111,6 +210,7 @@ class BinaryDictionary(object):
         offset = self.pos
         self.bytes[offset] = value
         self.bytes[offset+1] = min(255, int(node.value)) if node.value else 0
+        max_weight = self.bytes[offset+1]
         if node.value and int(node.value) > 5000:
             #print "High freq node found at offset " + str(offset) + ", " + str(value)
             pass
@@ -126,7 +226,9 @@ class BinaryDictionary(object):
             self.bytes[offset_children+3*c] = 0xff & (child_pos >> 16)
             self.bytes[offset_children+3*c+1] = 0xff & (child_pos >> 8)
             self.bytes[offset_children+3*c+2] = 0xff & child_pos
+            max_weight = max(max_weight, self.max_weights[child_pos])
             c += 1
+        self.max_weights[offset] = max_weight
         return offset
 
     def encode_ngrams(self, root_node):
@@ -144,6 +246,233 @@ class BinaryDictionary(object):
         self.pos += 3
         self.__add_ngram_node(root_node, None)#, 0)
 
+    def encode_unigram_max_weights(self):
+        """Add a section holding, for each unigram node, the maximum
+        weight found in its subtree. This allows best-first searches
+        of the unigram trie to skip subtrees which cannot hold any
+        of the best words. Must be called after encode_ngrams().
+        """
+        payload = bytearray(self.unigrams_end - self.__get_unigrams_offset())
+        for (node, max_weight) in self.max_weights.iteritems():
+            payload[node - self.__get_unigrams_offset()] = max_weight
+        self.__add_section(SECTION_UNIGRAM_MAX_WEIGHTS, payload)
+        return len(payload)
+
+    def encode_misspellings(self, misspellings):
+        """Add a section mapping common misspellings to their
+        correction, so that they can be corrected without any
+        lookup of variations. Misspellings which are known words,
+        and corrections which are not, are left out. Must be called
+        after encode_ngrams().
+
+        :param misspellings: a dictionary of corrections keyed by
+        misspelling
+        """
+        entries = []
+        for (misspelling, correction) in misspellings.iteritems():
+            if self.exists(misspelling) or not self.exists(correction):
+                continue
+            if len(misspelling) > 255 or len(correction) > 255:
+                continue
+            entries.append((misspelling, correction))
+
+        num_slots = 1
+        while num_slots < 2*len(entries):
+            num_slots *= 2
+        payload = bytearray(3 + 3*num_slots)
+        byteutils.set_int(payload, 0, num_slots, 3)
+        for (misspelling, correction) in entries:
+            slot = fnv_hash(misspelling) % num_slots
+            while byteutils.to_int(payload, 3 + 3*slot, 3) != 0:
+                slot = (slot + 1) % num_slots
+            byteutils.set_int(payload, 3 + 3*slot, len(payload), 3)
+            entry = bytearray(5 + len(misspelling) + len(correction))
+            byteutils.set_int(entry, 0, self.__get_unigram(correction), 3)
+            entry[3] = len(misspelling)
+            entry[4:4+len(misspelling)] = misspelling
+            entry[4+len(misspelling)] = len(correction)
+            entry[5+len(misspelling):] = correction
+            payload.extend(entry)
+        self.__add_section(SECTION_MISSPELLINGS, payload)
+        return len(payload)
+
+    def encode_trigram_index(self, root_node):
+        """Add a section holding an inverted index of the character
+        trigrams of the words in the unigram trie, used to shortlist
+        candidates for corrections of long or garbled words. Must be
+        called after encode_ngrams().
+
+        :param root_node: the root node of the unigram trie
+        """
+        postings = defaultdict(list)
+        lengths = {}
+        for word in root_node.keys():
+            if not isinstance(word, str) or not word:
+                continue
+            unigram = self.__get_unigram(word)
+            lengths[unigram] = len(word)
+            padded = '$' + word + '$'
+            for trigram in set(padded[i:i+3] for i in range(len(padded) - 2)):
+                postings[trigram].append(unigram)
+
+        trigrams = sorted(postings.keys())
+        payload = bytearray(3 + 9*len(trigrams))
+        byteutils.set_int(payload, 0, len(trigrams), 3)
+        for (i, trigram) in enumerate(trigrams):
+            entry = 3 + 9*i
+            payload[entry:entry+3] = trigram
+            byteutils.set_int(payload, entry+3, len(payload), 3)
+            byteutils.set_int(payload, entry+6, len(postings[trigram]), 3)
+            previous = 0
+            for unigram in sorted(postings[trigram]):
+                delta = unigram - previous
+                previous = unigram
+                while delta >= 0x80:
+                    payload.append(0x80 | (delta & 0x7f))
+                    delta >>= 7
+                payload.append(delta)
+                payload.append(min(255, lengths[unigram]))
+        self.__add_section(SECTION_TRIGRAM_INDEX, payload)
+        return len(payload)
+
+    def encode_top_completions(self, min_words, size=TOP_COMPLETIONS_SIZE):
+        """Add a section holding the heaviest words below each
+        unigram node with at least min_words words below it, so that
+        the completions of short prefixes, which are the most frequent
+        and the most expensive to search, can be read as is. Must be
+        called after encode_ngrams().
+
+        :param min_words: the number of words below a node from which
+        its completions are stored
+        :param size: the number of completions stored per node
+        """
+        lists = {}
+        self.__collect_top_completions(self.__get_unigrams_offset(), min_words, size, lists)
+        entry_size = 4 + 3*size
+        payload = bytearray(4 + entry_size*len(lists))
+        payload[0] = size
+        byteutils.set_int(payload, 1, len(lists), 3)
+        for (i, node) in enumerate(sorted(lists.keys())):
+            entry = 4 + entry_size*i
+            byteutils.set_int(payload, entry, node, 3)
+            payload[entry+3] = len(lists[node])
+            for (j, (weight, completion)) in enumerate(lists[node]):
+                byteutils.set_int(payload, entry+4+3*j, completion, 3)
+        self.__add_section(SECTION_TOP_COMPLETIONS, payload)
+        return (len(lists), len(payload))
+
+    def __collect_top_completions(self, node, min_words, size, lists):
+        """Return the number of words below a unigram node, and the
+        heaviest of them as (weight, address) pairs. The latter are
+        stored in lists for the nodes (other than the root) with at
+        least min_words words below them.
+
+        :param node: a unigram node
+        :param min_words: the number of words from which to store
+        :param size: the number of heaviest words to keep
+        :param lists: the stored lists, keyed by node
+        """
+        count = 0
+        heaviest = []
+        for i in range(self.bytes[node+2]):
+            child = byteutils.to_int(self.bytes, node+6+3*i, 3)
+            (child_count, child_heaviest) = self.__collect_top_completions(child, min_words, size, lists)
+            count += child_count
+            heaviest.extend(child_heaviest)
+            if self.__is_final_unigram(child):
+                count += 1
+                heaviest.append((self.__unigram_weight(child), child))
+        heaviest = sorted(heaviest, key=lambda x: -x[0])[:size]
+        if count >= min_words and node != self.__get_unigrams_offset():
+            lists[node] = heaviest
+        return (count, heaviest)
+
+    def encode_bloom_filter(self, root_node, false_positive_rate):
+        """Add a section holding a Bloom filter of the words in the
+        unigram trie, which rejects most lookups of words which are
+        not in the dictionary (e.g. the variations of a word looked
+        up for corrections) without walking the trie. All the bits of
+        a word are set in the same 64 byte block, chosen by its FNV-1a
+        hash h, at (g + i * ((g >> 9) | 1)) mod 512 for i < k, where
+        g = (h * 0x5bd1e995) ^ (h >> 15). Must be called after
+        encode_ngrams().
+
+        :param root_node: the root node of the unigram trie
+        :param false_positive_rate: the target rate of words which
+        are not in the dictionary but pass the filter
+        """
+        words = [word for word in root_node.keys()
+                 if isinstance(word, str) and word and self.exists(word)]
+        num_words = max(1, len(words))
+        num_bits = -num_words * math.log(false_positive_rate) / math.log(2)**2
+        num_hashes = max(1, min(255, int(round(num_bits / num_words * math.log(2)))))
+        block_bits = 8*BLOOM_BLOCK_SIZE
+        num_blocks = max(1, int(math.ceil(num_bits / block_bits)))
+
+        payload = bytearray(4 + BLOOM_BLOCK_SIZE*num_blocks)
+        payload[0] = num_hashes
+        byteutils.set_int(payload, 1, num_blocks, 3)
+        for word in words:
+            for bit in self.__bloom_bits(word, num_hashes, num_blocks):
+                payload[4 + bit/8] |= 1 << (bit % 8)
+        self.__add_section(SECTION_BLOOM_FILTER, payload)
+
+        # Measure the actual rate on random strings which are not words
+        known = set(words)
+        passed = 0
+        tested = 0
+        generator = random.Random(42)
+        while tested < 10000:
+            length = generator.randint(3, 10)
+            word = ''.join(generator.choice(string.ascii_lowercase) for i in range(length))
+            if word in known:
+                continue
+            tested += 1
+            bits = self.__bloom_bits(word, num_hashes, num_blocks)
+            if all(payload[4 + bit/8] & (1 << (bit % 8)) for bit in bits):
+                passed += 1
+        return (len(payload), num_hashes, float(passed) / tested)
+
+    def __bloom_bits(self, word, num_hashes, num_blocks):
+        """Return the positions of the bits of a word in the Bloom
+        filter, from the start of the first block"""
+        h = fnv_hash(word)
+        g = ((h * 0x5bd1e995) & 0xffffffff) ^ (h >> 15)
+        block_bits = 8*BLOOM_BLOCK_SIZE
+        block = (h % num_blocks) * block_bits
+        bit = g % block_bits
+        step = (g >> 9) | 1
+        bits = []
+        for i in range(num_hashes):
+            bits.append(block + bit)
+            bit = (bit + step) % block_bits
+        return bits
+
+    def __add_section(self, section_id, payload):
+        """Append an optional section to the byte array, after the
+        ngrams. The section directory is written by write_to_file().
+
+        :param section_id: the section id
+        :param payload: the section contents
+        """
+        self.bytes[self.pos:self.pos+len(payload)] = payload
+        self.sections.append((section_id, self.pos, len(payload)))
+        self.pos += len(payload)
+
+    def __add_sections_directory(self):
+        """Append the sections directory and the footer pointing to it"""
+        directory = self.pos
+        for (section_id, address, size) in self.sections:
+            self.bytes[self.pos] = section_id
+            byteutils.set_int(self.bytes, self.pos+1, address, 3)
+            byteutils.set_int(self.bytes, self.pos+4, size, 3)
+            self.pos += 7
+        self.bytes[self.pos] = len(self.sections)
+        byteutils.set_int(self.bytes, self.pos+1, directory, 3)
+        self.bytes[self.pos+4:self.pos+8] = SECTIONS_MAGIC
+        self.pos += 8
+        self.sections = []
+
     def __add_ngram_node(self, node, word):
         """Add an ngram node to the byte array.
 
@@ -209,7 +538,7 @@ class BinaryDictionary(object):
         :param word: the word to look up
         """
         if CACHE_ENABLED:
-            if word and word in self.word_cache:
+            if word and not prefix and word in self.word_cache:
                 return self.word_cache[word]
 
         if len(word) == 0:
@@ -455,6 +784,21 @@ class BinaryDictionary(object):
         """
         return self.__known([word]) or self.__known(corrector.variations(word)) or self.__known_variations(word) or [word]
 
+    def get_best_correction(self, word):
+        """Return the correction of a word with the highest weight
+        among those of the smallest edit distance, or None if the
+        word is known or has no correction.
+
+        :param word: the word to correct
+        """
+        if self.exists(word):
+            return None
+        known = self.__known(corrector.variations(word)) or \
+            self.__known(self.__known_variations(word))
+        if not known:
+            return None
+        return max(known.iteritems(), key=lambda c: c[1])[0]
+
     def get_completions(self, word, depth):
         """Return a list of completions of a given word. For instance,
         'yo' => ['you', 'your']
@@ -8,4 +8,8 @@ def to_int(byte_array, offset, chunk_size):
     value = 0
     for i in range(0, chunk_size):
         value += byte_array[offset + i] << (chunk_size-i-1)*8
-    return value
\ No newline at end of file
+    return value
+
+def set_int(byte_array, offset, value, chunk_size):
+    for i in range(0, chunk_size):
+        byte_array[offset + i] = 0xff & (value >> (chunk_size-i-1)*8)
@@ -12,16 +12,25 @@ from bindict import BinaryDictionary
 
 def main():
     try:
-        opts, args = getopt.getopt(sys.argv[1:], "h:o:u:n:dt")
+        opts, args = getopt.getopt(sys.argv[1:], "h:o:u:n:m:c:k:b:gdt")
     except getopt.error, msg:
         print msg
         print "Usage: 'python makedict.py -u unigrams -n bigrams,trigrams,fourgrams -o output'"
+        print "Misspellings: '-m misspellings' (lines 'misspelling correction') or '-c candidates' (one word per line)"
+        print "Trigram index: '-g'"
+        print "Top completions of the nodes with at least N words below them: '-k N'"
+        print "Bloom filter with a false positive rate of P: '-b P'"
         print "Debug: 'python makedict.py -d'"
         print "Generate test dict: 'python makedict.py -t'"
         sys.exit(2)
 
     unigrams = []
     ngrams = []
+    misspellings = ""
+    candidates = ""
+    trigrams = False
+    min_completion_words = 0
+    false_positive_rate = 0
     output = ""
     for o,l in opts:
         if "-t" == o:
@@ -36,6 +45,16 @@ def main():
             unigrams = [l]
         if "-n" == o:
             ngrams = l.split(',')
+        if "-m" == o:
+            misspellings = l
+        if "-c" == o:
+            candidates = l
+        if "-g" == o:
+            trigrams = True
+        if "-k" == o:
+            min_completion_words = int(l)
+        if "-b" == o:
+            false_positive_rate = float(l)
         if "-o" == o:
             output = l
       
@@ -60,16 +79,75 @@ def main():
     d.encode_unigrams(unigrams)
     print "Encoding ngrams..."
     d.encode_ngrams(ngrams)
+    print "Encoding unigram max weights..."
+    size = d.encode_unigram_max_weights()
+    print "Unigram max weights take " + str(size) + " bytes"
+    if misspellings or candidates:
+        print "Encoding misspellings..."
+        if misspellings:
+            corrections = read_misspellings(misspellings)
+        else:
+            corrections = correct_candidates(d, candidates)
+        size = d.encode_misspellings(corrections)
+        print "Misspellings take " + str(size) + " bytes"
+    if trigrams:
+        print "Encoding trigram index..."
+        size = d.encode_trigram_index(unigrams)
+        print "Trigram index takes " + str(size) + " bytes"
+    if min_completion_words > 0:
+        print "Encoding top completions..."
+        (num_nodes, size) = d.encode_top_completions(min_completion_words)
+        print "Top completions of " + str(num_nodes) + " nodes take " + str(size) + " bytes (" + \
+            str(round(100.0 * size / d.pos, 1)) + "% of the dictionary)"
+    if false_positive_rate > 0:
+        print "Encoding Bloom filter..."
+        (size, num_hashes, measured_rate) = d.encode_bloom_filter(unigrams, false_positive_rate)
+        print "Bloom filter takes " + str(size) + " bytes, with " + str(num_hashes) + \
+            " hashes per word and a measured false positive rate of " + str(measured_rate)
     print "Writing file to " + str(output)
     d.write_to_file(output)
     monitor.stop()
 
+def read_misspellings(filename):
+    """Read a list of misspellings and their correction, e.g. extracted
+    from correction logs, where each line is of the form
+    'misspelling correction'.
+
+    :param filename: the misspellings file
+    """
+    corrections = {}
+    f = open(filename, 'r')
+    for line in f:
+        s = line.strip().split(' ')
+        if len(s) == 2:
+            corrections[s[0]] = s[1]
+    f.close()
+    return corrections
+
+def correct_candidates(d, filename):
+    """Run the correction engine over a list of candidate misspellings,
+    one per line, and return the best correction of each.
+
+    :param d: the binary dictionary, with unigrams and ngrams encoded
+    :param filename: the candidates file
+    """
+    corrections = {}
+    f = open(filename, 'r')
+    for line in f:
+        word = line.strip()
+        correction = d.get_best_correction(word) if word else None
+        if correction:
+            corrections[word] = correction
+    f.close()
+    return corrections
+
 def generate_test_dict():
     unigrams = Trie()
     unigrams['a'] = 200
     unigrams['hi'] = 130
     unigrams['hello'] = 120
     unigrams['there'] = 140
+    unigrams['three'] = 150
     unigrams['how'] = 150
     unigrams['are'] = 80
     unigrams['you'] = 200
@@ -85,6 +163,11 @@ def generate_test_dict():
     bindict = BinaryDictionary()
     bindict.encode_unigrams(unigrams)
     bindict.encode_ngrams(ngrams)
+    bindict.encode_unigram_max_weights()
+    bindict.encode_misspellings({'thr': 'there'})
+    bindict.encode_trigram_index(unigrams)
+    bindict.encode_top_completions(3, 2)
+    bindict.encode_bloom_filter(unigrams, 0.01)
 
     bindict.write_to_file('../dictionaries/test/test.dict')
 
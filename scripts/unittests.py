@@ -16,6 +16,7 @@ class DictionaryTest(unittest.TestCase):
         self.unigrams['hi'] = 130
         self.unigrams['hello'] = 120
         self.unigrams['there'] = 140
+        self.unigrams['three'] = 150
         self.unigrams['how'] = 150
         self.unigrams['are'] = 80
         self.unigrams['you'] = 200
@@ -63,6 +64,10 @@ class DictionaryTest(unittest.TestCase):
         self.assertTrue('you' in self.bindict.get_corrections('yuu').keys())
         self.assertTrue('your' in self.bindict.get_corrections('yuur').keys())
 
+    def test_best_correction(self):
+        self.assertEqual(self.bindict.get_best_correction('yuu'), 'you')
+        self.assertEqual(self.bindict.get_best_correction('you'), None)
+
     def test_completions(self):
         self.assertTrue('you' in self.bindict.get_completions('yo', 1))
         self.assertFalse('your' in self.bindict.get_completions('yo', 1))
@@ -0,0 +1,207 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Spelling corrections of large batches of words.
+ */
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <tr1/unordered_map>
+#include "batch.h"
+
+using namespace std;
+
+/**
+ * Create a batch corrector, and start its workers.
+ * @param dictionary the dictionary to correct words with, which
+ * the workers do not change
+ * @param numThreads the number of workers
+ */
+BatchCorrector::BatchCorrector(const BinaryDictionary* dictionary, int numThreads) {
+    this->dictionary = dictionary;
+    batch = 0;
+    busyWorkers = 0;
+    stopping = false;
+    words = NULL;
+    results = NULL;
+    maxCorrections = 0;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&started, NULL);
+    pthread_cond_init(&finished, NULL);
+    int numWorkers = numThreads > 0 ? numThreads : 1;
+    for (int i = 0; i < numWorkers; i++) {
+        batch_worker* worker = new batch_worker();
+        worker->corrector = this;
+        worker->id = i;
+        worker->session = new DictionarySession(dictionary);
+        pthread_mutex_init(&worker->lock, NULL);
+        workers.push_back(worker);
+    }
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_create(&workers[i]->thread, NULL, BatchCorrector::runWorker, workers[i]);
+    }
+}
+
+/**
+ * Stop the workers, once they are done with the current batch.
+ */
+BatchCorrector::~BatchCorrector() {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&started);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i]->thread, NULL);
+        pthread_mutex_destroy(&workers[i]->lock);
+        delete workers[i]->session;
+        delete workers[i];
+    }
+    pthread_cond_destroy(&finished);
+    pthread_cond_destroy(&started);
+    pthread_mutex_destroy(&lock);
+}
+
+/**
+ * Clear the caches of the sessions of the workers, e.g. to free
+ * their memory between batches.
+ */
+void BatchCorrector::clearCaches() {
+    for (int i = 0; i < workers.size(); i++) {
+        workers[i]->session->clearCaches();
+    }
+}
+
+/**
+ * Get the spelling corrections of a list of words, as with
+ * BinaryDictionary::getCorrections(), on the workers.
+ * @param words the words to correct
+ * @param corrections the list of lists of corrections
+ * @param maxCorrections the maximum number of desired corrections
+ * per word
+ * @return the corrections of each word, in the order of the words
+ */
+vector<vector<weighted_string> > BatchCorrector::getCorrections(vector<string> words, vector<vector<weighted_string> > corrections, int maxCorrections) {
+    // Each distinct word is corrected once
+    std::tr1::unordered_map<string, int> distinct;
+    vector<string> unique;
+    vector<int> indices;
+    indices.reserve(words.size());
+    for (int i = 0; i < words.size(); i++) {
+        std::tr1::unordered_map<string, int>::iterator it = distinct.find(words[i]);
+        if (it == distinct.end()) {
+            it = distinct.insert(make_pair(words[i], (int) unique.size())).first;
+            unique.push_back(words[i]);
+        }
+        indices.push_back(it->second);
+    }
+
+    vector<vector<weighted_string> > found(unique.size());
+    int numChunks = (unique.size() + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE;
+    int numWorkers = workers.size();
+    for (int i = 0; i < numWorkers; i++) {
+        batch_worker* worker = workers[i];
+        pthread_mutex_lock(&worker->lock);
+        for (int chunk = numChunks * i / numWorkers; chunk < numChunks * (i + 1) / numWorkers; chunk++) {
+            worker->chunks.push_back(chunk);
+        }
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    pthread_mutex_lock(&lock);
+    this->words = &unique;
+    this->results = &found;
+    this->maxCorrections = maxCorrections;
+    busyWorkers = numWorkers;
+    batch++;
+    pthread_cond_broadcast(&started);
+    while (busyWorkers > 0) {
+        pthread_cond_wait(&finished, &lock);
+    }
+    this->words = NULL;
+    this->results = NULL;
+    pthread_mutex_unlock(&lock);
+
+    corrections.reserve(corrections.size() + words.size());
+    for (int i = 0; i < indices.size(); i++) {
+        corrections.push_back(found[indices[i]]);
+    }
+    return corrections;
+}
+
+/**
+ * Take the next chunk of a worker: the last one of its own deque,
+ * or else the first one of the deque of another worker.
+ * @param worker the worker
+ * @param chunk a holder for the chunk
+ * @return false if no chunk is left in the batch
+ */
+bool BatchCorrector::takeChunk(batch_worker* worker, int* chunk) {
+    bool taken = false;
+    pthread_mutex_lock(&worker->lock);
+    if (!worker->chunks.empty()) {
+        *chunk = worker->chunks.back();
+        worker->chunks.pop_back();
+        taken = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    for (int i = 1; i < workers.size() && !taken; i++) {
+        batch_worker* victim = workers[(worker->id + i) % workers.size()];
+        pthread_mutex_lock(&victim->lock);
+        if (!victim->chunks.empty()) {
+            *chunk = victim->chunks.front();
+            victim->chunks.pop_front();
+            taken = true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return taken;
+}
+
+/**
+ * Correct the words of a chunk. Each word of the batch is corrected
+ * by a single worker, which alone writes its corrections.
+ */
+void BatchCorrector::correctChunk(batch_worker* worker, int chunk) {
+    int end = min((int) words->size(), (chunk + 1) * BATCH_CHUNK_SIZE);
+    for (int i = chunk * BATCH_CHUNK_SIZE; i < end; i++) {
+        vector<weighted_string> holder;
+        (*results)[i] = worker->session->getCorrections((*words)[i], holder, maxCorrections);
+    }
+}
+
+/**
+ * Run the batches of a worker, until the corrector stops. A batch is
+ * over for a worker when no chunk is left in any deque, since no
+ * chunk is added to a batch once it started.
+ */
+void* BatchCorrector::runWorker(void* arg) {
+    batch_worker* worker = (batch_worker*) arg;
+    BatchCorrector* corrector = worker->corrector;
+    int done = 0;
+    while (true) {
+        pthread_mutex_lock(&corrector->lock);
+        while (corrector->batch == done && !corrector->stopping) {
+            pthread_cond_wait(&corrector->started, &corrector->lock);
+        }
+        if (corrector->stopping) {
+            pthread_mutex_unlock(&corrector->lock);
+            return NULL;
+        }
+        done = corrector->batch;
+        pthread_mutex_unlock(&corrector->lock);
+
+        int chunk;
+        while (corrector->takeChunk(worker, &chunk)) {
+            corrector->correctChunk(worker, chunk);
+        }
+
+        pthread_mutex_lock(&corrector->lock);
+        if (--corrector->busyWorkers == 0) {
+            pthread_cond_signal(&corrector->finished);
+        }
+        pthread_mutex_unlock(&corrector->lock);
+    }
+}
@@ -0,0 +1,90 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Spelling corrections of large batches of words.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+#include "bindict.h"
+#include "session.h"
+using namespace std;
+
+#define BATCH_CHUNK_SIZE 64
+
+class BatchCorrector;
+
+/**
+ * A worker thread of a batch corrector, with its own session on
+ * the dictionary, and its deque of chunks of words to correct: the
+ * worker takes chunks from the back of its deque, and when it is
+ * empty, steals them from the front of the deques of the other
+ * workers.
+ */
+struct batch_worker {
+    BatchCorrector* corrector;
+    int id;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    deque<int> chunks;
+    DictionarySession* session;
+};
+
+/**
+ * A batch corrector corrects many words at once on a pool of
+ * threads sharing a dictionary, e.g.
+ *
+ * BatchCorrector batch(&bindict, 8);
+ * batch.getCorrections(words, holder, 3) => [[{'you':200}], [{'hello':120}], ...]
+ *
+ * The words are deduplicated first, so that each distinct word is
+ * corrected once, and its corrections returned for each of its
+ * occurrences. The distinct words are split into chunks of
+ * BATCH_CHUNK_SIZE words, spread evenly over the workers, which
+ * steal chunks from each other once they run out of their own, so
+ * that all workers stay busy until the end of the batch even though
+ * some words take much longer to correct than others.
+ *
+ * The workers are started once, and keep their sessions, and the
+ * caches in them, from one batch to the next. Batches must not be
+ * run concurrently on the same corrector, nor while the dictionary
+ * loads another file.
+ */
+class BatchCorrector {
+
+private:
+    const BinaryDictionary* dictionary;
+    vector<batch_worker*> workers;
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+    int batch;
+    int busyWorkers;
+    bool stopping;
+    vector<string>* words;
+    vector<vector<weighted_string> >* results;
+    int maxCorrections;
+
+    // Workers are owned, and locks can't be copied
+    BatchCorrector(const BatchCorrector&);
+    BatchCorrector& operator=(const BatchCorrector&);
+
+    static void* runWorker(void* worker);
+    bool takeChunk(batch_worker* worker, int* chunk);
+    void correctChunk(batch_worker* worker, int chunk);
+
+public:
+    BatchCorrector(const BinaryDictionary* dictionary, int numThreads);
+    ~BatchCorrector();
+
+    int getNumThreads() { return workers.size(); }
+    void clearCaches();
+    vector<vector<weighted_string> > getCorrections(vector<string> words, vector<vector<weighted_string> > corrections, int maxCorrections);
+};
+
+#endif
@@ -7,6 +7,18 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <queue>
+#include <cstring>
+#include <ctime>
+#include <climits>
+#include <tr1/unordered_set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "bindict.h"
 #include "corrector.h"
 
@@ -14,29 +26,406 @@ using namespace std;
 
 #define DEBUG false
 #define CACHE_ENABLED true
+#define MAX_CACHED_NGRAM_SIZE 4
+#define MAX_CACHED_PREDICTIONS 0xffff
+#define CACHE_KEYS_MAGIC "MSTK"
+#define CACHE_KEYS_UNIGRAM 1
+#define CACHE_KEYS_NGRAM 2
+#define CACHE_KEYS_PREDICTIONS 3
 #define MAX_WORD_LENGTH 48
+#define MAX_WEIGHT 255
+#define MAX_CORRECTION_COST ERROR_MODEL_DEFAULT_COST
+#define MAX_CONTEXT_CANDIDATES 64
+#define MAX_CORRECTION_EDITS 2
+#define SECTIONS_MAGIC "MSTD"
 
 /**
- * Read a binary dictionary file into the byte array.
+ * Return the 32 bit FNV-1a hash of a word.
+ */
+static unsigned int fnvHash(const string& word) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < word.length(); i++) {
+        hash = (hash ^ (unsigned char) word[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * A node on the stack of a depth first walk of the unigram trie,
+ * 'level' generations below the node the walk started from.
+ */
+struct descent_state {
+    int node;
+    int level;
+};
+
+/**
+ * An entry of the best-first completion search: either a subtree,
+ * whose weight is the maximum weight in it, or a word, with its
+ * exact weight. 'path' indexes the node in the list of visited
+ * nodes, from which words are built.
+ */
+struct completion_state {
+    int path;
+    int weight;
+    bool final;
+};
+
+/**
+ * Order completion states by increasing weight, words first when
+ * equal (the top of a priority_queue is its largest element).
+ */
+struct compareCompletionState {
+    bool operator()(const completion_state& a, const completion_state& b) const {
+        if (a.weight != b.weight) return a.weight < b.weight;
+        return !a.final && b.final;
+    }
+};
+
+/**
+ * A node visited by the best-first completion search, and the index
+ * of its parent in the list of visited nodes (-1 for the children
+ * of the node the search started from).
+ */
+struct path_node {
+    int node;
+    int parent;
+};
+
+/**
+ * A node visited by the fuzzy completion search: 'distance' is the
+ * smallest edit distance between the typed word and a prefix of the
+ * node's path, and 'row' the offset of the node's edit distance row,
+ * or -1 once no descendant can come closer to the typed word.
+ */
+struct fuzzy_node {
+    int node;
+    int parent;
+    int distance;
+    int row;
+};
+
+/**
+ * An entry of the fuzzy completion search: either a subtree, with
+ * lower bounds on its distance and upper bounds on its weight, or a
+ * word, with its exact distance and weight.
+ */
+struct fuzzy_state {
+    int path;
+    int distance;
+    int weight;
+    bool final;
+};
+
+/**
+ * Order fuzzy states by decreasing distance, then by increasing
+ * weight, words first when equal (the top of a priority_queue is its
+ * largest element).
+ */
+struct compareFuzzyState {
+    bool operator()(const fuzzy_state& a, const fuzzy_state& b) const {
+        if (a.distance != b.distance) return a.distance > b.distance;
+        if (a.weight != b.weight) return a.weight < b.weight;
+        return !a.final && b.final;
+    }
+};
+
+/**
+ * A cursor over a delta encoded posting list of the trigram index.
+ */
+struct posting_cursor {
+    int pos;
+    int remaining;
+    int value;
+    int length;
+};
+
+/**
+ * Order posting cursors by increasing current value (the top of a
+ * priority_queue is its largest element).
+ */
+struct comparePostingCursor {
+    bool operator()(const posting_cursor& a, const posting_cursor& b) const {
+        return a.value > b.value;
+    }
+};
+
+/**
+ * Read the next value of a posting list, and move the cursor past it.
+ * @return false if the list is exhausted
+ */
+static bool nextPosting(char* bytes, posting_cursor* cursor) {
+    if (cursor->remaining == 0) return false;
+    int delta = 0;
+    int shift = 0;
+    unsigned char b;
+    do {
+        b = (unsigned char) bytes[cursor->pos++];
+        delta |= (b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    cursor->length = (unsigned char) bytes[cursor->pos++];
+    cursor->value += delta;
+    cursor->remaining--;
+    return true;
+}
+
+/**
+ * A state of the best-first correction search: 'node' has been
+ * reached after reading 'pos' characters of the typed word with
+ * 'edits' edits costing 'cost'. Final states stand for a word
+ * found at 'node', and are ranked by their exact score.
+ */
+struct search_state {
+    int node;
+    int pos;
+    int edits;
+    float cost;
+    float priority;
+    bool final;
+};
+
+/**
+ * Order search states by increasing number of edits, and then by
+ * increasing priority, i.e. the cost minus the log of the weight
+ * bound (the top of a priority_queue is its largest element).
+ */
+struct compareSearchState {
+    bool operator()(const search_state& a, const search_state& b) const {
+        if (a.edits != b.edits) return a.edits > b.edits;
+        return a.priority > b.priority;
+    }
+};
+
+static bool compareScore(const scored_word& a, const scored_word& b) {
+    return a.score > b.score;
+}
+
+static bool compareUnigram(const scored_word& a, const scored_word& b) {
+    return a.unigram < b.unigram;
+}
+
+static bool compareValue(const weighted_int& a, const weighted_int& b) {
+    return a.value < b.value;
+}
+
+static bool compareWeight(const weighted_string& a, const weighted_string& b) {
+    return a.weight > b.weight;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * Create a budget.
+ * @param milliseconds the time queries have from now on, or 0 for
+ * no deadline
+ * @param maxNodes the number of nodes queries may visit, or 0 for
+ * no limit
+ */
+QueryBudget::QueryBudget(double milliseconds, long maxNodes) {
+    deadline = milliseconds > 0 ? now() + milliseconds : 0;
+    this->maxNodes = maxNodes;
+    nodes = 0;
+    nextCheck = deadline > 0 ? 0 : LONG_MAX;
+    partial = false;
+    late = false;
+    yield = NULL;
+    yieldArg = NULL;
+    yieldInterval = 0;
+    nextYield = 0;
+}
+
+/**
+ * Call a function every 'nodes' nodes spent, e.g. to let other
+ * queries run, cf. QueryExecutor. Time spent in the function counts
+ * towards the deadline.
+ * @param nodes the number of nodes between calls
+ * @param yield the function, or NULL for none
+ * @param arg the argument of the function
+ */
+void QueryBudget::setYield(int nodes, void (*yield)(void*), void* arg) {
+    this->yield = yield;
+    yieldArg = arg;
+    yieldInterval = max(nodes, 1);
+    nextYield = this->nodes + yieldInterval;
+    nextCheck = min(nextCheck, yield != NULL ? nextYield : LONG_MAX);
+}
+
+/**
+ * Yield every yieldInterval nodes, and read the clock every
+ * BUDGET_CLOCK_INTERVAL nodes.
+ * @return false if the deadline has passed
+ */
+bool QueryBudget::checkpoint() {
+    nextCheck = LONG_MAX;
+    if (yield != NULL) {
+        if (nodes >= nextYield) {
+            nextYield = nodes + yieldInterval;
+            yield(yieldArg);
+        }
+        nextCheck = nextYield;
+    }
+    if (deadline > 0) {
+        nextCheck = min(nextCheck, nodes + BUDGET_CLOCK_INTERVAL);
+        if (now() >= deadline) {
+            partial = true;
+            late = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * The error model of uniform edit costs, used without an error model
+ * set. Its costs are only read, so it is shared by all queries.
+ */
+static ErrorModel uniformModel;
+
+/**
+ * The version of the last file loaded by any dictionary.
+ */
+static int lastVersion = 0;
+
+/**
+ * Map a binary dictionary file into memory, read-only, as the byte
+ * array. Pages are read from the file as queries touch them, and
+ * are shared by the processes mapping the same file. The file must
+ * thus only be replaced by renaming another file over it, and never
+ * rewritten in place, e.g. truncated, while it is loaded.
+ *
+ * The file is checked first, cf. isValid(), and if it cannot be
+ * mapped or is not valid, the dictionary is left as it was. Loading
+ * a file gives the dictionary a new version, and clears its caches.
+ *
  * @param filename the path to the binary dictionary file
  */
 void BinaryDictionary::fromFile(const char * filename) {
-    ifstream file (filename, ios::in|ios::binary|ios::ate);
-    if (file.is_open()) {
-        size = file.tellg();
-        bytes = new char [size];
-        file.seekg(0, ios::beg);
-        file.read(bytes, size);
-        file.close();
+    waitForWarmUp();
+    int fd = open(filename, O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || status.st_size == 0) {
+        if (fd >= 0) close(fd);
         if (DEBUG) {
-            cout << "Loaded " << size << " bytes " << endl;
+            cout << "Unable to open file";
         }
-        loaded = true;
-    } else {
+        return;
+    }
+    void* mapped = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return;
+    }
+    if (!isValid((char*) mapped, status.st_size)) {
+        munmap(mapped, status.st_size);
         if (DEBUG) {
-            cout << "Unable to open file";
+            cout << "Invalid dictionary " << filename << endl;
+        }
+        return;
+    }
+
+    unload();
+    bytes = (char*) mapped;
+    size = status.st_size;
+    unigramCache.clear();
+    ngramCache.clear();
+    predictionCache.clear();
+    ngramsOffset = toInt(bytes, 3, 3);
+    version = __sync_add_and_fetch(&lastVersion, 1);
+    if (DEBUG) {
+        cout << "Loaded " << size << " bytes " << endl;
+    }
+    loaded = true;
+    readSections();
+}
+
+/**
+ * Unmap the byte array, if any, dropping its pages from the memory
+ * of the process first.
+ */
+void BinaryDictionary::unload() {
+    if (bytes != NULL) {
+        madvise(bytes, size, MADV_DONTNEED);
+        munmap(bytes, size);
+        bytes = NULL;
+    }
+    loaded = false;
+}
+
+/**
+ * Check that a byte array holds a dictionary whose structure lies
+ * within the array: the n-gram header, and if there is a footer,
+ * the directory and the sections.
+ * @param bytes the byte array
+ * @param length the size of the byte array
+ * @return true if the byte array can be loaded
+ */
+bool BinaryDictionary::isValid(char* bytes, int length) const {
+    if (length < 12) {
+        return false;
+    }
+    int ngrams = toInt(bytes, 3, 3);
+    if (ngrams < getUnigramsOffset() || ngrams + 3 > length) {
+        return false;
+    }
+    if (memcmp(bytes + length - 4, SECTIONS_MAGIC, 4) != 0) {
+        return true;
+    }
+    int numSections = (unsigned char) bytes[length - 8];
+    int directory = toInt(bytes, length - 7, 3);
+    if (directory < ngrams + 3 || directory + 7*numSections > length - 8) {
+        return false;
+    }
+    for (int i = 0; i < numSections; i++) {
+        int entry = directory + 7*i;
+        int offset = toInt(bytes, entry + 1, 3);
+        if (offset < ngrams + 3 || offset + toInt(bytes, entry + 4, 3) > directory) {
+            return false;
         }
     }
+    return true;
+}
+
+/**
+ * Read the directory of optional sections, if the dictionary
+ * has a footer.
+ */
+void BinaryDictionary::readSections() {
+    for (int i = 0; i < MAX_SECTIONS; i++) {
+        sectionOffsets[i] = 0;
+        sectionSizes[i] = 0;
+    }
+    int length = size;
+    if (length < 8 || memcmp(bytes + length - 4, SECTIONS_MAGIC, 4) != 0) {
+        return;
+    }
+    int numSections = (unsigned char) bytes[length - 8];
+    int directory = toInt(bytes, length - 7, 3);
+    for (int i = 0; i < numSections; i++) {
+        int entry = directory + 7*i;
+        int id = (unsigned char) bytes[entry];
+        if (id >= MAX_SECTIONS) continue;
+        sectionOffsets[id] = toInt(bytes, entry + 1, 3);
+        sectionSizes[id] = toInt(bytes, entry + 4, 3);
+    }
+}
+
+/**
+ * Return the position, in the byte array, of an optional section.
+ * @param id the section id
+ * @param sectionSize a holder for the size of the section, or NULL
+ * @return the position of the section, or 0 if there is none
+ */
+int BinaryDictionary::getSection(int id, int* sectionSize) const {
+    if (!loaded || id < 0 || id >= MAX_SECTIONS) return 0;
+    if (sectionSize != NULL) {
+        *sectionSize = sectionSizes[id];
+    }
+    return sectionOffsets[id];
 }
 
 weighted_string BinaryDictionary::createWeightedString(string value, int weight) {
@@ -46,13 +435,49 @@ weighted_string BinaryDictionary::createWeightedString(string value, int weight)
     return word;
 }
 
+/**
+ * Return how many budgets queries were given, and how many of them
+ * were spent, since the dictionary was created.
+ */
+budget_stats BinaryDictionary::getBudgetStats() const {
+    budget_stats stats;
+    stats.budgets = __sync_fetch_and_add(&budgets, 0);
+    stats.deadlines = __sync_fetch_and_add(&budgetDeadlines, 0);
+    stats.nodeLimits = __sync_fetch_and_add(&budgetNodeLimits, 0);
+    return stats;
+}
+
+/**
+ * Spend nodes of the budget of a query, counting the limited budgets
+ * used and the budgets spent.
+ * @param budget the budget, or NULL for none
+ * @param nodes the number of nodes visited
+ * @return false if the budget is spent, and the query must return
+ * the results found so far
+ */
+bool BinaryDictionary::spend(QueryBudget* budget, int nodes) const {
+    if (budget == NULL) return true;
+    if (budget->isPartial()) return false;
+    if (budget->getNodes() == 0 && budget->isLimited()) {
+        __sync_add_and_fetch(&budgets, 1);
+    }
+    if (budget->spend(nodes)) return true;
+    __sync_add_and_fetch(budget->isLate() ? &budgetDeadlines : &budgetNodeLimits, 1);
+    return false;
+}
+
 /**
  * Determine whether a word is present in the unigram trie.
  * @param word the word to look up in the unigram trie
+ * @param caches the caches to use, or NULL for those of the
+ * dictionary
  * @return true if the word is present in the unigram trie
  */
-bool BinaryDictionary::exists(string word) {
-    int unigram = getUnigram(word);
+bool BinaryDictionary::exists(string word, QueryCaches* caches) const {
+    if (!mayExist(word)) {
+        return false;
+    }
+    int unigram = getUnigram(word, caches);
     if (unigram == 0) {
         return false;
     } else {
@@ -62,26 +487,54 @@ bool BinaryDictionary::exists(string word) {
 
 /**
  * Get the weighted next word predictions predictions of an ngram.
+ * The predictions of a context are kept in the prediction cache,
+ * keyed by the addresses of its words and the number of desired
+ * predictions, so that repeated contexts need no ngram lookup.
  * @param words a list of words constituting the ngram
  * @param numWords the number of words in the ngram
  * @param predictions an empty holder to fill up with predictions
  * @param numPredictions the maximum number of desired predictions
+ * @param caches the caches to use, or NULL for those of the
+ * dictionary
+ * @param budget the budget of the query, or NULL for none; the
+ * predictions of a spent budget are not cached
  * @return the number of predictions found, but at most numPredictions
  */
-vector<weighted_string> BinaryDictionary::getPredictions(string* words, int numWords, vector<weighted_string> predictions, int maxPredictions) {
+vector<weighted_string> BinaryDictionary::getPredictions(string* words, int numWords, vector<weighted_string> predictions, int maxPredictions, QueryCaches* caches, QueryBudget* budget) const {
     int unigrams[numWords];
-    getUnigrams(words, unigrams, numWords);
-    int ngram = getNgram(unigrams, numWords);
+    getUnigrams(words, unigrams, numWords, caches);
+
+    ngram_key key;
+    bool cached = CACHE_ENABLED && maxPredictions <= MAX_CACHED_PREDICTIONS && getNgramCacheKey(unigrams, numWords, &key);
+    vector<weighted_string> found;
+    if (cached) {
+        key.second |= (unsigned long long) maxPredictions << 48;
+        if (caches == NULL) caches = &sharedCaches;
+        if (caches->getPredictions(key, &found)) {
+            predictions.insert(predictions.end(), found.begin(), found.end());
+            return predictions;
+        }
+    }
+
+    int ngram = getNgram(unigrams, numWords, caches);
+    int numChildren = 0;
     weighted_int children[maxPredictions];
-    int numChildren = getNgramChildren(ngram, children, maxPredictions);
+    if (ngram > 0) {
+        numChildren = getNgramChildren(ngram, children, maxPredictions);
+    }
     for (int i = 0; i < numChildren; i++) {
+        if (!spend(budget, 1)) break;
         int unigram = getUnigramFromNgram(children[i].value);
         int ancestors[MAX_WORD_LENGTH];
         int numAncestors = getAncestors(unigram, ancestors);
         string word = constructWord(ancestors, numAncestors);
         weighted_string prediction = BinaryDictionary::createWeightedString(word, children[i].weight);
-        predictions.push_back(prediction);
+        found.push_back(prediction);
     }
+    if (cached && (budget == NULL || !budget->isPartial())) {
+        caches->putPredictions(key, found);
+    }
+    predictions.insert(predictions.end(), found.begin(), found.end());
     return predictions;
 }
 
@@ -94,14 +547,43 @@ vector<weighted_string> BinaryDictionary::getPredictions(string* words, int numW
  * @param word the word to correct
  * @param corrections the list of corrections
  * @param maxCorrections the maximum number of desired corrections
+ * @param caches the caches to use, or NULL for those of the
+ * dictionary
  * 
+ * If an error model is set, corrections are ranked by decreasing
+ * P(typo|word)P(word) instead, cf. getRankedCorrections(). If the
+ * dictionary holds unigram max weights, corrections are found by a
+ * best-first search returning only the maxCorrections best ones,
+ * cf. searchCandidates(). Common misspellings listed in the
+ * dictionary are corrected first, by a single hash table lookup,
+ * in which case their listed correction is the only one returned.
+ *
+ * Given a budget, the search stops once it is spent, and returns the
+ * corrections found so far.
+ *
  * @return the number of corrections found, but at most maxCorrections
  */
-vector<weighted_string> BinaryDictionary::getCorrections(string word, vector<weighted_string> corrections, int maxCorrections) {
+vector<weighted_string> BinaryDictionary::getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, QueryCaches* caches, QueryBudget* budget) const {
     if (maxCorrections == 0) return corrections;
 
+    weighted_string correction;
+    if (getMisspellingCorrection(word, &correction)) {
+        corrections.push_back(correction);
+        return corrections;
+    }
+
+    if (errorModel != NULL) return getRankedCorrections(word, corrections, maxCorrections, caches, budget);
+
+    if (getSection(SECTION_UNIGRAM_MAX_WEIGHTS, NULL) > 0) {
+        vector<scored_word> candidates = searchCandidates(word, &uniformModel, maxCorrections, budget);
+        for (int i = 0; i < candidates.size(); i++) {
+            corrections.push_back(BinaryDictionary::createWeightedString(candidates[i].value, candidates[i].weight));
+        }
+        return corrections;
+    }
+
     try {
-        weighted_string ww = getWeightedWord(word);
+        weighted_string ww = getWeightedWord(word, caches);
         if (ww.weight > 0) {
             corrections.push_back(ww);
             return corrections;
@@ -112,7 +594,7 @@ vector<weighted_string> BinaryDictionary::getCorrections(string word, vector<wei
     // Corrections of edit distance 1
     vector<string> variations;
     variations = Corrector::variations(word, variations);
-    corrections = known(variations, corrections);
+    corrections = known(variations, corrections, caches, budget);
 
     if (corrections.size() > 0) {
         return corrections;
@@ -124,8 +606,658 @@ vector<weighted_string> BinaryDictionary::getCorrections(string word, vector<wei
     return corrections;
 }
 
-// TODO
-// weighted_string[] BinaryDictionary::getCompletions(string word, int depth) {}
+/**
+ * Get spelling corrections of a word, ranked by the noisy channel
+ * score, cf. getCandidates().
+ *
+ * @param word the word to correct
+ * @param corrections the list of corrections
+ * @param maxCorrections the maximum number of desired corrections
+ * @return the corrections, best first
+ */
+vector<weighted_string> BinaryDictionary::getRankedCorrections(string word, vector<weighted_string> corrections, int maxCorrections, QueryCaches* caches, QueryBudget* budget) const {
+    vector<scored_word> candidates = getCandidates(word, errorModel, maxCorrections, caches, budget);
+    for (int i = 0; i < candidates.size(); i++) {
+        corrections.push_back(BinaryDictionary::createWeightedString(candidates[i].value, candidates[i].weight));
+    }
+    return corrections;
+}
+
+/**
+ * Get spelling corrections of a word, taking into account the words
+ * preceding it. Corrections are ranked as in getRankedCorrections()
+ * (with uniform edit costs if no error model is set), except that
+ * the candidates which are known continuations of the context in the
+ * ngram trie get their score boosted by the log of the ngram weight.
+ *
+ * The context is looked up only once, and its children are
+ * intersected with the candidates by a sorted merge on the unigram
+ * addresses. If the word is known, it is returned as is, and if it
+ * is a listed misspelling, its correction alone is returned.
+ *
+ * @param words the words preceding the word to correct
+ * @param numWords the number of words in the context
+ * @param word the word to correct
+ * @param corrections the list of corrections
+ * @param maxCorrections the maximum number of desired corrections
+ * @param caches the caches to use, or NULL for those of the
+ * dictionary
+ * @param budget the budget of the query, or NULL for none; once it is
+ * spent, the candidates found so far are ranked without the context
+ * @return the corrections, best first
+ */
+vector<weighted_string> BinaryDictionary::getCorrections(string* words, int numWords, string word, vector<weighted_string> corrections, int maxCorrections, QueryCaches* caches, QueryBudget* budget) const {
+    if (maxCorrections == 0) return corrections;
+
+    weighted_string correction;
+    if (getMisspellingCorrection(word, &correction)) {
+        corrections.push_back(correction);
+        return corrections;
+    }
+
+    vector<scored_word> candidates = getCandidates(word, errorModel != NULL ? errorModel : &uniformModel, MAX_CONTEXT_CANDIDATES, caches, budget);
+
+    if (numWords > 0 && candidates.size() > 1 && spend(budget, numWords)) {
+        int unigrams[numWords];
+        getUnigrams(words, unigrams, numWords, caches);
+        int ngram = getNgram(unigrams, numWords, caches);
+        if (ngram > 0) {
+            int numChildren = (unsigned char) bytes[ngram + 4];
+            weighted_int children[numChildren];
+            getNgramChildren(ngram, children, numChildren);
+            for (int i = 0; i < numChildren; i++) {
+                children[i].value = getUnigramFromNgram(children[i].value);
+            }
+            sort(children, children + numChildren, compareValue);
+            sort(candidates.begin(), candidates.end(), compareUnigram);
+
+            int i = 0, j = 0;
+            while (i < candidates.size() && j < numChildren) {
+                if (candidates[i].unigram < children[j].value) {
+                    i++;
+                } else if (candidates[i].unigram > children[j].value) {
+                    j++;
+                } else {
+                    candidates[i].score += log(1.0f + children[j].weight);
+                    i++;
+                    j++;
+                }
+            }
+            stable_sort(candidates.begin(), candidates.end(), compareScore);
+        }
+    }
+
+    for (int i = 0; i < candidates.size() && i < maxCorrections; i++) {
+        corrections.push_back(BinaryDictionary::createWeightedString(candidates[i].value, candidates[i].weight));
+    }
+    return corrections;
+}
+
+/**
+ * Return the known variations of a word of edit distance at most 1,
+ * ranked by the noisy channel score log P(word) - cost(typo|word),
+ * where P(word) is given by the unigram weight and the cost by the
+ * error model. If the word itself is known, it is the only candidate.
+ *
+ * Variations are looked up cheapest first, and the lookup stops as
+ * soon as no remaining variation can make it into the top
+ * maxCandidates, even with the maximum weight. Variations costing
+ * more than MAX_CORRECTION_COST are not looked up at all.
+ *
+ * If the dictionary holds unigram max weights, the candidates are
+ * found by searchCandidates() instead.
+ *
+ * @param word the word to correct
+ * @param model the error model
+ * @param maxCandidates the maximum number of candidates
+ * @param budget the budget of the search, or NULL for none, spent
+ * by variation looked up
+ * @return the candidates, best first
+ */
+vector<scored_word> BinaryDictionary::getCandidates(string word, ErrorModel* model, int maxCandidates, QueryCaches* caches, QueryBudget* budget) const {
+    if (getSection(SECTION_UNIGRAM_MAX_WEIGHTS, NULL) > 0) {
+        return searchCandidates(word, model, maxCandidates, budget);
+    }
+
+    vector<scored_word> ranked;
+    int unigram = getUnigram(word, caches);
+    if (unigram > 0 && isFinalUnigram(unigram)) {
+        scored_word candidate;
+        candidate.value = word;
+        candidate.unigram = unigram;
+        candidate.weight = getUnigramWeight(unigram);
+        candidate.score = log((float) candidate.weight);
+        ranked.push_back(candidate);
+        return ranked;
+    }
+
+    vector<weighted_variation> holder;
+    vector<weighted_variation> variations = Corrector::variations(word, model, MAX_CORRECTION_COST, holder);
+    float maxLogWeight = log((float) MAX_WEIGHT);
+
+    std::tr1::unordered_set<int> seen;
+    for (int i = 0; i < variations.size(); i++) {
+        if (ranked.size() >= maxCandidates &&
+                maxLogWeight - variations[i].cost <= ranked.back().score) {
+            break;
+        }
+        if (!mayExist(variations[i].value)) continue;
+        if (!spend(budget, 1)) break;
+        unigram = getUnigram(variations[i].value, caches);
+        if (unigram == 0 || !isFinalUnigram(unigram) || !seen.insert(unigram).second) {
+            continue;
+        }
+        scored_word candidate;
+        candidate.value = variations[i].value;
+        candidate.unigram = unigram;
+        candidate.weight = getUnigramWeight(unigram);
+        candidate.score = log((float) candidate.weight) - variations[i].cost;
+        vector<scored_word>::iterator pos = upper_bound(ranked.begin(), ranked.end(), candidate, compareScore);
+        ranked.insert(pos, candidate);
+        if (ranked.size() > maxCandidates) {
+            ranked.pop_back();
+        }
+    }
+    return ranked;
+}
+
+/**
+ * Find the best corrections of a word by a best-first search of the
+ * unigram trie, where each step either matches the next character
+ * of the typed word, or applies an edit priced by the error model.
+ *
+ * States are expanded by increasing number of edits, and then by
+ * increasing cost - log(w), where w is the maximum weight in the
+ * subtree of the state's node. Since neither can decrease along a
+ * path, words come out of the search in the order of their noisy
+ * channel score within each edit distance, and the search stops
+ * as soon as maxCandidates words are found. As in Norvig's
+ * corrector, only the words of the smallest edit distance (up to
+ * MAX_CORRECTION_EDITS) are returned, so a known word is returned
+ * alone.
+ *
+ * Without unigram max weights in the dictionary, all subtrees are
+ * bounded by MAX_WEIGHT, which is correct but visits more nodes.
+ *
+ * @param word the word to correct
+ * @param model the error model
+ * @param maxCandidates the maximum number of candidates
+ * @param budget the budget of the search, or NULL for none, spent
+ * by state expanded
+ * @return the candidates, best first
+ */
+vector<scored_word> BinaryDictionary::searchCandidates(string word, ErrorModel* model, int maxCandidates, QueryBudget* budget) const {
+    vector<scored_word> ranked;
+    int length = word.length();
+    if (length == 0 || length > MAX_WORD_LENGTH || maxCandidates <= 0) {
+        return ranked;
+    }
+
+    priority_queue<search_state, vector<search_state>, compareSearchState> queue;
+    std::tr1::unordered_set<long long> expanded;
+    std::tr1::unordered_set<int> found;
+    int maxEdits = MAX_CORRECTION_EDITS;
+
+    search_state root;
+    root.node = getUnigramsOffset();
+    root.pos = 0;
+    root.edits = 0;
+    root.cost = 0;
+    root.priority = -log((float) max(1, getMaxWeight(root.node)));
+    root.final = false;
+    queue.push(root);
+
+    while (!queue.empty()) {
+        search_state state = queue.top();
+        queue.pop();
+        if (state.edits > maxEdits) break;
+
+        if (state.final) {
+            if (!found.insert(state.node).second) continue;
+            int ancestors[MAX_WORD_LENGTH + MAX_CORRECTION_EDITS];
+            int numAncestors = getAncestors(state.node, ancestors);
+            scored_word candidate;
+            candidate.value = constructWord(ancestors, numAncestors);
+            candidate.unigram = state.node;
+            candidate.weight = getUnigramWeight(state.node);
+            candidate.score = -state.priority;
+            ranked.push_back(candidate);
+            // Only keep the words of the smallest edit distance
+            maxEdits = state.edits;
+            if (ranked.size() >= maxCandidates) break;
+            continue;
+        }
+
+        long long key = ((long long) state.node << 8) | (state.pos << 2) | state.edits;
+        if (!expanded.insert(key).second) continue;
+        if (!spend(budget, 1)) break;
+
+        if (state.pos == length && state.node != getUnigramsOffset() && isFinalUnigram(state.node)) {
+            search_state final = state;
+            final.priority = state.cost - log((float) getUnigramWeight(state.node));
+            final.final = true;
+            queue.push(final);
+        }
+
+        search_state next;
+        next.final = false;
+        bool canEdit = state.edits < maxEdits;
+        int numChildren = (unsigned char) bytes[state.node + 2];
+        for (int i = 0; i < numChildren; i++) {
+            int child = toInt(bytes, state.node + 6 + 3*i, 3);
+            char c = bytes[child];
+            int bound = getMaxWeight(child);
+            if (bound == 0) continue;
+            float priority = -log((float) bound);
+            next.node = child;
+
+            if (state.pos < length) {
+                if (c == word[state.pos]) {
+                    // Match
+                    next.pos = state.pos + 1;
+                    next.edits = state.edits;
+                    next.cost = state.cost;
+                    next.priority = next.cost + priority;
+                    queue.push(next);
+                } else if (canEdit) {
+                    // Substitution
+                    float cost = model->substitutionCost(word[state.pos], c);
+                    if (cost <= MAX_CORRECTION_COST) {
+                        next.pos = state.pos + 1;
+                        next.edits = state.edits + 1;
+                        next.cost = state.cost + cost;
+                        next.priority = next.cost + priority;
+                        queue.push(next);
+                    }
+                }
+                // Transposition: the typed word has c and the next
+                // character the other way around
+                if (canEdit && state.pos + 1 < length && c == word[state.pos + 1] && c != word[state.pos]) {
+                    float cost = model->transpositionCost(word[state.pos], c);
+                    int numGrandChildren = (unsigned char) bytes[child + 2];
+                    for (int j = 0; j < numGrandChildren && cost <= MAX_CORRECTION_COST; j++) {
+                        int grandChild = toInt(bytes, child + 6 + 3*j, 3);
+                        if (bytes[grandChild] != word[state.pos]) continue;
+                        int grandChildBound = getMaxWeight(grandChild);
+                        if (grandChildBound == 0) break;
+                        search_state transposed;
+                        transposed.node = grandChild;
+                        transposed.pos = state.pos + 2;
+                        transposed.edits = state.edits + 1;
+                        transposed.cost = state.cost + cost;
+                        transposed.priority = transposed.cost - log((float) grandChildBound);
+                        transposed.final = false;
+                        queue.push(transposed);
+                        break;
+                    }
+                }
+            }
+
+            if (canEdit) {
+                // The typed word is missing c
+                float cost = model->deletionCost(c);
+                if (cost <= MAX_CORRECTION_COST) {
+                    next.pos = state.pos;
+                    next.edits = state.edits + 1;
+                    next.cost = state.cost + cost;
+                    next.priority = next.cost + priority;
+                    queue.push(next);
+                }
+            }
+        }
+
+        if (canEdit && state.pos < length) {
+            // The typed word has an extra character
+            float cost = model->insertionCost(word[state.pos]);
+            if (cost <= MAX_CORRECTION_COST) {
+                next = state;
+                next.pos = state.pos + 1;
+                next.edits = state.edits + 1;
+                next.cost = state.cost + cost;
+                next.priority = state.priority + cost;
+                queue.push(next);
+            }
+        }
+    }
+    return ranked;
+}
+
+/**
+ * Get spelling corrections of a word of edit distance at most
+ * maxDistance. In CORRECTION_EDITS mode, this is the same as
+ * getCorrections(word, corrections, maxCorrections). In
+ * CORRECTION_TRIGRAMS mode, candidates are shortlisted using the
+ * trigram index, cf. getTrigramCandidates(), and are ranked by
+ * increasing edit distance, and then by decreasing weight. This
+ * falls back to CORRECTION_EDITS mode if the dictionary has no
+ * trigram index, or if the word is too short for the index to
+ * rule out any word. In both modes, the correction of a listed
+ * misspelling is returned alone.
+ *
+ * @param word the word to correct
+ * @param corrections the list of corrections
+ * @param maxCorrections the maximum number of desired corrections
+ * @param mode how to look for candidates
+ * @param maxDistance the maximum edit distance of a correction
+ * @param caches the caches to use, or NULL for those of the
+ * dictionary
+ * @param budget the budget of the query, or NULL for none
+ * @return the corrections, best first
+ */
+vector<weighted_string> BinaryDictionary::getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, CorrectionMode mode, int maxDistance, QueryCaches* caches, QueryBudget* budget) const {
+    weighted_string correction;
+    if (maxCorrections > 0 && getMisspellingCorrection(word, &correction)) {
+        corrections.push_back(correction);
+        return corrections;
+    }
+
+    vector<scored_word> candidates;
+    if (mode == CORRECTION_EDITS || maxCorrections == 0 ||
+            !getTrigramCandidates(word, maxDistance, maxCorrections, &candidates, budget)) {
+        return getCorrections(word, corrections, maxCorrections, caches, budget);
+    }
+    for (int i = 0; i < candidates.size(); i++) {
+        corrections.push_back(BinaryDictionary::createWeightedString(candidates[i].value, candidates[i].weight));
+    }
+    return corrections;
+}
+
+/**
+ * Find the best words within maxDistance edits of a word using the
+ * trigram index. Since an edit changes at most 4 of the trigrams of
+ * a word (a transposition in the middle of it), a word within
+ * maxDistance edits shares at least t - 4 * maxDistance of the t
+ * distinct trigrams of the word. The posting lists of these trigrams
+ * are merged, counting the occurrences of each word, and the words
+ * above the threshold, and whose length is within maxDistance of the
+ * length of the word, are verified with the exact edit distance.
+ *
+ * @param word the word to correct
+ * @param maxDistance the maximum edit distance of a candidate
+ * @param maxCandidates the maximum number of candidates
+ * @param candidates a holder for the candidates, best first
+ * @param budget the budget of the search, or NULL for none, spent
+ * by posting merged
+ * @return false if the index cannot be used for this word
+ */
+bool BinaryDictionary::getTrigramCandidates(string word, int maxDistance, int maxCandidates, vector<scored_word>* candidates, QueryBudget* budget) const {
+    if (getSection(SECTION_TRIGRAM_INDEX, NULL) == 0 || word.length() > MAX_WORD_LENGTH) {
+        return false;
+    }
+
+    string padded = "$" + word + "$";
+    vector<string> trigrams;
+    for (int i = 0; i + 3 <= padded.length(); i++) {
+        trigrams.push_back(padded.substr(i, 3));
+    }
+    sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    int threshold = trigrams.size() - 4 * maxDistance;
+    if (threshold <= 0) {
+        return false;
+    }
+
+    priority_queue<posting_cursor, vector<posting_cursor>, comparePostingCursor> cursors;
+    for (int i = 0; i < trigrams.size(); i++) {
+        posting_cursor cursor;
+        cursor.pos = getTrigramPostings(trigrams[i].data(), &cursor.remaining);
+        cursor.value = 0;
+        if (cursor.pos > 0 && nextPosting(bytes, &cursor)) {
+            cursors.push(cursor);
+        }
+    }
+    if (cursors.size() < threshold) {
+        return true;
+    }
+
+    vector<scored_word> ranked;
+    while (!cursors.empty() && spend(budget, 1)) {
+        int unigram = cursors.top().value;
+        int length = cursors.top().length;
+        int count = 0;
+        while (!cursors.empty() && cursors.top().value == unigram) {
+            posting_cursor cursor = cursors.top();
+            cursors.pop();
+            count++;
+            if (nextPosting(bytes, &cursor)) {
+                cursors.push(cursor);
+            }
+        }
+        if (count < threshold || abs(length - (int) word.length()) > maxDistance) continue;
+
+        int ancestors[MAX_WORD_LENGTH];
+        int numAncestors = getAncestors(unigram, ancestors);
+        string candidate = constructWord(ancestors, numAncestors);
+        int distance = Corrector::distance(word, candidate, maxDistance);
+        if (distance > maxDistance) continue;
+
+        scored_word scored;
+        scored.value = candidate;
+        scored.unigram = unigram;
+        scored.weight = getUnigramWeight(unigram);
+        scored.score = log((float) scored.weight) - distance * ERROR_MODEL_DEFAULT_COST;
+        vector<scored_word>::iterator pos = upper_bound(ranked.begin(), ranked.end(), scored, compareScore);
+        ranked.insert(pos, scored);
+        if (ranked.size() > maxCandidates) {
+            ranked.pop_back();
+        }
+    }
+    candidates->insert(candidates->end(), ranked.begin(), ranked.end());
+    return true;
+}
+
+/**
+ * Get completions of a word, that is, known words of which it is a
+ * strict prefix, and which are at most 'depth' characters longer.
+ * For instance,
+ *
+ * getCompletions('yo', 1) => [{'you':200}]
+ * getCompletions('yo', 2) => [{'you':200}, {'your':100}]
+ *
+ * @param word the word to complete
+ * @param depth the maximum number of characters to add to the word
+ * @param completions the list of completions
+ * @param maxCompletions the maximum number of desired completions
+ * @param caches the caches to use, or NULL for those of the
+ * dictionary
+ * @param budget the budget of the query, or NULL for none
+ * @return the completions, by decreasing weight
+ */
+vector<weighted_string> BinaryDictionary::getCompletions(string word, int depth, vector<weighted_string> completions, int maxCompletions, QueryCaches* caches, QueryBudget* budget) const {
+    if (maxCompletions <= 0 || depth <= 0) return completions;
+    int node = getUnigram(word, caches);
+    if (node == 0) return completions;
+    vector<weighted_string> descendants = getDescendants(node, word, depth, maxCompletions, budget);
+    completions.insert(completions.end(), descendants.begin(), descendants.end());
+    return completions;
+}
+
+/**
+ * Get the completions of the words close to a word, for instance
+ * while the word is being typed with a typo. A completion is a word
+ * which has a prefix within maxDistance edits (insertions, deletions,
+ * substitutions and transpositions) of the word, e.g.
+ *
+ * getFuzzyCompletions('teh', 2, 1) => [{'three':150}, {'there':140}]
+ *
+ * Completions are ranked by distance, and then by weight, so that
+ * completions of the word itself come first. The word itself is not
+ * returned.
+ *
+ * The unigram trie is searched best-first, carrying the edit
+ * distance row of each node from its parent's: subtrees whose row
+ * has no entry within maxDistance are pruned, and the others are
+ * expanded by increasing distance and decreasing max weight. Once a
+ * subtree can no longer come closer to the word, its rows are no
+ * longer computed.
+ *
+ * @param word the word to complete
+ * @param completions the list of completions
+ * @param maxCompletions the maximum number of desired completions
+ * @param maxDistance the maximum number of edits
+ * @param budget the budget of the query, or NULL for none, spent by
+ * node expanded
+ * @return the completions, by distance and decreasing weight
+ */
+vector<weighted_string> BinaryDictionary::getFuzzyCompletions(string word, vector<weighted_string> completions, int maxCompletions, int maxDistance, QueryBudget* budget) const {
+    int length = word.length();
+    if (length > MAX_WORD_LENGTH || maxCompletions <= 0 || maxDistance < 0) {
+        return completions;
+    }
+
+    vector<fuzzy_node> visited;
+    vector<unsigned char> rows;
+    priority_queue<fuzzy_state, vector<fuzzy_state>, compareFuzzyState> queue;
+    int found = 0;
+
+    fuzzy_node root;
+    root.node = getUnigramsOffset();
+    root.parent = -1;
+    root.distance = length;
+    root.row = 0;
+    for (int j = 0; j <= length; j++) {
+        rows.push_back(j);
+    }
+    visited.push_back(root);
+
+    fuzzy_state start;
+    start.path = 0;
+    start.distance = 0;
+    start.weight = getMaxWeight(root.node);
+    start.final = false;
+    queue.push(start);
+
+    while (!queue.empty() && found < maxCompletions) {
+        fuzzy_state state = queue.top();
+        queue.pop();
+
+        if (state.final) {
+            string completion = "";
+            for (int i = state.path; i > 0; i = visited[i].parent) {
+                completion = bytes[visited[i].node] + completion;
+            }
+            if (completion == word) continue;
+            completions.push_back(BinaryDictionary::createWeightedString(completion, state.weight));
+            found++;
+            continue;
+        }
+
+        if (!spend(budget, 1)) break;
+        fuzzy_node parent = visited[state.path];
+        if (state.path > 0 && parent.distance <= maxDistance) {
+            int weight = getUnigramWeight(parent.node);
+            if (weight > 0) {
+                fuzzy_state final = state;
+                final.distance = parent.distance;
+                final.weight = weight;
+                final.final = true;
+                queue.push(final);
+            }
+        }
+
+        int numChildren = (unsigned char) bytes[parent.node + 2];
+        for (int i = 0; i < numChildren; i++) {
+            fuzzy_node next;
+            next.node = toInt(bytes, parent.node + 6 + 3*i, 3);
+            next.parent = state.path;
+            next.distance = parent.distance;
+            next.row = -1;
+            int bound = getMaxWeight(next.node);
+            if (bound == 0) continue;
+
+            int lowest = parent.distance;
+            if (parent.row >= 0) {
+                // Optimal string alignment distance, one row per trie level
+                char c = bytes[next.node];
+                int depth = rows[parent.row] + 1;
+                int grandparent = state.path > 0 ? visited[parent.parent].row : -1;
+                char previous = bytes[parent.node];
+                int row = rows.size();
+                rows.push_back(depth);
+                int rowMin = depth;
+                for (int j = 1; j <= length; j++) {
+                    int d = min(rows[parent.row + j] + 1, rows[row + j - 1] + 1);
+                    d = min(d, rows[parent.row + j - 1] + (word[j-1] == c ? 0 : 1));
+                    if (grandparent >= 0 && j > 1 && word[j-1] == previous && word[j-2] == c) {
+                        d = min(d, rows[grandparent + j - 2] + 1);
+                    }
+                    rows.push_back(d);
+                    rowMin = min(rowMin, d);
+                }
+                next.distance = min(parent.distance, (int) rows[row + length]);
+                if (rowMin <= maxDistance) {
+                    next.row = row;
+                    lowest = min(next.distance, rowMin);
+                } else {
+                    // Rows only grow from here on
+                    rows.resize(row);
+                    lowest = next.distance;
+                }
+            }
+            if (lowest > maxDistance) continue;
+
+            fuzzy_state child;
+            child.path = visited.size();
+            child.distance = lowest;
+            child.weight = bound;
+            child.final = false;
+            visited.push_back(next);
+            queue.push(child);
+        }
+    }
+    return completions;
+}
+
+/**
+ * Get the heaviest completions of a word, whatever their length.
+ * For instance,
+ *
+ * getTopCompletions('h', 2) => [{'how':150}, {'hi':130}]
+ *
+ * If the dictionary holds a precomputed list of top completions for
+ * the word, and it is long enough, it is returned as is. Otherwise,
+ * if the dictionary holds unigram max weights, this is a best-first
+ * search which only visits the nodes needed to prove the top
+ * completions, cf. getHeaviestDescendants(). Otherwise the whole
+ * subtree below the word is walked.
+ *
+ * @param word the word to complete
+ * @param completions the list of completions
+ * @param maxCompletions the maximum number of desired completions
+ * @param caches the caches to use, or NULL for those of the
+ * dictionary
+ * @param budget the budget of the query, or NULL for none; listed
+ * completions are returned whatever the budget
+ * @return the completions, by decreasing weight
+ */
+vector<weighted_string> BinaryDictionary::getTopCompletions(string word, vector<weighted_string> completions, int maxCompletions, QueryCaches* caches, QueryBudget* budget) const {
+    if (maxCompletions <= 0) return completions;
+    int node = getUnigram(word, caches);
+    if (node == 0) return completions;
+    int listSize;
+    int list = getTopCompletionList(node, &listSize);
+    int numListed = list > 0 ? (unsigned char) bytes[list + 3] : 0;
+    if (list > 0 && (numListed >= maxCompletions || numListed < listSize)) {
+        for (int i = 0; i < numListed && i < maxCompletions; i++) {
+            int completion = toInt(bytes, list + 4 + 3*i, 3);
+            string suffix = "";
+            for (int n = completion; n != node; n = getParent(n)) {
+                suffix = bytes[n] + suffix;
+            }
+            completions.push_back(BinaryDictionary::createWeightedString(word + suffix, getUnigramWeight(completion)));
+        }
+        return completions;
+    }
+
+    vector<weighted_string> descendants;
+    if (getSection(SECTION_UNIGRAM_MAX_WEIGHTS, NULL) > 0) {
+        descendants = getHeaviestDescendants(node, word, maxCompletions, budget);
+    } else {
+        descendants = getDescendants(node, word, MAX_WORD_LENGTH, maxCompletions, budget);
+    }
+    completions.insert(completions.end(), descendants.begin(), descendants.end());
+    return completions;
+}
 
 // TODO
 // weighted_string[] BinaryDictionary::getSuggestions(string word, int depth) {}
@@ -134,7 +1266,7 @@ vector<weighted_string> BinaryDictionary::getCorrections(string word, vector<wei
  * Return the position, in the byte array, of the first unigram node.
  * @return the position of the first unigram node
  */
-int BinaryDictionary::getUnigramsOffset() {
+int BinaryDictionary::getUnigramsOffset() const {
     return 6;
 }
 
@@ -145,11 +1277,8 @@ int BinaryDictionary::getUnigramsOffset() {
  * child nodes.
  * @return the position of the first ngram node
  */
-int BinaryDictionary::getNgramsOffset() {
-    if (ngramsOffset < 0) {
-        ngramsOffset = toInt(bytes, 3, 3);
-    }
-    return (unsigned char) ngramsOffset;
+int BinaryDictionary::getNgramsOffset() const {
+    return ngramsOffset;
 }
 
 /**
@@ -157,7 +1286,7 @@ int BinaryDictionary::getNgramsOffset() {
  * @param node a unigram node
  * @return true if the node has positive weight
  */
-bool BinaryDictionary::isFinalUnigram(int node) {
+bool BinaryDictionary::isFinalUnigram(int node) const {
     return getUnigramWeight(node) > 0;
 }
 
@@ -166,16 +1295,156 @@ bool BinaryDictionary::isFinalUnigram(int node) {
  * @param node a unigram node
  * @return the weight of the unigram node
  */
-int BinaryDictionary::getUnigramWeight(int node) {
+int BinaryDictionary::getUnigramWeight(int node) const {
     return (unsigned char) bytes[node+1];
 }
 
+/**
+ * Return the maximum weight of a final node in the subtree of a
+ * unigram node, or MAX_WEIGHT if the dictionary does not hold
+ * unigram max weights.
+ * @param node a unigram node
+ * @return an upper bound on the weights in the subtree of the node
+ */
+int BinaryDictionary::getMaxWeight(int node) const {
+    int offset = getSection(SECTION_UNIGRAM_MAX_WEIGHTS, NULL);
+    if (offset == 0) {
+        return MAX_WEIGHT;
+    }
+    return (unsigned char) bytes[offset + node - getUnigramsOffset()];
+}
+
+/**
+ * Look up a word in the table of common misspellings.
+ * @param word the word to look up
+ * @param correction a holder for the correction of the word
+ * @return true if the word is a listed misspelling
+ */
+bool BinaryDictionary::getMisspellingCorrection(string word, weighted_string* correction) const {
+    int offset = getSection(SECTION_MISSPELLINGS, NULL);
+    if (offset == 0) {
+        return false;
+    }
+    unsigned int numSlots = toInt(bytes, offset, 3);
+    if (numSlots == 0) {
+        return false;
+    }
+    unsigned int slot = fnvHash(word) & (numSlots - 1);
+    for (int i = 0; i < numSlots; i++) {
+        int entry = toInt(bytes, offset + 3 + 3*slot, 3);
+        if (entry == 0) {
+            return false;
+        }
+        entry += offset;
+        int length = (unsigned char) bytes[entry + 3];
+        if (length == word.length() && memcmp(bytes + entry + 4, word.data(), length) == 0) {
+            int unigram = toInt(bytes, entry, 3);
+            int correctionLength = (unsigned char) bytes[entry + 4 + length];
+            correction->value = string(bytes + entry + 5 + length, correctionLength);
+            correction->weight = getUnigramWeight(unigram);
+            return true;
+        }
+        slot = (slot + 1) & (numSlots - 1);
+    }
+    return false;
+}
+
+/**
+ * Look up the posting list of a trigram in the trigram index.
+ * @param trigram the three characters of the trigram
+ * @param numPostings a holder for the number of postings
+ * @return the position of the posting list, or 0 if the trigram
+ * is not in the index
+ */
+int BinaryDictionary::getTrigramPostings(const char* trigram, int* numPostings) const {
+    int offset = getSection(SECTION_TRIGRAM_INDEX, NULL);
+    if (offset == 0) {
+        return 0;
+    }
+    int low = 0;
+    int high = toInt(bytes, offset, 3) - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int entry = offset + 3 + 9*middle;
+        int order = memcmp(bytes + entry, trigram, 3);
+        if (order == 0) {
+            *numPostings = toInt(bytes, entry + 6, 3);
+            return offset + toInt(bytes, entry + 3, 3);
+        } else if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check a word against the Bloom filter of the dictionary, if any.
+ * The bits of a word all lie in the same 64 byte block, so that a
+ * word which is not in the dictionary is usually rejected after
+ * reading a single cache line.
+ * @param word the word to look up
+ * @return false if the word is certainly not in the dictionary
+ */
+bool BinaryDictionary::mayExist(string word) const {
+    int offset = getSection(SECTION_BLOOM_FILTER, NULL);
+    if (offset == 0) {
+        return true;
+    }
+    int numHashes = (unsigned char) bytes[offset];
+    int numBlocks = toInt(bytes, offset + 1, 3);
+    unsigned int hash = fnvHash(word);
+    unsigned int second = (hash * 0x5bd1e995u) ^ (hash >> 15);
+    unsigned char* block = (unsigned char*) bytes + offset + 4 + BLOOM_BLOCK_SIZE * (hash % numBlocks);
+    int bit = second & (8*BLOOM_BLOCK_SIZE - 1);
+    int step = (second >> 9) | 1;
+    for (int i = 0; i < numHashes; i++) {
+        if ((block[bit >> 3] & (1 << (bit & 7))) == 0) {
+            return false;
+        }
+        bit = (bit + step) & (8*BLOOM_BLOCK_SIZE - 1);
+    }
+    return true;
+}
+
+/**
+ * Look up the precomputed top completions of a unigram node.
+ * @param node the unigram node
+ * @param maxCompletions a holder for the maximum number of
+ * completions of a node in the section
+ * @return the address of the node's entry, or 0 if there is none
+ */
+int BinaryDictionary::getTopCompletionList(int node, int* maxCompletions) const {
+    int offset = getSection(SECTION_TOP_COMPLETIONS, NULL);
+    if (offset == 0) {
+        return 0;
+    }
+    *maxCompletions = (unsigned char) bytes[offset];
+    int entrySize = 4 + 3 * *maxCompletions;
+    int low = 0;
+    int high = toInt(bytes, offset + 1, 3) - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int entry = offset + 4 + entrySize*middle;
+        int address = toInt(bytes, entry, 3);
+        if (address == node) {
+            return entry;
+        } else if (address < node) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return 0;
+}
+
 /**
  * Return the weight of an ngram node
  * @param node an ngram node
  * @return the weight of the node
  */
-int BinaryDictionary::getNgramWeight(int node) {
+int BinaryDictionary::getNgramWeight(int node) const {
     return (unsigned char) bytes[node+3];
 }
 
@@ -184,8 +1453,17 @@ int BinaryDictionary::getNgramWeight(int node) {
  * @param word the word to look up
  * @return the address of the final node in the word
  */
-int BinaryDictionary::getUnigram(string word) {
-    return getUnigram(word, 0, getUnigramsOffset(), word);
+int BinaryDictionary::getUnigram(string word, QueryCaches* caches) const {
+    if (caches == NULL) caches = &sharedCaches;
+    int unigram;
+    if (CACHE_ENABLED && caches->getUnigram(word, &unigram)) {
+        return unigram;
+    }
+    unigram = getUnigram(word, 0, getUnigramsOffset());
+    if (CACHE_ENABLED && unigram > 0) {
+        caches->putUnigram(word, unigram);
+    }
+    return unigram;
 }
 
 /**
@@ -195,20 +1473,10 @@ int BinaryDictionary::getUnigram(string word) {
  * @param offset the offset in the byte array (= 6 for root node)
  * @return the address of the final node in the word
  */
-int BinaryDictionary::getUnigram(string word, int prefixSize, int offset, string cacheKey) {
-    if (CACHE_ENABLED) {
-        It it = unigramCache.find(cacheKey);
-        if (it != unigramCache.end()) {
-            return it->second;
-        }
-    }
-
+int BinaryDictionary::getUnigram(string word, int prefixSize, int offset) const {
     int length = word.length();
     if (length == 0) {
         if (prefixSize > 0) {
-            if (CACHE_ENABLED) {
-               unigramCache[cacheKey] = offset;
-            }
             return offset;
         }
         return 0;
@@ -222,7 +1490,7 @@ int BinaryDictionary::getUnigram(string word, int prefixSize, int offset, string
     for (int i = 0; i < numChildren; i++) {
         int childPos = toInt(bytes, offset + 6 + 3*i, 3);
         if ((unsigned char) bytes[childPos] == head) {
-            return getUnigram(word.substr(1, length), prefixSize + 1, childPos, cacheKey);
+            return getUnigram(word.substr(1, length), prefixSize + 1, childPos);
         }
     }
 
@@ -236,9 +1504,9 @@ int BinaryDictionary::getUnigram(string word, int prefixSize, int offset, string
  * @param size the number of words in the list
  * @return the number of unigrams found (currently just equal to size)
  */
-int BinaryDictionary::getUnigrams(string* words, int* unigrams, int size) {
+int BinaryDictionary::getUnigrams(string* words, int* unigrams, int size, QueryCaches* caches) const {
     for (int i = 0; i < size; i++) {
-        unigrams[i] = getUnigram(words[i]);
+        unigrams[i] = getUnigram(words[i], caches);
     }
     return size;
 }
@@ -250,26 +1518,27 @@ int BinaryDictionary::getUnigrams(string* words, int* unigrams, int size) {
  * @param size the size of the unigrams array
  * @return the address of the corresponding ngram
  */
-int BinaryDictionary::getNgram(int* unigrams, int size) {
-    return getNgram(unigrams, size, 0, getNgramsOffset() + 3, getNgramCacheKey(unigrams, size));
+int BinaryDictionary::getNgram(int* unigrams, int size, QueryCaches* caches) const {
+    if (caches == NULL) caches = &sharedCaches;
+    ngram_key key;
+    bool cached = CACHE_ENABLED && getNgramCacheKey(unigrams, size, &key);
+    int ngram;
+    if (cached && caches->getNgram(key, &ngram)) {
+        return ngram;
+    }
+    ngram = getNgram(unigrams, size, 0, getNgramsOffset() + 3);
+    if (cached && ngram > 0) {
+        caches->putNgram(key, ngram);
+    }
+    return ngram;
 }
 
 /**
  * Cf. getNgram(int[] unigrams, int size)
  */
-int BinaryDictionary::getNgram(int* unigrams, int unigramsSize, int prefixSize, int offset, string cacheKey) {
-    if (CACHE_ENABLED) {
-        It it = ngramCache.find(cacheKey);
-        if (it != ngramCache.end()) {
-            return it->second;
-        }
-    }
-
+int BinaryDictionary::getNgram(int* unigrams, int unigramsSize, int prefixSize, int offset) const {
     if (unigramsSize == 0) {
         if (prefixSize > 0) {
-            if (CACHE_ENABLED) {
-               ngramCache[cacheKey] = offset;
-            }
             return offset;
         }
         return 0;
@@ -284,26 +1553,217 @@ int BinaryDictionary::getNgram(int* unigrams, int unigramsSize, int prefixSize,
     for (int i = 0; i < numChildren; i++) {
         int childPos = toInt(bytes, offset + 5 + 3*i, 3);
         int childUnigramPos = toInt(bytes, childPos, 3);
-        if ((unsigned char) childUnigramPos == head) {
-            return getNgram(unigrams + 1, unigramsSize - 1, prefixSize + 1, childPos, cacheKey);
+        if (childUnigramPos == head) {
+            return getNgram(unigrams + 1, unigramsSize - 1, prefixSize + 1, childPos);
         }
     }
     return 0;
 }
 
 /**
- * Return the ngram cache key corresponding to a list of unigrams.
- * 
+ * Pack a list of unigrams into an ngram cache key: the 24 bit
+ * addresses of the unigrams, two per 64 bit word, along with the
+ * size of the list, so that distinct lists have distinct keys.
+ *
  * @param unigrams the unigram list
  * @param size the number of unigrams in the list
- * @return the key used in the ngram cache
+ * @param key a holder for the key
+ * @return false if the list is too long to be cached
+ */
+bool BinaryDictionary::getNgramCacheKey(int* unigrams, int size, ngram_key* key) const {
+    if (size > MAX_CACHED_NGRAM_SIZE) {
+        return false;
+    }
+    unsigned long long packed[2] = { (unsigned long long) size << 56, 0 };
+    for (int i = 0; i < size; i++) {
+        packed[i / 2] |= (unsigned long long) (unigrams[i] & 0xffffff) << (24 * (i % 2));
+    }
+    key->first = packed[0];
+    key->second = packed[1];
+    return true;
+}
+
+/**
+ * Set the maximum number of entries of the unigram and ngram caches,
+ * which clears them. A capacity of 0 disables a cache.
+ * @param unigrams the capacity of the unigram cache
+ * @param ngrams the capacity of the ngram cache
+ */
+void BinaryDictionary::setCacheCapacity(int unigrams, int ngrams) {
+    unigramCache.setCapacity(unigrams);
+    ngramCache.setCapacity(ngrams);
+}
+
+/**
+ * Unpack an ngram cache key into the words it stands for, or empty
+ * words for the addresses of unknown words.
+ * @param key the key
+ * @param words a holder for up to MAX_CACHED_NGRAM_SIZE words
+ * @return the number of words
  */
-string BinaryDictionary::getNgramCacheKey(int* unigrams, int size) {
-    string s = "";
+int BinaryDictionary::getNgramCacheWords(ngram_key key, string* words) const {
+    int size = key.first >> 56;
+    unsigned long long packed[2] = { key.first, key.second };
     for (int i = 0; i < size; i++) {
-        s.append("" + unigrams[i]);
+        int unigram = (packed[i / 2] >> (24 * (i % 2))) & 0xffffff;
+        words[i] = "";
+        if (unigram > 0) {
+            int ancestors[MAX_WORD_LENGTH];
+            int numAncestors = getAncestors(unigram, ancestors);
+            words[i] = constructWord(ancestors, numAncestors);
+        }
+    }
+    return size;
+}
+
+/**
+ * Write one entry of a cache keys file.
+ */
+static void writeCacheKey(ofstream& file, int type, string* words, int numWords, int maxPredictions) {
+    file.put(type);
+    file.put(numWords);
+    for (int i = 0; i < numWords; i++) {
+        file.put(words[i].length());
+        file.write(words[i].data(), words[i].length());
+    }
+    if (type == CACHE_KEYS_PREDICTIONS) {
+        file.put(maxPredictions >> 8);
+        file.put(maxPredictions & 0xff);
+    }
+}
+
+/**
+ * Save the keys in the caches, i.e. the words, contexts and
+ * prediction requests which were looked up most recently, so that
+ * another process can warm its caches up with warmUpCaches(). Keys
+ * are saved as words, so that they can be used with another version
+ * of the dictionary. The file starts with 'MSTK', followed by one
+ * entry per key:
+ *
+ * 0       : type (1: word, 2: ngram, 3: predictions)
+ * 1       : number of words
+ * .       : length of word1
+ * ...     : word1
+ * ...     : wordn
+ * .,.     : number of predictions (predictions only)
+ *
+ * @param filename the path to the cache keys file
+ * @return true if the file could be written
+ */
+bool BinaryDictionary::saveCacheKeys(const char * filename) const {
+    ofstream file (filename, ios::out|ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(CACHE_KEYS_MAGIC, 4);
+
+    vector<string> words;
+    unigramCache.getKeys(&words);
+    for (int i = 0; i < words.size(); i++) {
+        writeCacheKey(file, CACHE_KEYS_UNIGRAM, &words[i], 1, 0);
+    }
+
+    string context[MAX_CACHED_NGRAM_SIZE];
+    vector<ngram_key> keys;
+    ngramCache.getKeys(&keys);
+    for (int i = 0; i < keys.size(); i++) {
+        int size = getNgramCacheWords(keys[i], context);
+        writeCacheKey(file, CACHE_KEYS_NGRAM, context, size, 0);
+    }
+
+    keys.clear();
+    predictionCache.getKeys(&keys);
+    for (int i = 0; i < keys.size(); i++) {
+        int maxPredictions = keys[i].second >> 48;
+        keys[i].second &= 0xffffffffffffULL;
+        int size = getNgramCacheWords(keys[i], context);
+        writeCacheKey(file, CACHE_KEYS_PREDICTIONS, context, size, maxPredictions);
+    }
+    file.close();
+    return !file.fail();
+}
+
+/**
+ * Fill the caches up by looking up the keys saved by saveCacheKeys(),
+ * which also brings the pages of the dictionary they touch into
+ * memory. Queries can run meanwhile, cf. startWarmUp().
+ * @param filename the path to the cache keys file
+ * @return the number of keys looked up, or -1 if the file could not
+ * be read
+ */
+int BinaryDictionary::warmUpCaches(const char * filename) {
+    ifstream file (filename, ios::in|ios::binary);
+    char magic[4];
+    if (!file.is_open() || !file.read(magic, 4) || memcmp(magic, CACHE_KEYS_MAGIC, 4) != 0) {
+        return -1;
+    }
+
+    int numKeys = 0;
+    string words[MAX_CACHED_NGRAM_SIZE];
+    while (true) {
+        int type = file.get();
+        int numWords = file.get();
+        if (!file || numWords > MAX_CACHED_NGRAM_SIZE) break;
+        // The size of the keys of other types is unknown
+        if (type != CACHE_KEYS_UNIGRAM && type != CACHE_KEYS_NGRAM && type != CACHE_KEYS_PREDICTIONS) break;
+        for (int i = 0; i < numWords; i++) {
+            int length = file.get();
+            if (!file) break;
+            char buffer[256];
+            file.read(buffer, length);
+            words[i].assign(buffer, length);
+        }
+        int maxPredictions = 0;
+        if (type == CACHE_KEYS_PREDICTIONS) {
+            maxPredictions = file.get() << 8;
+            maxPredictions |= file.get();
+        }
+        if (!file) break;
+
+        if (type == CACHE_KEYS_UNIGRAM && numWords == 1) {
+            getUnigram(words[0], NULL);
+            numKeys++;
+        } else if (type == CACHE_KEYS_NGRAM) {
+            int unigrams[MAX_CACHED_NGRAM_SIZE];
+            getUnigrams(words, unigrams, numWords, NULL);
+            getNgram(unigrams, numWords, NULL);
+            numKeys++;
+        } else if (type == CACHE_KEYS_PREDICTIONS) {
+            vector<weighted_string> holder;
+            getPredictions(words, numWords, holder, maxPredictions);
+            numKeys++;
+        }
+    }
+    return numKeys;
+}
+
+/**
+ * Warm the caches up on a background thread, cf. warmUpCaches().
+ * @param filename the path to the cache keys file
+ */
+void BinaryDictionary::startWarmUp(const char * filename) {
+    waitForWarmUp();
+    warmUpFile = filename;
+    warmingUp = pthread_create(&warmUpThread, NULL, BinaryDictionary::runWarmUp, this) == 0;
+}
+
+/**
+ * Wait for the background warm up, if any, to finish.
+ * @return the number of keys looked up by the last warm up, or -1 if
+ * the file could not be read
+ */
+int BinaryDictionary::waitForWarmUp() {
+    if (warmingUp) {
+        pthread_join(warmUpThread, NULL);
+        warmingUp = false;
     }
-    return s;
+    return warmUpKeys;
+}
+
+void* BinaryDictionary::runWarmUp(void* dictionary) {
+    BinaryDictionary* bindict = (BinaryDictionary*) dictionary;
+    bindict->warmUpKeys = bindict->warmUpCaches(bindict->warmUpFile.c_str());
+    return NULL;
 }
 
 /**
@@ -315,12 +1775,12 @@ string BinaryDictionary::getNgramCacheKey(int* unigrams, int size) {
  * @param limit the maximum number of addresses to return
  * @return the number of children, but not exceeding limit
  */
-int BinaryDictionary::getUnigramChildren(int unigram, weighted_int* children, int limit) {
+int BinaryDictionary::getUnigramChildren(int unigram, weighted_int* children, int limit) const {
     int numChildren = (unsigned char) bytes[unigram + 2];
     int size = min(numChildren, limit);
     for (int i = 0; i < size; i++) {
         int childAddress = toInt(bytes, unigram + 6 + 3*i, 3);
-        int childWeight = bytes[childAddress + 1];
+        int childWeight = (unsigned char) bytes[childAddress + 1];
         weighted_int node;
         node.value = childAddress;
         node.weight = childWeight;
@@ -336,12 +1796,12 @@ int BinaryDictionary::getUnigramChildren(int unigram, weighted_int* children, in
  * ngrams trie instead.
  * @return the number of children, but not exceeding limit
  */
-int BinaryDictionary::getNgramChildren(int ngram, weighted_int* children, int limit) {
+int BinaryDictionary::getNgramChildren(int ngram, weighted_int* children, int limit) const {
     int numChildren = (unsigned char) bytes[ngram + 4];
     int size = min(numChildren, limit);
     for (int i = 0; i < size; i++) {
         int childAddress = toInt(bytes, ngram + 5 + 3*i, 3);
-        int childWeight = bytes[childAddress + 3];
+        int childWeight = (unsigned char) bytes[childAddress + 3];
         weighted_int node;
         node.value = childAddress;
         node.weight = childWeight;
@@ -358,7 +1818,7 @@ int BinaryDictionary::getNgramChildren(int ngram, weighted_int* children, int li
  * @param ngram the node address in the ngram trie
  * @return the address of the unigram it points to
  */
-int BinaryDictionary::getUnigramFromNgram(int ngram) {
+int BinaryDictionary::getUnigramFromNgram(int ngram) const {
     return toInt(bytes, ngram, 3);
 }
 
@@ -368,7 +1828,7 @@ int BinaryDictionary::getUnigramFromNgram(int ngram) {
  * @param node the address of the last child node in the chain
  * @return the number of ancestors, including the node itself
  */
-int BinaryDictionary::getAncestors(int node, int* ancestors) {
+int BinaryDictionary::getAncestors(int node, int* ancestors) const {
     ancestors[0] = node;
 
     int parent = getParent(node);
@@ -395,18 +1855,130 @@ int BinaryDictionary::getAncestors(int node, int* ancestors) {
  * be the address of an ngram node, in which case the
  * return value is wrong.
  */
-int BinaryDictionary::getParent(int node) {
+int BinaryDictionary::getParent(int node) const {
     if (node <= 0) {
         return 0;
     }
     return toInt(bytes, node + 3, 3);
 }
 
-// TODO
-// int BinaryDictionary::getDescendants(int node, int* completions, int depth, int count) {}
+/**
+ * Return the heaviest final nodes below a unigram node, as words. The
+ * subtree is walked depth first with an explicit stack, and the path
+ * from the node is kept in a buffer, so that words are built without
+ * walking back up the parent pointers, and only if they make it into
+ * the heaviest maxDescendants.
+ * @param node the unigram node
+ * @param prefix the word corresponding to the node
+ * @param depth the number of generations below the node to look at
+ * @param maxDescendants the maximum number of words to return
+ * @param budget the budget of the walk, or NULL for none, spent by
+ * node visited
+ * @return the words, by decreasing weight
+ */
+vector<weighted_string> BinaryDictionary::getDescendants(int node, string prefix, int depth, int maxDescendants, QueryBudget* budget) const {
+    vector<weighted_string> heaviest;
+    depth = min(depth, MAX_WORD_LENGTH);
+    char path[MAX_WORD_LENGTH];
+    vector<descent_state> stack;
+    descent_state state;
+    state.node = node;
+    state.level = 0;
+    stack.push_back(state);
 
-// TODO
-// int BinaryDictionary::getDescendants(int node, int* completions, int depth, int count) {}
+    while (!stack.empty() && spend(budget, 1)) {
+        state = stack.back();
+        stack.pop_back();
+        int level = state.level;
+        if (level > 0) {
+            path[level - 1] = bytes[state.node];
+            int weight = getUnigramWeight(state.node);
+            if (weight > 0 && (heaviest.size() < maxDescendants || weight > heaviest.front().weight)) {
+                heaviest.push_back(BinaryDictionary::createWeightedString(prefix + string(path, level), weight));
+                push_heap(heaviest.begin(), heaviest.end(), compareWeight);
+                if (heaviest.size() > maxDescendants) {
+                    pop_heap(heaviest.begin(), heaviest.end(), compareWeight);
+                    heaviest.pop_back();
+                }
+            }
+        }
+        if (level == depth) continue;
+        int numChildren = (unsigned char) bytes[state.node + 2];
+        for (int i = 0; i < numChildren; i++) {
+            descent_state child;
+            child.node = toInt(bytes, state.node + 6 + 3*i, 3);
+            child.level = level + 1;
+            stack.push_back(child);
+        }
+    }
+
+    sort_heap(heaviest.begin(), heaviest.end(), compareWeight);
+    return heaviest;
+}
+
+/**
+ * Return the heaviest final nodes below a unigram node, as words,
+ * by a best-first search over the unigram max weights: subtrees are
+ * expanded by decreasing maximum weight, and a word comes out of the
+ * search once no subtree left can hold a heavier one. The search
+ * stops after maxDescendants words, so it visits the nodes on the
+ * paths to the words returned and their siblings, however large the
+ * subtree. Words are built from the list of visited nodes.
+ * @param node the unigram node
+ * @param prefix the word corresponding to the node
+ * @param maxDescendants the maximum number of words to return
+ * @param budget the budget of the search, or NULL for none, spent by
+ * node expanded
+ * @return the words, by decreasing weight
+ */
+vector<weighted_string> BinaryDictionary::getHeaviestDescendants(int node, string prefix, int maxDescendants, QueryBudget* budget) const {
+    vector<weighted_string> heaviest;
+    vector<path_node> visited;
+    priority_queue<completion_state, vector<completion_state>, compareCompletionState> queue;
+
+    int parent = -1;
+    while (true) {
+        int from = parent < 0 ? node : visited[parent].node;
+        int numChildren = (unsigned char) bytes[from + 2];
+        for (int i = 0; i < numChildren; i++) {
+            completion_state child;
+            path_node visit;
+            visit.node = toInt(bytes, from + 6 + 3*i, 3);
+            visit.parent = parent;
+            child.weight = getMaxWeight(visit.node);
+            if (child.weight == 0) continue;
+            child.path = visited.size();
+            child.final = false;
+            visited.push_back(visit);
+            queue.push(child);
+        }
+
+        // Pop subtrees until one needs to be expanded
+        parent = -1;
+        while (!queue.empty() && heaviest.size() < maxDescendants) {
+            completion_state state = queue.top();
+            queue.pop();
+            if (!state.final) {
+                int weight = getUnigramWeight(visited[state.path].node);
+                if (weight > 0) {
+                    completion_state word = state;
+                    word.weight = weight;
+                    word.final = true;
+                    queue.push(word);
+                }
+                parent = state.path;
+                break;
+            }
+            string suffix = "";
+            for (int i = state.path; i >= 0; i = visited[i].parent) {
+                suffix = bytes[visited[i].node] + suffix;
+            }
+            heaviest.push_back(BinaryDictionary::createWeightedString(prefix + suffix, state.weight));
+        }
+        if (parent < 0 || !spend(budget, 1)) break;
+    }
+    return heaviest;
+}
 
 /**
  * Given a list of (unigram) nodes, reconstruct the
@@ -418,7 +1990,7 @@ int BinaryDictionary::getParent(int node) {
  * root node) and the last is a tail node
  * @return the reconstructed word
  */
-string BinaryDictionary::constructWord(int* nodeList, int numNodes) {
+string BinaryDictionary::constructWord(int* nodeList, int numNodes) const {
     string word = "";
     for (int i = 0; i < numNodes; i++) {
         int value = bytes[nodeList[i]];
@@ -430,8 +2002,9 @@ string BinaryDictionary::constructWord(int* nodeList, int numNodes) {
     return word;
 }
 
-weighted_string BinaryDictionary::getWeightedWord(string word) {
-    int unigram = getUnigram(word);
+weighted_string BinaryDictionary::getWeightedWord(string word, QueryCaches* caches) const {
+    if (!mayExist(word)) throw 0;
+    int unigram = getUnigram(word, caches);
     if (unigram == 0) throw 0;
     weighted_string ww;
     ww.value = word;
@@ -448,13 +2021,14 @@ weighted_string BinaryDictionary::getWeightedWord(string word) {
  * @param words a list a words
  * @param filtered the filtered list
  * @param numWords the number of words in the list
+ * @param budget the budget of the lookups, or NULL for none
  * @return numFiltered the number of elements remaining
  */
-vector<weighted_string> BinaryDictionary::known(vector<string> words, vector<weighted_string> filtered) {
+vector<weighted_string> BinaryDictionary::known(vector<string> words, vector<weighted_string> filtered, QueryCaches* caches, QueryBudget* budget) const {
     int count = 0;
-    for (int i = 0; i < words.size(); i++) {
+    for (int i = 0; i < words.size() && spend(budget, 1); i++) {
         try {
-            weighted_string ww = getWeightedWord(words[i]);
+            weighted_string ww = getWeightedWord(words[i], caches);
             if (ww.weight == 0) {
                 continue;
             }
@@ -10,13 +10,12 @@
 #include <string>
 #include <iostream>
 #include <fstream>
-#include <tr1/unordered_map>
 #include <vector>
+#include <pthread.h>
+#include "errormodel.h"
+#include "cache.h"
 using namespace std;
 
-typedef std::tr1::unordered_map<string, int> Dict;
-typedef Dict::const_iterator It;
-
 
 // TODO:
 // Use Boost tuples instead
@@ -32,6 +31,159 @@ struct weighted_int {
     int weight;
 };
 
+/**
+ * How getCorrections() looks for candidates: by applying edits
+ * to the word, or by shortlisting the words sharing enough
+ * character trigrams with it, which is faster for long words
+ * and large edit distances.
+ */
+enum CorrectionMode {
+    CORRECTION_EDITS,
+    CORRECTION_TRIGRAMS
+};
+
+/**
+ * The key of a list of unigrams in the ngram cache, cf.
+ * getNgramCacheKey().
+ */
+struct ngram_key {
+    unsigned long long first;
+    unsigned long long second;
+
+    bool operator==(const ngram_key& other) const {
+        return first == other.first && second == other.second;
+    }
+};
+
+struct ngram_key_hash {
+    size_t operator()(const ngram_key& key) const {
+        return (size_t) ((key.first * 0x9e3779b97f4a7c15ULL) ^ key.second);
+    }
+};
+
+typedef ShardedCache<string, int> UnigramCache;
+typedef ShardedCache<ngram_key, int, ngram_key_hash> NgramCache;
+typedef ShardedCache<ngram_key, vector<weighted_string>, ngram_key_hash> PredictionCache;
+
+/**
+ * The caches a query looks words, contexts and predictions up in:
+ * those of the dictionary, shared by all threads, or those of a
+ * DictionarySession, used by a single thread.
+ */
+class QueryCaches {
+
+public:
+    virtual ~QueryCaches() {}
+    virtual bool getUnigram(const string& word, int* unigram) = 0;
+    virtual void putUnigram(const string& word, int unigram) = 0;
+    virtual bool getNgram(const ngram_key& key, int* ngram) = 0;
+    virtual void putNgram(const ngram_key& key, int ngram) = 0;
+    virtual bool getPredictions(const ngram_key& key, vector<weighted_string>* predictions) = 0;
+    virtual void putPredictions(const ngram_key& key, const vector<weighted_string>& predictions) = 0;
+};
+
+/**
+ * Query caches made of three caches owned elsewhere, either Cache
+ * or ShardedCache.
+ */
+template <class U, class N, class P>
+class CacheSet : public QueryCaches {
+
+private:
+    U& unigrams;
+    N& ngrams;
+    P& predictions;
+
+public:
+    CacheSet(U& unigrams, N& ngrams, P& predictions)
+            : unigrams(unigrams), ngrams(ngrams), predictions(predictions) {}
+
+    bool getUnigram(const string& word, int* unigram) { return unigrams.get(word, unigram); }
+    void putUnigram(const string& word, int unigram) { unigrams.put(word, unigram); }
+    bool getNgram(const ngram_key& key, int* ngram) { return ngrams.get(key, ngram); }
+    void putNgram(const ngram_key& key, int ngram) { ngrams.put(key, ngram); }
+    bool getPredictions(const ngram_key& key, vector<weighted_string>* found) { return predictions.get(key, found); }
+    void putPredictions(const ngram_key& key, const vector<weighted_string>& found) { predictions.put(key, found); }
+};
+
+/**
+ * The limits of one or more queries: a deadline, and a maximum number
+ * of trie nodes or candidates to visit, either of them 0 for none,
+ * e.g.
+ *
+ * QueryBudget budget(2.0, 0);
+ * corrections = bindict.getCorrections("intellegense", holder, 3, NULL, &budget);
+ * if (budget.isPartial()) ...
+ *
+ * Searches spend the budget as they visit nodes, and the clock is
+ * only read every BUDGET_CLOCK_INTERVAL nodes. Once the budget is
+ * spent, they return the best results found so far, and the budget
+ * is partial. A budget can be shared by the queries of a keystroke,
+ * but not by several threads.
+ */
+class QueryBudget {
+
+private:
+    double deadline;
+    long maxNodes;
+    long nodes;
+    long nextCheck;
+    bool partial;
+    bool late;
+    void (*yield)(void*);
+    void* yieldArg;
+    int yieldInterval;
+    long nextYield;
+
+    bool checkpoint();
+
+public:
+    QueryBudget(double milliseconds, long maxNodes);
+
+    void setYield(int nodes, void (*yield)(void*), void* arg);
+
+    /**
+     * Spend nodes of the budget.
+     * @return false if the budget is spent
+     */
+    bool spend(int count) {
+        if (partial) return false;
+        nodes += count;
+        if (maxNodes > 0 && nodes > maxNodes) {
+            partial = true;
+            return false;
+        }
+        return nodes < nextCheck || checkpoint();
+    }
+
+    /**
+     * Whether the budget has a deadline or a maximum number of nodes,
+     * rather than only a yield function.
+     */
+    bool isLimited() const { return deadline > 0 || maxNodes > 0; }
+
+    bool isPartial() const { return partial; }
+    bool isLate() const { return late; }
+    long getNodes() const { return nodes; }
+};
+
+/**
+ * How many budgets queries were given, and how many of them were
+ * spent, by reaching their deadline or their maximum number of nodes.
+ */
+struct budget_stats {
+    long budgets;
+    long deadlines;
+    long nodeLimits;
+};
+
+struct scored_word {
+    string value;
+    int unigram;
+    int weight;
+    float score;
+};
+
 /**
  * A binary dictionary consists of a byte array serializing
  * two tries: a unigram trie and an ngram trie. Unigrams
@@ -73,44 +225,179 @@ struct weighted_int {
  * 5,6,7   : child1 address
  * 8,9,10  : child2 address
  * ...     : childn address
+ * ========================================================
+ * Sections (optional, following the n-gram nodes)
+ * --------------------------------------------------------
+ * ...     : section contents, followed by one directory
+ *           entry per section:
+ * 0       : section id
+ * 1,2,3   : section address
+ * 4,5,6   : section size
+ * ========================================================
+ * Footer (last 8 bytes, only if there are sections)
+ * --------------------------------------------------------
+ * 0       : number of sections
+ * 1,2,3   : address of the first directory entry
+ * 4..7    : 'MSTD'
+ * ========================================================
+ * Unigram max weights section (id 1)
+ * --------------------------------------------------------
+ * One byte per byte of the unigram trie: the byte at index
+ * node - 6 holds the maximum weight of a final node in the
+ * subtree of the unigram node, including the node itself.
+ * ========================================================
+ * Misspellings section (id 2)
+ * --------------------------------------------------------
+ * 0,1,2   : number of slots (a power of two)
+ * 3,4,5   : slot1 entry address, relative to the section,
+ *           or 0 if the slot is empty
+ * ...     : slotn entry address
+ * An open addressing hash table of misspellings, where a
+ * misspelling with FNV-1a hash h is in the first non empty
+ * slot from h mod the number of slots. Entries:
+ * 0,1,2   : address of the correction (i.e. address of the
+ *           tail node of a word in unigram trie)
+ * 3       : length of the misspelling
+ * ...     : misspelling
+ * .       : length of the correction
+ * ...     : correction
+ * ========================================================
+ * Trigram index section (id 3)
+ * --------------------------------------------------------
+ * 0,1,2   : number of trigrams
+ * 0,1,2   : trigram1
+ * 3,4,5   : trigram1 posting list address, relative to the
+ *           section
+ * 6,7,8   : trigram1 number of postings
+ * ...     : trigramn, sorted in increasing order
+ * An inverted index of the character trigrams of the words
+ * padded with '$', e.g. '$hi', 'hi$' for 'hi'. A posting list
+ * holds the addresses of the tail nodes of the words containing
+ * the trigram, in increasing order, as differences to the
+ * previous address encoded as varints (7 bits per byte, the
+ * high bit being set on all but the last byte), each followed
+ * by the length of the word.
+ * ========================================================
+ * Top completions section (id 4)
+ * --------------------------------------------------------
+ * 0       : maximum number of completions per node (k)
+ * 1,2,3   : number of nodes
+ * 0,1,2   : node1 address, in the unigram trie
+ * 3       : node1 number of completions (at most k)
+ * 4,5,6   : node1 completion1 address (i.e. address of the
+ *           tail node of a word in unigram trie)
+ * ...     : node1 completionk address
+ * ...     : noden, sorted by increasing address
+ * The heaviest words below the unigram nodes with the largest
+ * subtrees, by decreasing weight, not including the word of the
+ * node itself. Entries take 4 + 3k bytes, unused completion
+ * addresses being 0.
+ * ========================================================
+ * Bloom filter section (id 5)
+ * --------------------------------------------------------
+ * 0       : number of bits set per word (k)
+ * 1,2,3   : number of blocks
+ * ...     : blocks of 64 bytes (512 bits)
+ * A Bloom filter of the words of the unigram trie. With h the
+ * FNV-1a hash of a word, and g = (h * 0x5bd1e995) ^ (h >> 15)
+ * (32 bit arithmetic), the word sets the k bits
+ * (g + i * ((g >> 9) | 1)) mod 512, for i < k, of block
+ * h mod the number of blocks. Bit j of a block is bit j mod 8
+ * of its byte j / 8.
  */
 
+#define MAX_SECTIONS 16
+#define SECTION_UNIGRAM_MAX_WEIGHTS 1
+#define SECTION_MISSPELLINGS 2
+#define SECTION_TRIGRAM_INDEX 3
+#define SECTION_TOP_COMPLETIONS 4
+#define SECTION_BLOOM_FILTER 5
+#define BLOOM_BLOCK_SIZE 64
+#define DEFAULT_UNIGRAM_CACHE_CAPACITY 4096
+#define DEFAULT_NGRAM_CACHE_CAPACITY 4096
+#define DEFAULT_PREDICTION_CACHE_CAPACITY 1024
+#define CACHE_SHARDS 16
+#define BUDGET_CLOCK_INTERVAL 16
+
+/**
+ * Once loaded, a dictionary is not changed by queries, which are
+ * const methods, and can be run from several threads at once. The
+ * only state they change is held in caches: by default those of the
+ * dictionary, which are sharded and locked, cf. ShardedCache, or
+ * those given to the query, typically by a DictionarySession owned
+ * by the thread, which need no locking. Loading a file, and setting
+ * the error model or the cache capacity must not overlap queries.
+ *
+ * Queries whose cost depends on the input, i.e. all of them but
+ * exists(), can be given a QueryBudget to bound their latency.
+ */
 class BinaryDictionary {
 
+friend class CompletionSession;
+
 private:
     ifstream::pos_type size;
     char * bytes;
     bool loaded;
-    Dict unigramCache;
-    Dict ngramCache;
+    int version;
+    int sectionOffsets[MAX_SECTIONS];
+    int sectionSizes[MAX_SECTIONS];
+    mutable UnigramCache unigramCache;
+    mutable NgramCache ngramCache;
+    mutable PredictionCache predictionCache;
+    mutable CacheSet<UnigramCache, NgramCache, PredictionCache> sharedCaches;
     int ngramsOffset;
+    ErrorModel* errorModel;
+    pthread_t warmUpThread;
+    bool warmingUp;
+    string warmUpFile;
+    int warmUpKeys;
+    mutable volatile long budgets;
+    mutable volatile long budgetDeadlines;
+    mutable volatile long budgetNodeLimits;
 
-    int getUnigramsOffset();
-    int getNgramsOffset();
-    bool isFinalUnigram(int node);
-    int getUnigramWeight(int node);
-    int getNgramWeight(int node);
-    int getUnigram(string word);
-    weighted_string getWeightedWord(string word);
-    int getUnigram(string word, int prefixSize, int offset, string cacheKey);
-    int getUnigrams(string* words, int* unigrams, int size);
-    int getNgram(int* unigrams, int size);
-    int getNgram(int* unigrams, int unigramsSize, int prefixSize, int offset, string cacheKey);
-    string getNgramCacheKey(int* unigrams, int size);
-    int getUnigramChildren(int unigram, weighted_int* children, int limit);
-    int getNgramChildren(int ngram, weighted_int* children, int limit);
-    int getUnigramFromNgram(int ngram);
-    int getAncestors(int node, int* ancestors);
-    int getParent(int node);
-    // TODO:
-    // int getDescendants(int node, int* completions, int depth);
-    string constructWord(int* nodeList, int numNodes);
+    void unload();
+    bool spend(QueryBudget* budget, int nodes) const;
+    bool isValid(char* bytes, int length) const;
+    void readSections();
+    int getSection(int id, int* sectionSize) const;
+    int getUnigramsOffset() const;
+    int getNgramsOffset() const;
+    bool isFinalUnigram(int node) const;
+    int getUnigramWeight(int node) const;
+    int getMaxWeight(int node) const;
+    bool getMisspellingCorrection(string word, weighted_string* correction) const;
+    int getTrigramPostings(const char* trigram, int* numPostings) const;
+    int getTopCompletionList(int node, int* maxCompletions) const;
+    bool mayExist(string word) const;
+    bool getTrigramCandidates(string word, int maxDistance, int maxCandidates, vector<scored_word>* candidates, QueryBudget* budget) const;
+    int getNgramWeight(int node) const;
+    int getUnigram(string word, QueryCaches* caches) const;
+    weighted_string getWeightedWord(string word, QueryCaches* caches) const;
+    int getUnigram(string word, int prefixSize, int offset) const;
+    int getUnigrams(string* words, int* unigrams, int size, QueryCaches* caches) const;
+    int getNgram(int* unigrams, int size, QueryCaches* caches) const;
+    int getNgram(int* unigrams, int unigramsSize, int prefixSize, int offset) const;
+    bool getNgramCacheKey(int* unigrams, int size, ngram_key* key) const;
+    int getNgramCacheWords(ngram_key key, string* words) const;
+    static void* runWarmUp(void* dictionary);
+    int getUnigramChildren(int unigram, weighted_int* children, int limit) const;
+    int getNgramChildren(int ngram, weighted_int* children, int limit) const;
+    int getUnigramFromNgram(int ngram) const;
+    int getAncestors(int node, int* ancestors) const;
+    int getParent(int node) const;
+    vector<weighted_string> getDescendants(int node, string prefix, int depth, int maxDescendants, QueryBudget* budget) const;
+    vector<weighted_string> getHeaviestDescendants(int node, string prefix, int maxDescendants, QueryBudget* budget) const;
+    string constructWord(int* nodeList, int numNodes) const;
     // string[] knownVariations(int word);
-    vector<weighted_string> known(vector<string> words, vector<weighted_string> filtered);
+    vector<weighted_string> known(vector<string> words, vector<weighted_string> filtered, QueryCaches* caches, QueryBudget* budget) const;
+    vector<weighted_string> getRankedCorrections(string word, vector<weighted_string> corrections, int maxCorrections, QueryCaches* caches, QueryBudget* budget) const;
+    vector<scored_word> getCandidates(string word, ErrorModel* model, int maxCandidates, QueryCaches* caches, QueryBudget* budget) const;
+    vector<scored_word> searchCandidates(string word, ErrorModel* model, int maxCandidates, QueryBudget* budget) const;
     static weighted_string createWeightedString(string value, int weight);
 
 public:
-    int toInt(char * byteArray, int offset, int chunkSize) {
+    int toInt(char * byteArray, int offset, int chunkSize) const {
         int value = 0;
         for (int i = 0; i < chunkSize; i++) {
             value += (unsigned char) byteArray[offset + i] << (chunkSize-i-1)*8;
@@ -118,16 +405,38 @@ public:
         return value;
     }
 
-    bool isLoaded() { return loaded; }
-    BinaryDictionary() { ngramsOffset = -1; }
-    ~BinaryDictionary() { delete[] bytes; }
+    bool isLoaded() const { return loaded; }
+    int getVersion() const { return version; }
+    long getSize() const { return loaded ? (long) size : 0; }
+    BinaryDictionary() : unigramCache(DEFAULT_UNIGRAM_CACHE_CAPACITY, CACHE_SHARDS),
+            ngramCache(DEFAULT_NGRAM_CACHE_CAPACITY, CACHE_SHARDS),
+            predictionCache(DEFAULT_PREDICTION_CACHE_CAPACITY, CACHE_SHARDS),
+            sharedCaches(unigramCache, ngramCache, predictionCache) {
+        ngramsOffset = -1; errorModel = NULL; bytes = NULL; loaded = false; version = 0; warmingUp = false; warmUpKeys = 0;
+        budgets = 0; budgetDeadlines = 0; budgetNodeLimits = 0;
+    }
+    ~BinaryDictionary() { waitForWarmUp(); unload(); }
 
     void fromFile(const char * filename);
-    bool exists(string word);
-    vector<weighted_string> getPredictions(string* words, int numWords, vector<weighted_string> predictions, int maxPredictions);
-    vector<weighted_string> getCorrections(string word, vector<weighted_string> corrections, int maxCorrections);
-    // TODO:
-    // int getCompletions(string word, int depth);
+    void setErrorModel(ErrorModel* model) { errorModel = model; }
+    void setCacheCapacity(int unigrams, int ngrams);
+    cache_stats getUnigramCacheStats() const { return unigramCache.getStats(); }
+    cache_stats getNgramCacheStats() const { return ngramCache.getStats(); }
+    void setPredictionCacheCapacity(int predictions) { predictionCache.setCapacity(predictions); }
+    cache_stats getPredictionCacheStats() const { return predictionCache.getStats(); }
+    bool saveCacheKeys(const char * filename) const;
+    int warmUpCaches(const char * filename);
+    void startWarmUp(const char * filename);
+    int waitForWarmUp();
+    budget_stats getBudgetStats() const;
+    bool exists(string word, QueryCaches* caches = NULL) const;
+    vector<weighted_string> getPredictions(string* words, int numWords, vector<weighted_string> predictions, int maxPredictions, QueryCaches* caches = NULL, QueryBudget* budget = NULL) const;
+    vector<weighted_string> getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, QueryCaches* caches = NULL, QueryBudget* budget = NULL) const;
+    vector<weighted_string> getCorrections(string* words, int numWords, string word, vector<weighted_string> corrections, int maxCorrections, QueryCaches* caches = NULL, QueryBudget* budget = NULL) const;
+    vector<weighted_string> getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, CorrectionMode mode, int maxDistance, QueryCaches* caches = NULL, QueryBudget* budget = NULL) const;
+    vector<weighted_string> getCompletions(string word, int depth, vector<weighted_string> completions, int maxCompletions, QueryCaches* caches = NULL, QueryBudget* budget = NULL) const;
+    vector<weighted_string> getTopCompletions(string word, vector<weighted_string> completions, int maxCompletions, QueryCaches* caches = NULL, QueryBudget* budget = NULL) const;
+    vector<weighted_string> getFuzzyCompletions(string word, vector<weighted_string> completions, int maxCompletions, int maxDistance, QueryBudget* budget = NULL) const;
 };
 
 #endif
\ No newline at end of file
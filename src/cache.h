@@ -0,0 +1,264 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Bounded lookup caches.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <vector>
+#include <tr1/unordered_map>
+using namespace std;
+
+/**
+ * Counters of a cache, since it was created or cleared.
+ */
+struct cache_stats {
+    long hits;
+    long misses;
+    long evictions;
+    int size;
+    int capacity;
+};
+
+/**
+ * A cache holding at most 'capacity' entries, evicted with the
+ * CLOCK algorithm: entries sit in a circular array of slots, each
+ * with a bit set whenever the entry is read. When the cache is full,
+ * a hand sweeps the slots, clearing the bits it finds set, and the
+ * first entry whose bit is clear is evicted. This approximates LRU
+ * without reordering anything on hits. A capacity of 0 disables the
+ * cache.
+ *
+ * H is the hash function of the keys, which must also be comparable
+ * with ==.
+ */
+template <class K, class V, class H = std::tr1::hash<K> >
+class Cache {
+
+private:
+    struct slot {
+        K key;
+        V value;
+        bool referenced;
+    };
+
+    typedef std::tr1::unordered_map<K, int, H> Index;
+
+    vector<slot> slots;
+    Index index;
+    int capacity;
+    int hand;
+    cache_stats stats;
+
+public:
+    Cache(int capacity) {
+        setCapacity(capacity);
+    }
+
+    /**
+     * Look up a key.
+     * @param key the key
+     * @param value a holder for the value of the key
+     * @return true if the key is in the cache
+     */
+    bool get(const K& key, V* value) {
+        typename Index::const_iterator it = index.find(key);
+        if (it == index.end()) {
+            stats.misses++;
+            return false;
+        }
+        slot& s = slots[it->second];
+        s.referenced = true;
+        *value = s.value;
+        stats.hits++;
+        return true;
+    }
+
+    /**
+     * Add or replace an entry, evicting another one if the cache
+     * is full.
+     * @param key the key
+     * @param value the value of the key
+     */
+    void put(const K& key, const V& value) {
+        if (capacity == 0) return;
+        typename Index::iterator it = index.find(key);
+        if (it != index.end()) {
+            slots[it->second].value = value;
+            return;
+        }
+
+        slot s;
+        s.key = key;
+        s.value = value;
+        s.referenced = false;
+        if (slots.size() < capacity) {
+            index[key] = slots.size();
+            slots.push_back(s);
+            return;
+        }
+        while (slots[hand].referenced) {
+            slots[hand].referenced = false;
+            hand = (hand + 1) % capacity;
+        }
+        index.erase(slots[hand].key);
+        index[key] = hand;
+        slots[hand] = s;
+        hand = (hand + 1) % capacity;
+        stats.evictions++;
+    }
+
+    /**
+     * Append the keys in the cache to a list.
+     */
+    void getKeys(vector<K>* keys) {
+        for (int i = 0; i < slots.size(); i++) {
+            keys->push_back(slots[i].key);
+        }
+    }
+
+    /**
+     * Remove all entries, and reset the counters.
+     */
+    void clear() {
+        slots.clear();
+        index.clear();
+        hand = 0;
+        stats.hits = 0;
+        stats.misses = 0;
+        stats.evictions = 0;
+    }
+
+    /**
+     * Change the maximum number of entries, which clears the cache.
+     */
+    void setCapacity(int capacity) {
+        this->capacity = capacity > 0 ? capacity : 0;
+        clear();
+        slots.reserve(this->capacity);
+    }
+
+    cache_stats getStats() {
+        cache_stats current = stats;
+        current.size = slots.size();
+        current.capacity = capacity;
+        return current;
+    }
+};
+
+/**
+ * A cache which several threads can share: entries are spread
+ * over 'numShards' caches by the hash of their key, each shard
+ * being guarded by its own lock and evicting its own entries, so
+ * that threads only contend when they hit the same shard. The
+ * capacity is split evenly between the shards.
+ */
+template <class K, class V, class H = std::tr1::hash<K> >
+class ShardedCache {
+
+private:
+    vector<Cache<K, V, H>*> shards;
+    pthread_mutex_t* locks;
+    H hash;
+
+    // Shards are owned, and locks can't be copied
+    ShardedCache(const ShardedCache&);
+    ShardedCache& operator=(const ShardedCache&);
+
+    int shard(const K& key) {
+        size_t h = hash(key);
+        return (h ^ (h >> 16)) % shards.size();
+    }
+
+public:
+    ShardedCache(int capacity, int numShards) {
+        locks = new pthread_mutex_t[numShards];
+        for (int i = 0; i < numShards; i++) {
+            pthread_mutex_init(&locks[i], NULL);
+            shards.push_back(new Cache<K, V, H>(0));
+        }
+        setCapacity(capacity);
+    }
+
+    ~ShardedCache() {
+        for (int i = 0; i < shards.size(); i++) {
+            pthread_mutex_destroy(&locks[i]);
+            delete shards[i];
+        }
+        delete[] locks;
+    }
+
+    /**
+     * Cf. Cache::get()
+     */
+    bool get(const K& key, V* value) {
+        int i = shard(key);
+        pthread_mutex_lock(&locks[i]);
+        bool found = shards[i]->get(key, value);
+        pthread_mutex_unlock(&locks[i]);
+        return found;
+    }
+
+    /**
+     * Cf. Cache::put()
+     */
+    void put(const K& key, const V& value) {
+        int i = shard(key);
+        pthread_mutex_lock(&locks[i]);
+        shards[i]->put(key, value);
+        pthread_mutex_unlock(&locks[i]);
+    }
+
+    void getKeys(vector<K>* keys) {
+        for (int i = 0; i < shards.size(); i++) {
+            pthread_mutex_lock(&locks[i]);
+            shards[i]->getKeys(keys);
+            pthread_mutex_unlock(&locks[i]);
+        }
+    }
+
+    void clear() {
+        for (int i = 0; i < shards.size(); i++) {
+            pthread_mutex_lock(&locks[i]);
+            shards[i]->clear();
+            pthread_mutex_unlock(&locks[i]);
+        }
+    }
+
+    void setCapacity(int capacity) {
+        int numShards = shards.size();
+        for (int i = 0; i < numShards; i++) {
+            pthread_mutex_lock(&locks[i]);
+            shards[i]->setCapacity((capacity + numShards - 1) / numShards);
+            pthread_mutex_unlock(&locks[i]);
+        }
+    }
+
+    /**
+     * Return the sum of the counters of the shards.
+     */
+    cache_stats getStats() {
+        cache_stats total;
+        total.hits = 0;
+        total.misses = 0;
+        total.evictions = 0;
+        total.size = 0;
+        total.capacity = 0;
+        for (int i = 0; i < shards.size(); i++) {
+            pthread_mutex_lock(&locks[i]);
+            cache_stats stats = shards[i]->getStats();
+            pthread_mutex_unlock(&locks[i]);
+            total.hits += stats.hits;
+            total.misses += stats.misses;
+            total.evictions += stats.evictions;
+            total.size += stats.size;
+            total.capacity += stats.capacity;
+        }
+        return total;
+    }
+};
+
+#endif
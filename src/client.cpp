@@ -0,0 +1,228 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A load test client of the query server.
+ *
+ * Usage: ./Client [-s SOCKET | -p PORT | -m SEGMENT] [-c CONNECTIONS] [-d DEPTH] [-n REQUESTS]
+ *                 [-t exists|predictions|corrections|completions|mixed] WORDS
+ *
+ * Sends REQUESTS requests (by default 100000) over CONNECTIONS
+ * connections (by default 4), each on its own thread and with at
+ * most DEPTH requests (by default 1) waiting for their responses,
+ * and reports the throughput and the latency percentiles. With -m,
+ * connections are channels of the shared memory segment SEGMENT of
+ * the server. Queries are made of the
+ * words of the file WORDS, with one word per line, optionally after
+ * its count as in NSP unigram files.
+ */
+
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include "protocol.h"
+#include "shmring.h"
+
+using namespace std;
+
+#define DEFAULT_SOCKET "/tmp/suggest.sock"
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/**
+ * Read the words of a file, with one word per line, optionally
+ * after its count.
+ */
+static vector<string> readWords(const char * filename) {
+    vector<string> words;
+    ifstream file (filename);
+    string line;
+    while (getline(file, line)) {
+        istringstream tokens(line);
+        string first, second;
+        tokens >> first;
+        if (tokens >> second) {
+            words.push_back(second);
+        } else if (!first.empty()) {
+            words.push_back(first);
+        }
+    }
+    return words;
+}
+
+/**
+ * Build a random request of a type, or of any type if 'type' is 0.
+ */
+static query_request createRequest(vector<string>& words, int type, unsigned int* seed, unsigned int id) {
+    query_request request;
+    request.id = id;
+    request.type = type != 0 ? type : 1 + rand_r(seed) % 4;
+    request.maxResults = 3;
+    string word = words[rand_r(seed) % words.size()];
+    if (request.type == QUERY_PREDICTIONS) {
+        request.words.push_back(words[rand_r(seed) % words.size()]);
+        request.words.push_back(word);
+    } else if (request.type == QUERY_CORRECTIONS) {
+        int i = rand_r(seed) % word.length();
+        word[i] = 'a' + rand_r(seed) % 26;
+        request.words.push_back(word);
+    } else if (request.type == QUERY_COMPLETIONS) {
+        request.words.push_back(word.substr(0, 1 + rand_r(seed) % 3));
+    } else {
+        request.words.push_back(word);
+    }
+    return request;
+}
+
+/**
+ * The arguments and results of a connection thread.
+ */
+struct connection_args {
+    const char * socketPath;
+    int port;
+    const char * segmentName;
+    vector<string>* words;
+    int type;
+    int depth;
+    int numRequests;
+    int seed;
+    vector<double> latencies;
+    int errors;
+};
+
+/**
+ * Send the requests of a connection thread with a client, either a
+ * QueryClient or a SharedMemoryClient.
+ */
+template <class Client> static void sendRequests(Client& client, connection_args* args) {
+    unsigned int seed = args->seed;
+    args->latencies.reserve(args->numRequests);
+    deque<double> sent;
+    int numSent = 0;
+    int numReceived = 0;
+    string frames;
+    query_response response;
+    while (numReceived < args->numRequests) {
+        frames.clear();
+        while (numSent < args->numRequests && numSent - numReceived < args->depth) {
+            encodeRequest(createRequest(*args->words, args->type, &seed, numSent++), &frames);
+            sent.push_back(now());
+        }
+        if (!frames.empty() && !client.send(frames)) break;
+        if (!client.receive(&response)) break;
+        if (response.id != (unsigned int) numReceived || response.status != STATUS_OK) {
+            args->errors++;
+        } else {
+            args->latencies.push_back(now() - sent.front());
+        }
+        sent.pop_front();
+        numReceived++;
+    }
+    args->errors += args->numRequests - numReceived;
+}
+
+static void* runConnection(void* arg) {
+    connection_args* args = (connection_args*) arg;
+    if (args->segmentName != NULL) {
+        SharedMemoryClient client;
+        if (client.attach(args->segmentName)) {
+            sendRequests(client, args);
+            return NULL;
+        }
+    } else {
+        QueryClient client;
+        if (args->port > 0 ? client.connectTcp(args->port) : client.connectUnix(args->socketPath)) {
+            sendRequests(client, args);
+            return NULL;
+        }
+    }
+    args->errors = args->numRequests;
+    return NULL;
+}
+
+static double percentile(vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[min((int) (p * sorted.size()), (int) sorted.size() - 1)];
+}
+
+int main(int argc, char ** argv) {
+    const char * socketPath = DEFAULT_SOCKET;
+    int port = 0;
+    const char * segmentName = NULL;
+    int numConnections = 4;
+    int depth = 1;
+    int numRequests = 100000;
+    int type = 0;
+    int option;
+    const char * usage = " [-s SOCKET | -p PORT | -m SEGMENT] [-c CONNECTIONS] [-d DEPTH] [-n REQUESTS] [-t exists|predictions|corrections|completions|mixed] WORDS";
+    while ((option = getopt(argc, argv, "s:p:m:c:d:n:t:")) != -1) {
+        string value = optarg != NULL ? optarg : "";
+        switch (option) {
+        case 's': socketPath = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'm': segmentName = optarg; break;
+        case 'c': numConnections = max(1, atoi(optarg)); break;
+        case 'd': depth = max(1, atoi(optarg)); break;
+        case 'n': numRequests = atoi(optarg); break;
+        case 't':
+            type = value == "exists" ? QUERY_EXISTS : value == "predictions" ? QUERY_PREDICTIONS :
+                   value == "corrections" ? QUERY_CORRECTIONS : value == "completions" ? QUERY_COMPLETIONS : 0;
+            break;
+        default:
+            cerr << "Usage: " << argv[0] << usage << endl;
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return 2;
+    }
+    vector<string> words = readWords(argv[optind]);
+    if (words.empty()) {
+        cerr << "No words in " << argv[optind] << endl;
+        return 1;
+    }
+
+    pthread_t threads[numConnections];
+    vector<connection_args> args(numConnections);
+    double start = now();
+    for (int i = 0; i < numConnections; i++) {
+        args[i].socketPath = socketPath;
+        args[i].port = port;
+        args[i].segmentName = segmentName;
+        args[i].words = &words;
+        args[i].type = type;
+        args[i].depth = depth;
+        args[i].numRequests = numRequests / numConnections + (i < numRequests % numConnections ? 1 : 0);
+        args[i].seed = 42 + i;
+        args[i].errors = 0;
+        pthread_create(&threads[i], NULL, runConnection, &args[i]);
+    }
+    vector<double> latencies;
+    int errors = 0;
+    for (int i = 0; i < numConnections; i++) {
+        pthread_join(threads[i], NULL);
+        latencies.insert(latencies.end(), args[i].latencies.begin(), args[i].latencies.end());
+        errors += args[i].errors;
+    }
+    double elapsed = now() - start;
+    sort(latencies.begin(), latencies.end());
+
+    cout << latencies.size() << " requests in " << elapsed << "ms over " << numConnections << " connections of depth " << depth << " ("
+         << (int) (latencies.size() / elapsed * 1000) << " qps, " << errors << " errors)" << endl;
+    cout << "latency p50 " << percentile(latencies, 0.5) * 1000 << "us, p90 " << percentile(latencies, 0.9) * 1000
+         << "us, p99 " << percentile(latencies, 0.99) * 1000 << "us, p99.9 " << percentile(latencies, 0.999) * 1000
+         << "us, max " << percentile(latencies, 1) * 1000 << "us" << endl;
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Incremental completion of a word as it is typed.
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "completion.h"
+
+using namespace std;
+
+/**
+ * Order session entries by increasing weight, words first when
+ * equal, so that the heaviest entry is on top of the heap.
+ */
+static bool compareEntry(const session_entry& a, const session_entry& b) {
+    if (a.weight != b.weight) return a.weight < b.weight;
+    return !a.final && b.final;
+}
+
+/**
+ * Create a completion session.
+ * @param dictionary the dictionary to complete words from
+ * @param maxCompletions the number of completions to maintain
+ */
+CompletionSession::CompletionSession(const BinaryDictionary* dictionary, int maxCompletions) {
+    this->dictionary = dictionary;
+    this->maxCompletions = maxCompletions;
+    reset();
+}
+
+/**
+ * Start completing a new word.
+ */
+void CompletionSession::reset() {
+    prefix = "";
+    reached.clear();
+    history.clear();
+    current.frontier.clear();
+    current.found.clear();
+
+    session_node root;
+    root.node = dictionary->getUnigramsOffset();
+    root.parent = -1;
+    root.depth = 0;
+    root.firstChild = -1;
+    root.numChildren = 0;
+    reached.push_back(root);
+    current.path = 0;
+    expand(0);
+}
+
+/**
+ * Append a character to the prefix: descend to the child node of
+ * the prefix, keep the part of the frontier and of the completions
+ * found below it, and expand the child if it was still a subtree
+ * of the frontier.
+ * @param c the typed character
+ */
+void CompletionSession::type(char c) {
+    history.push_back(current);
+    prefix += c;
+
+    int path = -1;
+    if (current.path >= 0) {
+        session_node parent = reached[current.path];
+        for (int i = parent.firstChild; i < parent.firstChild + parent.numChildren; i++) {
+            if (dictionary->bytes[reached[i].node] == c) {
+                path = i;
+                break;
+            }
+        }
+    }
+
+    session_state next;
+    next.path = path;
+    bool expanded = true;
+    if (path >= 0) {
+        for (int i = 0; i < current.frontier.size(); i++) {
+            session_entry entry = current.frontier[i];
+            if (entry.path == path) {
+                // The prefix itself is not a completion
+                if (!entry.final) expanded = false;
+                continue;
+            }
+            if (isBelow(entry.path, path)) {
+                next.frontier.push_back(entry);
+            }
+        }
+        for (int i = 0; i < current.found.size(); i++) {
+            session_entry entry = current.found[i];
+            if (entry.path != path && isBelow(entry.path, path)) {
+                next.found.push_back(entry);
+            }
+        }
+        make_heap(next.frontier.begin(), next.frontier.end(), compareEntry);
+    }
+    current = next;
+    if (path >= 0 && !expanded) {
+        expand(path);
+    }
+}
+
+/**
+ * Remove the last character of the prefix, and restore the state
+ * saved before it was typed.
+ */
+void CompletionSession::erase() {
+    if (history.empty()) return;
+    current = history.back();
+    history.pop_back();
+    prefix.erase(prefix.length() - 1);
+}
+
+/**
+ * Get the heaviest completions of the prefix, searching the
+ * frontier further if fewer than maxCompletions are known yet.
+ * @param completions the list of completions
+ * @return the completions, by decreasing weight
+ */
+vector<weighted_string> CompletionSession::getCompletions(vector<weighted_string> completions) {
+    search();
+    for (int i = 0; i < current.found.size(); i++) {
+        weighted_string completion;
+        completion.value = "";
+        completion.weight = current.found[i].weight;
+        for (int p = current.found[i].path; p > 0; p = reached[p].parent) {
+            completion.value = dictionary->bytes[reached[p].node] + completion.value;
+        }
+        completions.push_back(completion);
+    }
+    return completions;
+}
+
+/**
+ * Pop the heaviest entries of the frontier until maxCompletions
+ * words are found, expanding subtrees into their word and children.
+ */
+void CompletionSession::search() {
+    vector<session_entry>& frontier = current.frontier;
+    while (current.found.size() < maxCompletions && !frontier.empty()) {
+        pop_heap(frontier.begin(), frontier.end(), compareEntry);
+        session_entry entry = frontier.back();
+        frontier.pop_back();
+        if (entry.final) {
+            current.found.push_back(entry);
+            continue;
+        }
+        int weight = dictionary->getUnigramWeight(reached[entry.path].node);
+        if (weight > 0) {
+            push(frontier, entry.path, weight, true);
+        }
+        expand(entry.path);
+    }
+}
+
+/**
+ * Add the children of a reached node which hold words to the
+ * reached nodes, and to the frontier as subtrees.
+ * @param path the index of the node in the reached nodes
+ */
+void CompletionSession::expand(int path) {
+    int node = reached[path].node;
+    int numChildren = (unsigned char) dictionary->bytes[node + 2];
+    reached[path].firstChild = reached.size();
+    reached[path].numChildren = 0;
+    for (int i = 0; i < numChildren; i++) {
+        session_node child;
+        child.node = dictionary->toInt(dictionary->bytes, node + 6 + 3*i, 3);
+        child.parent = path;
+        child.depth = reached[path].depth + 1;
+        child.firstChild = -1;
+        child.numChildren = 0;
+        int bound = dictionary->getMaxWeight(child.node);
+        if (bound == 0) continue;
+        reached.push_back(child);
+        reached[path].numChildren++;
+        push(current.frontier, reached.size() - 1, bound, false);
+    }
+}
+
+/**
+ * Push an entry on a frontier.
+ */
+void CompletionSession::push(vector<session_entry>& entries, int path, int weight, bool final) {
+    session_entry entry;
+    entry.path = path;
+    entry.weight = weight;
+    entry.final = final;
+    entries.push_back(entry);
+    push_heap(entries.begin(), entries.end(), compareEntry);
+}
+
+/**
+ * Return true if a reached node is a descendant of another one.
+ */
+bool CompletionSession::isBelow(int path, int ancestor) {
+    int depth = reached[ancestor].depth;
+    while (reached[path].depth > depth) {
+        path = reached[path].parent;
+    }
+    return path == ancestor;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Incremental completion of a word as it is typed.
+ */
+
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <string>
+#include <vector>
+#include "bindict.h"
+using namespace std;
+
+/**
+ * A node reached by a completion session, 'depth' characters
+ * below the root, and the index of its parent in the list of
+ * reached nodes (-1 for the root). Once the node is expanded, its
+ * children which hold words are the 'numChildren' reached nodes
+ * from 'firstChild'.
+ */
+struct session_node {
+    int node;
+    int parent;
+    int depth;
+    int firstChild;
+    int numChildren;
+};
+
+/**
+ * An entry of the frontier of a completion session: either a
+ * subtree, whose weight is the maximum weight in it, or a word,
+ * with its exact weight. 'path' indexes the list of reached nodes.
+ */
+struct session_entry {
+    int path;
+    int weight;
+    bool final;
+};
+
+/**
+ * The state of a completion session after a keystroke: the
+ * reached node of the typed prefix (-1 if the prefix is not in the
+ * dictionary), the frontier of the best-first search below it, and
+ * the completions already proven to be the heaviest, by decreasing
+ * weight.
+ */
+struct session_state {
+    int path;
+    vector<session_entry> frontier;
+    vector<session_entry> found;
+};
+
+/**
+ * A completion session completes a word as it is typed, one
+ * character at a time, e.g.
+ *
+ * CompletionSession session(&bindict, 3);
+ * session.type('h');
+ * session.getCompletions(holder) => [{'how':150}, {'hi':130}, {'hello':120}]
+ * session.type('e');
+ * session.getCompletions(holder) => [{'hello':120}]
+ * session.erase();
+ *
+ * and returns the same completions as getTopCompletions(). Rather
+ * than looking the prefix up from the root and searching below it
+ * at each keystroke, the session keeps the frontier of the search
+ * below the prefix: typing a character keeps the part of it below
+ * the new prefix, which is a frontier of the search below the new
+ * prefix, and erasing one restores the state saved before it was
+ * typed. The cost of a keystroke thus depends on the size of the
+ * frontier, and not on the length of the prefix.
+ */
+class CompletionSession {
+
+private:
+    const BinaryDictionary* dictionary;
+    int maxCompletions;
+    string prefix;
+    vector<session_node> reached;
+    session_state current;
+    vector<session_state> history;
+
+    void push(vector<session_entry>& entries, int path, int weight, bool final);
+    void expand(int path);
+    bool isBelow(int path, int ancestor);
+    void search();
+
+public:
+    CompletionSession(const BinaryDictionary* dictionary, int maxCompletions);
+
+    void reset();
+    void type(char c);
+    void erase();
+    string getPrefix() { return prefix; }
+    vector<weighted_string> getCompletions(vector<weighted_string> completions);
+};
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Spelling corrections of the words of a text, in batches.
+ *
+ * Usage: ./Correct [-j THREADS] [-n CORRECTIONS] [-m ERROR_MODEL] DICTIONARY < text
+ *
+ * Prints one line per word of the text, the word followed by its
+ * corrections, best first, separated by tabs. The number of words
+ * corrected per second is reported on the standard error.
+ */
+
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "bindict.h"
+#include "errormodel.h"
+#include "batch.h"
+
+using namespace std;
+
+#define BATCH_SIZE (1 << 20)
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/**
+ * Correct a batch of words, and print them with their corrections.
+ */
+static void correct(BatchCorrector& batch, vector<string>& words, int maxCorrections) {
+    vector<vector<weighted_string> > holder;
+    vector<vector<weighted_string> > corrections = batch.getCorrections(words, holder, maxCorrections);
+    for (int i = 0; i < words.size(); i++) {
+        cout << words[i];
+        for (int j = 0; j < corrections[i].size(); j++) {
+            cout << '\t' << corrections[i][j].value;
+        }
+        cout << '\n';
+    }
+    words.clear();
+}
+
+int main(int argc, char ** argv) {
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxCorrections = 1;
+    const char * errorModelFile = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "j:n:m:")) != -1) {
+        switch (option) {
+        case 'j': numThreads = atoi(optarg); break;
+        case 'n': maxCorrections = atoi(optarg); break;
+        case 'm': errorModelFile = optarg; break;
+        default:
+            cerr << "Usage: " << argv[0] << " [-j THREADS] [-n CORRECTIONS] [-m ERROR_MODEL] DICTIONARY < text" << endl;
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        cerr << "Usage: " << argv[0] << " [-j THREADS] [-n CORRECTIONS] [-m ERROR_MODEL] DICTIONARY < text" << endl;
+        return 2;
+    }
+
+    BinaryDictionary bindict;
+    bindict.fromFile(argv[optind]);
+    if (!bindict.isLoaded()) {
+        cerr << "Unable to load " << argv[optind] << endl;
+        return 1;
+    }
+    ErrorModel model;
+    if (errorModelFile != NULL) {
+        if (!model.fromFile(errorModelFile)) {
+            cerr << "Unable to load " << errorModelFile << endl;
+            return 1;
+        }
+        bindict.setErrorModel(&model);
+    }
+
+    ios::sync_with_stdio(false);
+    BatchCorrector batch(&bindict, numThreads);
+    double start = now();
+    long numWords = 0;
+    vector<string> words;
+    string word;
+    while (cin >> word) {
+        words.push_back(word);
+        numWords++;
+        if (words.size() == BATCH_SIZE) {
+            correct(batch, words, maxCorrections);
+        }
+    }
+    correct(batch, words, maxCorrections);
+    cout.flush();
+
+    double elapsed = now() - start;
+    cerr << numWords << " words in " << elapsed << "ms on " << batch.getNumThreads() << " threads ("
+         << (long) (numWords / elapsed * 1000) << " words/s)" << endl;
+    return 0;
+}
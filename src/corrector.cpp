@@ -8,6 +8,8 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
 #include "corrector.h"
 
 using namespace std;
@@ -19,6 +21,17 @@ string_pair Corrector::createStringPair(string first, string second) {
     return pair;
 }
 
+weighted_variation Corrector::createWeightedVariation(string value, float cost) {
+    weighted_variation variation;
+    variation.value = value;
+    variation.cost = cost;
+    return variation;
+}
+
+bool Corrector::compareCost(const weighted_variation& a, const weighted_variation& b) {
+    return a.cost < b.cost;
+}
+
 /**
  * Return a vector of all variations of 'word' with edit
  * distance 1.
@@ -48,6 +61,96 @@ vector<string> Corrector::variations(string word, vector<string> variations) {
     return variations;
 }
 
+/**
+ * Return the variations of 'word' with edit distance 1, together
+ * with their cost in the error model, ordered by increasing cost.
+ * Variations costing more than maxCost are left out, so that
+ * unlikely edits (e.g. substituting keys which are far apart on
+ * the keyboard) are never looked up.
+ *
+ * Note that the edits are expressed from the point of view of
+ * the typed word: deleting a character from 'word' corrects an
+ * inserted character, and so on.
+ *
+ * @param word the typed word to vary
+ * @param model the error model giving the cost of each edit
+ * @param maxCost the maximum cost of a variation
+ * @param variations a holder for the vector of variations
+ * @return the variations of 'word', cheapest first
+ */
+vector<weighted_variation> Corrector::variations(string word, ErrorModel* model, float maxCost, vector<weighted_variation> variations) {
+    string ALPHABET = "abcdefghijklmnopqrstuvwxyz";
+    int l = word.length();
+    for (int i = 0; i <= l; i++) {
+        string head = word.substr(0, i);
+        if (i < l) {
+            string tail = word.substr(i + 1, l);
+            float cost = model->insertionCost(word[i]);
+            if (cost <= maxCost) {
+                variations.push_back(Corrector::createWeightedVariation(head + tail, cost));
+            }
+            if (i < l - 1) {
+                cost = model->transpositionCost(word[i], word[i+1]);
+                if (cost <= maxCost) {
+                    variations.push_back(Corrector::createWeightedVariation(head + word[i+1] + word[i] + word.substr(i + 2, l), cost));
+                }
+            }
+            for (int j = 0; j < ALPHABET.length(); j++) {
+                if (ALPHABET[j] == word[i]) continue;
+                cost = model->substitutionCost(word[i], ALPHABET[j]);
+                if (cost <= maxCost) {
+                    variations.push_back(Corrector::createWeightedVariation(head + ALPHABET[j] + tail, cost));
+                }
+            }
+        }
+        for (int j = 0; j < ALPHABET.length(); j++) {
+            float cost = model->deletionCost(ALPHABET[j]);
+            if (cost <= maxCost) {
+                variations.push_back(Corrector::createWeightedVariation(head + ALPHABET[j] + word.substr(i, l), cost));
+            }
+        }
+    }
+    stable_sort(variations.begin(), variations.end(), Corrector::compareCost);
+    return variations;
+}
+
+/**
+ * Return the edit distance between two words, where an edit is a
+ * deletion, an insertion, a substitution or a transposition of two
+ * adjacent characters (i.e. the optimal string alignment distance).
+ *
+ * @param first the first word
+ * @param second the second word
+ * @param maxDistance the largest distance of interest
+ * @return the distance, or maxDistance + 1 if it exceeds maxDistance
+ */
+int Corrector::distance(string first, string second, int maxDistance) {
+    int m = first.length();
+    int n = second.length();
+    if (abs(m - n) > maxDistance) return maxDistance + 1;
+
+    vector<int> previous(n + 1), current(n + 1), next(n + 1);
+    for (int j = 0; j <= n; j++) {
+        current[j] = j;
+    }
+    for (int i = 1; i <= m; i++) {
+        next[0] = i;
+        int rowMin = i;
+        for (int j = 1; j <= n; j++) {
+            int cost = first[i-1] == second[j-1] ? 0 : 1;
+            next[j] = min(min(current[j] + 1, next[j-1] + 1), current[j-1] + cost);
+            if (i > 1 && j > 1 && first[i-1] == second[j-2] && first[i-2] == second[j-1]) {
+                next[j] = min(next[j], previous[j-2] + 1);
+            }
+            rowMin = min(rowMin, next[j]);
+        }
+        if (rowMin > maxDistance) return maxDistance + 1;
+        previous.swap(current);
+        current.swap(next);
+    }
+    return min(current[n], maxDistance + 1);
+}
+
 vector<string_pair> Corrector::splits(string word, vector<string_pair> holder) {
     int l = word.length();
     for (int i = 0; i <= l; i++) {
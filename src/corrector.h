@@ -9,19 +9,30 @@
 #define CORRECTOR_H
 
 #include <string>
+#include <vector>
+#include "errormodel.h"
 using namespace std;
 
 struct string_pair {
     string first, second;
 };
 
+struct weighted_variation {
+    string value;
+    float cost;
+};
+
 class Corrector {
 
 public:
     static vector<string> variations(string word, vector<string> variations);
+    static vector<weighted_variation> variations(string word, ErrorModel* model, float maxCost, vector<weighted_variation> variations);
+    static int distance(string first, string second, int maxDistance);
 
 private:
     static string_pair createStringPair(string first, string second);
+    static weighted_variation createWeightedVariation(string value, float cost);
+    static bool compareCost(const weighted_variation& a, const weighted_variation& b);
     static vector<string_pair> splits(string word, vector<string_pair> holder);
     static vector<string> deletes(vector<string_pair> splits, vector<string> holder);
     static vector<string> transposes(vector<string_pair> splits, vector<string> holder);
@@ -0,0 +1,138 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A noisy channel error model used to rank and prune
+ * spelling corrections.
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "errormodel.h"
+
+using namespace std;
+
+#define DEBUG false
+
+/**
+ * Create an error model in which all edits have the same cost.
+ */
+ErrorModel::ErrorModel() {
+    for (int i = 0; i < ERROR_MODEL_ALPHABET_SIZE; i++) {
+        insertions[i] = ERROR_MODEL_DEFAULT_COST;
+        deletions[i] = ERROR_MODEL_DEFAULT_COST;
+        for (int j = 0; j < ERROR_MODEL_ALPHABET_SIZE; j++) {
+            substitutions[i][j] = ERROR_MODEL_DEFAULT_COST;
+            transpositions[i][j] = ERROR_MODEL_DEFAULT_COST;
+        }
+    }
+}
+
+/**
+ * Return the index of a character in the cost tables, or -1
+ * if the character is outside the alphabet.
+ */
+int ErrorModel::index(char c) {
+    if (c < 'a' || c > 'z') {
+        return -1;
+    }
+    return c - 'a';
+}
+
+/**
+ * Read edit costs from an error model file, as described in
+ * errormodel.h.
+ * @param filename the path to the error model file
+ * @return true if the file could be read
+ */
+bool ErrorModel::fromFile(const char * filename) {
+    ifstream file (filename);
+    if (!file.is_open()) {
+        if (DEBUG) {
+            cout << "Unable to open file";
+        }
+        return false;
+    }
+
+    string line;
+    while (getline(file, line)) {
+        if (line.length() == 0 || line[0] == '#') continue;
+        istringstream tokens(line);
+        string op, first, second;
+        float cost;
+        tokens >> op >> first;
+        if (op == "sub" || op == "trans") {
+            tokens >> second;
+        }
+        if (!(tokens >> cost) || first.length() != 1 || second.length() > 1) {
+            if (DEBUG) {
+                cout << "Skipping malformed line: " << line << endl;
+            }
+            continue;
+        }
+
+        int a = index(first[0]);
+        int b = second.length() > 0 ? index(second[0]) : -1;
+        bool anyA = first[0] == '*';
+        bool anyB = second.length() > 0 && second[0] == '*';
+        for (int i = 0; i < ERROR_MODEL_ALPHABET_SIZE; i++) {
+            if (!anyA && i != a) continue;
+            if (op == "ins") {
+                insertions[i] = cost;
+            } else if (op == "del") {
+                deletions[i] = cost;
+            } else {
+                for (int j = 0; j < ERROR_MODEL_ALPHABET_SIZE; j++) {
+                    if (!anyB && j != b) continue;
+                    if (op == "sub") {
+                        substitutions[i][j] = cost;
+                    } else if (op == "trans") {
+                        transpositions[i][j] = cost;
+                    }
+                }
+            }
+        }
+    }
+    file.close();
+    return true;
+}
+
+/**
+ * Return the cost of typing 'typed' instead of 'intended'.
+ */
+float ErrorModel::substitutionCost(char typed, char intended) {
+    int a = index(typed);
+    int b = index(intended);
+    if (a < 0 || b < 0) return ERROR_MODEL_DEFAULT_COST;
+    return substitutions[a][b];
+}
+
+/**
+ * Return the cost of typing an extra 'typed' character.
+ */
+float ErrorModel::insertionCost(char typed) {
+    int a = index(typed);
+    if (a < 0) return ERROR_MODEL_DEFAULT_COST;
+    return insertions[a];
+}
+
+/**
+ * Return the cost of omitting the 'intended' character.
+ */
+float ErrorModel::deletionCost(char intended) {
+    int a = index(intended);
+    if (a < 0) return ERROR_MODEL_DEFAULT_COST;
+    return deletions[a];
+}
+
+/**
+ * Return the cost of typing 'first' and 'second' in the
+ * wrong order.
+ */
+float ErrorModel::transpositionCost(char first, char second) {
+    int a = index(first);
+    int b = index(second);
+    if (a < 0 || b < 0) return ERROR_MODEL_DEFAULT_COST;
+    return transpositions[a][b];
+}
@@ -0,0 +1,61 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A noisy channel error model used to rank and prune
+ * spelling corrections.
+ */
+
+#ifndef ERRORMODEL_H
+#define ERRORMODEL_H
+
+#include <string>
+using namespace std;
+
+#define ERROR_MODEL_ALPHABET_SIZE 26
+#define ERROR_MODEL_DEFAULT_COST 10.0f
+
+/**
+ * An error model assigns a cost to each single character edit,
+ * where the cost is the negative log probability of the edit,
+ * i.e. -log P(typo|word). The cost of a variation is the sum of
+ * the costs of its edits, so that candidates can be ranked by
+ *
+ *   log P(word) - cost = log P(word) + log P(typo|word)
+ *
+ * An error model file is a plain text file in which each line
+ * is of the form:
+ *
+ *   sub <typed> <intended> <cost>
+ *   ins <typed> <cost>
+ *   del <intended> <cost>
+ *   trans <first> <second> <cost>
+ *
+ * A '*' in place of a character sets the default cost for all
+ * characters. Lines starting with '#' are ignored. Later lines
+ * override earlier ones, so defaults should come first.
+ *
+ * With no file loaded, all edits cost ERROR_MODEL_DEFAULT_COST,
+ * which is large enough to make the edit count dominate the
+ * word weight (log 255 < 6), as in Norvig's corrector.
+ */
+class ErrorModel {
+
+private:
+    float substitutions[ERROR_MODEL_ALPHABET_SIZE][ERROR_MODEL_ALPHABET_SIZE];
+    float insertions[ERROR_MODEL_ALPHABET_SIZE];
+    float deletions[ERROR_MODEL_ALPHABET_SIZE];
+    float transpositions[ERROR_MODEL_ALPHABET_SIZE][ERROR_MODEL_ALPHABET_SIZE];
+
+    static int index(char c);
+
+public:
+    ErrorModel();
+
+    bool fromFile(const char * filename);
+    float substitutionCost(char typed, char intended);
+    float insertionCost(char typed);
+    float deletionCost(char intended);
+    float transpositionCost(char first, char second);
+};
+
+#endif
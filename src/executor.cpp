@@ -0,0 +1,229 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Interleaving many queries on a few threads.
+ */
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "executor.h"
+#include "queryserver.h"
+
+using namespace std;
+
+/**
+ * Create an executor, and the sessions of its workers.
+ * @param dictionary the dictionary to query
+ * @param numThreads the number of worker threads
+ */
+QueryExecutor::QueryExecutor(const BinaryDictionary* dictionary, int numThreads) {
+    this->dictionary = dictionary;
+    sliceNodes = EXECUTOR_SLICE_NODES;
+    running = false;
+    stopping = false;
+    slices = 0;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&queued, NULL);
+    pthread_cond_init(&finished, NULL);
+    for (int i = 0; i < max(numThreads, 1); i++) {
+        executor_worker* worker = new executor_worker();
+        worker->executor = this;
+        worker->session = new DictionarySession(dictionary);
+        worker->admit = true;
+        workers.push_back(worker);
+    }
+}
+
+QueryExecutor::~QueryExecutor() {
+    stop();
+    for (int i = 0; i < workers.size(); i++) {
+        for (int j = 0; j < workers[i]->fibers.size(); j++) {
+            munmap(workers[i]->fibers[j]->stack, EXECUTOR_STACK_SIZE);
+            delete workers[i]->fibers[j];
+        }
+        delete workers[i]->session;
+        delete workers[i];
+    }
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&queued);
+    pthread_cond_destroy(&finished);
+}
+
+/**
+ * Start the workers.
+ * @return false if they are already started
+ */
+bool QueryExecutor::start() {
+    if (running) return false;
+    stopping = false;
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_create(&workers[i]->thread, NULL, QueryExecutor::runWorker, workers[i]);
+    }
+    running = true;
+    return true;
+}
+
+/**
+ * Stop the workers, once they have run the queries submitted.
+ */
+void QueryExecutor::stop() {
+    if (!running) return;
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i]->thread, NULL);
+    }
+    running = false;
+}
+
+/**
+ * Queue a query for the first worker with a free fiber. The query
+ * runs once the executor is started.
+ */
+void QueryExecutor::submit(QueryTask* task) {
+    task->done = 0;
+    pthread_mutex_lock(&lock);
+    pending.push_back(task);
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Wait until a query is done. Queries with a callback must not be
+ * waited for.
+ */
+void QueryExecutor::wait(QueryTask* task) {
+    pthread_mutex_lock(&lock);
+    while (!task->done) {
+        pthread_cond_wait(&finished, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Return the number of slices run since the executor was created,
+ * i.e. the number of times the workers switched to a query.
+ */
+long QueryExecutor::getSlices() {
+    return __sync_fetch_and_add(&slices, 0);
+}
+
+/**
+ * Mark a query as done, and call its callback, after which the task
+ * may be gone.
+ */
+void QueryExecutor::finish(QueryTask* task) {
+    void (*callback)(QueryTask*, void*) = task->callback;
+    void* callbackArg = task->callbackArg;
+    pthread_mutex_lock(&lock);
+    task->done = 1;
+    pthread_cond_broadcast(&finished);
+    pthread_mutex_unlock(&lock);
+    if (callback != NULL) {
+        callback(task, callbackArg);
+    }
+}
+
+/**
+ * Start a query on an idle fiber of a worker, or on a new one, at
+ * the front of the queries in progress. The stack of a new fiber
+ * ends with a guard page below it, so that a query overflowing it
+ * crashes instead of overwriting the memory next to it.
+ */
+void QueryExecutor::startFiber(executor_worker* worker, QueryTask* task) {
+    executor_fiber* fiber;
+    if (!worker->idle.empty()) {
+        fiber = worker->idle.back();
+        worker->idle.pop_back();
+    } else {
+        fiber = new executor_fiber();
+        fiber->stack = (char*) mmap(NULL, EXECUTOR_STACK_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        mprotect(fiber->stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+        fiber->worker = worker;
+        worker->fibers.push_back(fiber);
+    }
+    fiber->task = task;
+    fiber->finished = false;
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack;
+    fiber->context.uc_stack.ss_size = EXECUTOR_STACK_SIZE;
+    fiber->context.uc_link = &worker->context;
+    // makecontext() only passes ints
+    unsigned long long address = (unsigned long long) (size_t) fiber;
+    makecontext(&fiber->context, (void (*)()) QueryExecutor::runFiber, 2,
+            (unsigned int) (address >> 32), (unsigned int) address);
+    worker->running.push_front(fiber);
+}
+
+/**
+ * Run the query of a fiber, yielding back to its worker every
+ * 'sliceNodes' nodes, and return to the worker once it is done.
+ */
+void QueryExecutor::runFiber(unsigned int high, unsigned int low) {
+    executor_fiber* fiber = (executor_fiber*) (size_t) (((unsigned long long) high << 32) | low);
+    executor_worker* worker = fiber->worker;
+    QueryTask* task = fiber->task;
+    task->budget.setYield(worker->executor->sliceNodes, QueryExecutor::yieldFiber, fiber);
+    QueryServer::execute(worker->session, task->request, &task->response, &task->budget);
+    task->budget.setYield(0, NULL, NULL);
+    fiber->finished = true;
+}
+
+/**
+ * Switch from a fiber back to its worker, until the worker resumes
+ * the fiber.
+ */
+void QueryExecutor::yieldFiber(void* arg) {
+    executor_fiber* fiber = (executor_fiber*) arg;
+    swapcontext(&fiber->context, &fiber->worker->context);
+}
+
+/**
+ * Run the queries submitted until the executor stops, a slice at a
+ * time, taking turns between starting a new query and resuming the
+ * oldest one in progress.
+ */
+void* QueryExecutor::runWorker(void* arg) {
+    executor_worker* worker = (executor_worker*) arg;
+    QueryExecutor* executor = worker->executor;
+    pthread_mutex_lock(&executor->lock);
+    while (true) {
+        while (executor->pending.empty() && worker->running.empty() && !executor->stopping) {
+            pthread_cond_wait(&executor->queued, &executor->lock);
+        }
+        if (executor->pending.empty() && worker->running.empty()) break;
+        bool admit = worker->admit || worker->running.empty();
+        if (admit && !executor->pending.empty() && worker->running.size() < EXECUTOR_FIBERS) {
+            QueryTask* task = executor->pending.front();
+            executor->pending.pop_front();
+            pthread_mutex_unlock(&executor->lock);
+            executor->startFiber(worker, task);
+        } else {
+            pthread_mutex_unlock(&executor->lock);
+        }
+        worker->admit = !worker->admit;
+
+        executor_fiber* fiber = worker->running.front();
+        worker->running.pop_front();
+        swapcontext(&worker->context, &fiber->context);
+        __sync_add_and_fetch(&executor->slices, 1);
+        if (fiber->finished) {
+            QueryTask* task = fiber->task;
+            fiber->task = NULL;
+            worker->idle.push_back(fiber);
+            executor->finish(task);
+        } else {
+            worker->running.push_back(fiber);
+        }
+        pthread_mutex_lock(&executor->lock);
+    }
+    pthread_mutex_unlock(&executor->lock);
+    return NULL;
+}
@@ -0,0 +1,195 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Interleaving many queries on a few threads.
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+#include <ucontext.h>
+#include "bindict.h"
+#include "session.h"
+#include "protocol.h"
+using namespace std;
+
+#define EXECUTOR_SLICE_NODES 256
+#define EXECUTOR_FIBERS 64
+#define EXECUTOR_STACK_SIZE 131072
+
+class QueryExecutor;
+class QueryTask;
+
+/**
+ * A query run by a QueryExecutor: the request, of the binary
+ * protocol, cf. protocol.h, its budget, and once done, its response.
+ * A task must not be changed nor destroyed from the time it is
+ * submitted until it is done, or until its callback is called.
+ */
+class QueryTask {
+
+friend class QueryExecutor;
+
+private:
+    QueryBudget budget;
+    void (*callback)(QueryTask*, void*);
+    void* callbackArg;
+    volatile int done;
+
+public:
+    query_request request;
+    query_response response;
+
+    QueryTask() : budget(0, 0) { callback = NULL; callbackArg = NULL; done = 0; }
+
+    /**
+     * Limit the query, cf. QueryBudget; the deadline runs from now.
+     */
+    void setBudget(double milliseconds, long maxNodes) { budget = QueryBudget(milliseconds, maxNodes); }
+
+    /**
+     * Call a function on the thread of the executor once the query is
+     * done, instead of waiting for it.
+     */
+    void setCallback(void (*callback)(QueryTask*, void*), void* arg) { this->callback = callback; callbackArg = arg; }
+
+    bool isDone() { return __sync_fetch_and_add(&done, 0) != 0; }
+    bool isPartial() { return budget.isPartial(); }
+};
+
+/**
+ * A query in progress on a worker of an executor, with the stack it
+ * runs on, mapped with a guard page, and the context to switch back
+ * to it.
+ */
+struct executor_fiber {
+    ucontext_t context;
+    char* stack;
+    QueryTask* task;
+    bool finished;
+    struct executor_worker* worker;
+};
+
+/**
+ * A worker thread of an executor, with its own session on the
+ * dictionary, the queries in progress on it, round robin, and its
+ * idle fibers.
+ */
+struct executor_worker {
+    QueryExecutor* executor;
+    pthread_t thread;
+    ucontext_t context;
+    DictionarySession* session;
+    vector<executor_fiber*> fibers;
+    vector<executor_fiber*> idle;
+    deque<executor_fiber*> running;
+    bool admit;
+};
+
+/**
+ * An executor runs many queries at once on a few threads, e.g.
+ *
+ * QueryExecutor executor(&bindict, 2);
+ * executor.start();
+ * QueryTask task;
+ * task.request = request;
+ * executor.submit(&task);
+ * executor.wait(&task);
+ * task.response => [{'you':200}, ...]
+ *
+ * Each query runs on a fiber, a stack of its own, which it leaves
+ * every 'sliceNodes' nodes of its search, cf. QueryBudget::setYield,
+ * for the worker to resume the next query in progress. A worker
+ * takes turns between starting a submitted query and resuming the
+ * queries in progress, round robin, so that a short query does not
+ * wait for the long ones submitted before it, and long ones are not
+ * starved by a stream of short ones. Each worker holds at most
+ * EXECUTOR_FIBERS queries in progress, and queries are not moved
+ * from one worker to another once started.
+ *
+ * Queries yield in the middle of the searches, but never in the
+ * middle of a cache operation, so that the queries in progress on a
+ * worker share its session.
+ *
+ * When compiled as C++20, a QueryAwaiter lets coroutines co_await
+ * queries instead.
+ */
+class QueryExecutor {
+
+private:
+    const BinaryDictionary* dictionary;
+    vector<executor_worker*> workers;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t finished;
+    deque<QueryTask*> pending;
+    int sliceNodes;
+    bool running;
+    bool stopping;
+    volatile long slices;
+
+    // Workers are owned, and locks can't be copied
+    QueryExecutor(const QueryExecutor&);
+    QueryExecutor& operator=(const QueryExecutor&);
+
+    static void* runWorker(void* worker);
+    static void runFiber(unsigned int high, unsigned int low);
+    static void yieldFiber(void* fiber);
+    void startFiber(executor_worker* worker, QueryTask* task);
+    void finish(QueryTask* task);
+
+public:
+    QueryExecutor(const BinaryDictionary* dictionary, int numThreads);
+    ~QueryExecutor();
+
+    void setSliceNodes(int nodes) { sliceNodes = max(nodes, 1); }
+    bool start();
+    void stop();
+    void submit(QueryTask* task);
+    void wait(QueryTask* task);
+    long getSlices();
+};
+
+#if __cplusplus >= 202002L
+#include <coroutine>
+
+/**
+ * Await a query from a C++20 coroutine, e.g.
+ *
+ * QueryTask task;
+ * task.request = request;
+ * query_response& response = co_await QueryAwaiter(&executor, &task);
+ *
+ * The coroutine is resumed on the thread of the executor which ran
+ * the query, and should hand itself over to another executor before
+ * doing any long work there.
+ */
+class QueryAwaiter {
+
+private:
+    QueryExecutor* executor;
+    QueryTask* task;
+
+    static void resume(QueryTask* task, void* address) {
+        std::coroutine_handle<>::from_address(address).resume();
+    }
+
+public:
+    QueryAwaiter(QueryExecutor* executor, QueryTask* task) : executor(executor), task(task) {}
+
+    bool await_ready() { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        task->setCallback(QueryAwaiter::resume, handle.address());
+        executor->submit(task);
+    }
+
+    query_response& await_resume() { return task->response; }
+};
+#endif
+
+#endif
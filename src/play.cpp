@@ -1,13 +1,377 @@
 /**
  * Copyright 2012 8pen
  *
- * BinaryDictionary playground
+ * BinaryDictionary playground: runs queries read line by line.
+ *
+ * Usage: ./Play [-j THREADS] [-n RESULTS] [-t DEADLINE] [-o tsv|json] [-m ERROR_MODEL] DICTIONARY [QUERIES]
+ *
+ * Reads queries from the file QUERIES, or from the standard input,
+ * one per line:
+ *
+ * predict how are       the next words after 'how are'
+ * correct yuur          the corrections of 'yuur'
+ * correct how are yuu   the corrections of 'yuu' after 'how are'
+ * complete yo 3         the 3 heaviest completions of 'yo'
+ * exists hello          'hello' if it is a word
+ *
+ * where a trailing number is the maximum number of results (by
+ * default RESULTS, or 3). Prints a line per query, in the order of
+ * the queries, either as tab separated values:
+ *
+ * complete yo 3 <TAB> ok <TAB> you:200 your:100 <TAB> 4.2
+ *
+ * i.e. the query, 'ok' or 'error', the results with their weights,
+ * and the time taken in microseconds, or as JSON objects with the
+ * same fields:
+ *
+ * {"query": "complete yo 3", "status": "ok", "results": [{"value": "you", "weight": 200}, ...], "micros": 4.2}
+ *
+ * With a DEADLINE, in milliseconds, each query returns the results
+ * found by then, and its status is 'partial' if it ran out of time.
+ *
+ * With THREADS threads, blocks of queries are run in parallel, while
+ * the results of the previous blocks are printed; at most 2 blocks
+ * per thread are in memory at once, so that arbitrarily long query
+ * logs can be replayed. The number of queries per second is reported
+ * on the standard error.
  */
 
-#include <UnitTest++.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <iostream>
+#include <fstream>
+#include <sstream>
 #include "bindict.h"
+#include "errormodel.h"
+#include "session.h"
+
+using namespace std;
+
+#define DEFAULT_RESULTS 3
+#define BLOCK_SIZE 1024
+#define BLOCKS_PER_THREAD 2
+#define FORMAT_TSV 0
+#define FORMAT_JSON 1
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * Append a string to a buffer as a JSON string.
+ */
+static void appendJson(string* buffer, const string& value) {
+    buffer->push_back('"');
+    for (int i = 0; i < value.length(); i++) {
+        unsigned char c = value[i];
+        if (c == '"' || c == '\\') {
+            buffer->push_back('\\');
+            buffer->push_back(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            buffer->append(escaped);
+        } else {
+            buffer->push_back(c);
+        }
+    }
+    buffer->push_back('"');
+}
+
+/**
+ * Run a query with a session.
+ * @param session the session
+ * @param query the query line
+ * @param defaultResults the number of results of queries which do
+ * not give one
+ * @param budget the budget of the query, or NULL for none
+ * @param results a holder for the results
+ * @return an error message, or an empty string if the query is valid
+ */
+static string run(DictionarySession& session, const string& query, int defaultResults, QueryBudget* budget, vector<weighted_string>& results) {
+    istringstream tokens(query);
+    string command;
+    tokens >> command;
+    vector<string> words;
+    string word;
+    while (tokens >> word) {
+        words.push_back(word);
+    }
+    int maxResults = defaultResults;
+    if (!words.empty() && words.back().find_first_not_of("0123456789") == string::npos) {
+        maxResults = atoi(words.back().c_str());
+        words.pop_back();
+    }
+
+    vector<weighted_string> holder;
+    results.clear();
+    if (command.empty()) {
+        return "empty query";
+    } else if (words.empty()) {
+        return "no words";
+    } else if (command == "predict") {
+        results = session.getPredictions(&words[0], words.size(), holder, maxResults, budget);
+    } else if (command == "correct" && words.size() == 1) {
+        results = session.getCorrections(words[0], holder, maxResults, budget);
+    } else if (command == "correct") {
+        results = session.getCorrections(&words[0], words.size() - 1, words.back(), holder, maxResults, budget);
+    } else if (command == "complete" && words.size() == 1) {
+        results = session.getTopCompletions(words[0], holder, maxResults, budget);
+    } else if (command == "exists" && words.size() == 1) {
+        if (session.exists(words[0])) {
+            weighted_string result;
+            result.value = words[0];
+            result.weight = 0;
+            results.push_back(result);
+        }
+    } else if (command == "complete" || command == "exists") {
+        return "one word expected";
+    } else {
+        return "unknown command " + command;
+    }
+    return "";
+}
+
+/**
+ * Run a query, and append its output line to a buffer.
+ */
+static void runLine(DictionarySession& session, const string& query, int defaultResults, double deadline, int format, string* output) {
+    vector<weighted_string> results;
+    double start = now();
+    QueryBudget budget(deadline, 0);
+    string error = run(session, query, defaultResults, deadline > 0 ? &budget : NULL, results);
+    double micros = (now() - start) * 1000;
+    string status = !error.empty() ? "error" : budget.isPartial() ? "partial" : "ok";
+
+    ostringstream line;
+    if (format == FORMAT_JSON) {
+        string json = "{\"query\": ";
+        appendJson(&json, query);
+        json += ", \"status\": \"" + status + (error.empty() ? "\", \"results\": [" : "\", \"error\": ");
+        if (!error.empty()) {
+            appendJson(&json, error);
+        }
+        for (int i = 0; i < results.size(); i++) {
+            json += i > 0 ? ", {\"value\": " : "{\"value\": ";
+            appendJson(&json, results[i].value);
+            ostringstream weight;
+            weight << ", \"weight\": " << results[i].weight << "}";
+            json += weight.str();
+        }
+        line << json << (error.empty() ? "]" : "") << ", \"micros\": " << micros << "}\n";
+    } else {
+        line << query << '\t' << status << '\t';
+        if (!error.empty()) {
+            line << error;
+        }
+        for (int i = 0; i < results.size(); i++) {
+            line << (i > 0 ? " " : "") << results[i].value << ':' << results[i].weight;
+        }
+        line << '\t' << micros << '\n';
+    }
+    output->append(line.str());
+}
+
+/**
+ * A block of queries, and their output lines once they have run.
+ */
+struct play_block {
+    vector<string> queries;
+    string output;
+    bool done;
+};
+
+/**
+ * The blocks being run by a pool of threads, in the order of the
+ * queries, and the blocks waiting for a thread.
+ */
+struct play_pool {
+    const BinaryDictionary* dictionary;
+    int defaultResults;
+    double deadline;
+    int format;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t done;
+    deque<play_block*> blocks;
+    deque<play_block*> waiting;
+    bool stopping;
+};
+
+static void* runBlocks(void* arg) {
+    play_pool* pool = (play_pool*) arg;
+    DictionarySession session(pool->dictionary);
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->waiting.empty() && !pool->stopping) {
+            pthread_cond_wait(&pool->queued, &pool->lock);
+        }
+        if (pool->waiting.empty()) break;
+        play_block* block = pool->waiting.front();
+        pool->waiting.pop_front();
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 0; i < block->queries.size(); i++) {
+            runLine(session, block->queries[i], pool->defaultResults, pool->deadline, pool->format, &block->output);
+        }
+        pthread_mutex_lock(&pool->lock);
+        block->done = true;
+        pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * Print the blocks which have run, in order, and wait until fewer
+ * than 'maxBlocks' blocks are in memory. Called with the lock of the
+ * pool held.
+ */
+static void printBlocks(play_pool& pool, int maxBlocks) {
+    while (!pool.blocks.empty()) {
+        play_block* block = pool.blocks.front();
+        if (!block->done) {
+            if (pool.blocks.size() < maxBlocks) break;
+            pthread_cond_wait(&pool.done, &pool.lock);
+            continue;
+        }
+        pool.blocks.pop_front();
+        pthread_mutex_unlock(&pool.lock);
+        cout << block->output;
+        delete block;
+        pthread_mutex_lock(&pool.lock);
+    }
+}
+
+/**
+ * Run the queries of a stream on a pool of threads, printing their
+ * output in order.
+ * @return the number of queries
+ */
+static long runThreads(const BinaryDictionary& bindict, istream& in, int numThreads, int defaultResults, double deadline, int format) {
+    play_pool pool;
+    pool.dictionary = &bindict;
+    pool.defaultResults = defaultResults;
+    pool.deadline = deadline;
+    pool.format = format;
+    pool.stopping = false;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.queued, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pthread_t threads[numThreads];
+    for (int i = 0; i < numThreads; i++) {
+        pthread_create(&threads[i], NULL, runBlocks, &pool);
+    }
+
+    int maxBlocks = BLOCKS_PER_THREAD * numThreads;
+    long numQueries = 0;
+    string query;
+    bool more = true;
+    while (more) {
+        play_block* block = new play_block();
+        block->done = false;
+        while (block->queries.size() < BLOCK_SIZE && (more = !getline(in, query).fail())) {
+            block->queries.push_back(query);
+        }
+        numQueries += block->queries.size();
+        pthread_mutex_lock(&pool.lock);
+        pool.blocks.push_back(block);
+        pool.waiting.push_back(block);
+        pthread_cond_signal(&pool.queued);
+        printBlocks(pool, maxBlocks);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    printBlocks(pool, 1);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.queued);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.queued);
+    pthread_cond_destroy(&pool.done);
+    return numQueries;
+}
+
+int main(int argc, char ** argv) {
+    int numThreads = 1;
+    int defaultResults = DEFAULT_RESULTS;
+    double deadline = 0;
+    int format = FORMAT_TSV;
+    const char * errorModelFile = NULL;
+    int option;
+    const char * usage = " [-j THREADS] [-n RESULTS] [-t DEADLINE] [-o tsv|json] [-m ERROR_MODEL] DICTIONARY [QUERIES]";
+    while ((option = getopt(argc, argv, "j:n:t:o:m:")) != -1) {
+        switch (option) {
+        case 'j': numThreads = atoi(optarg); break;
+        case 'n': defaultResults = atoi(optarg); break;
+        case 't': deadline = atof(optarg); break;
+        case 'o': format = string(optarg) == "json" ? FORMAT_JSON : FORMAT_TSV; break;
+        case 'm': errorModelFile = optarg; break;
+        default:
+            cerr << "Usage: " << argv[0] << usage << endl;
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return 2;
+    }
+
+    BinaryDictionary bindict;
+    bindict.fromFile(argv[optind]);
+    if (!bindict.isLoaded()) {
+        cerr << "Unable to load " << argv[optind] << endl;
+        return 1;
+    }
+    ErrorModel model;
+    if (errorModelFile != NULL) {
+        if (!model.fromFile(errorModelFile)) {
+            cerr << "Unable to load " << errorModelFile << endl;
+            return 1;
+        }
+        bindict.setErrorModel(&model);
+    }
+    ifstream file;
+    if (optind + 1 < argc) {
+        file.open(argv[optind + 1]);
+        if (!file) {
+            cerr << "Unable to open " << argv[optind + 1] << endl;
+            return 1;
+        }
+    }
+    istream& in = file.is_open() ? (istream&) file : cin;
+
+    ios::sync_with_stdio(false);
+    double start = now();
+    long numQueries = 0;
+    if (numThreads > 1) {
+        numQueries = runThreads(bindict, in, numThreads, defaultResults, deadline, format);
+    } else {
+        DictionarySession session(&bindict);
+        string query;
+        string output;
+        while (getline(in, query)) {
+            output.clear();
+            runLine(session, query, defaultResults, deadline, format, &output);
+            cout << output;
+            numQueries++;
+        }
+    }
+    cout.flush();
 
-// TODO
-int main() {
-    cout << "Welcome to the suggest playground!" << endl;
-}
\ No newline at end of file
+    double elapsed = now() - start;
+    cerr << numQueries << " queries in " << elapsed << "ms on " << max(numThreads, 1) << " threads ("
+         << (long) (numQueries / elapsed * 1000) << " queries/s)" << endl;
+    return 0;
+}
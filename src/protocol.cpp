@@ -0,0 +1,236 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * The binary protocol of the query server.
+ */
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+using namespace std;
+
+#define RECEIVE_BUFFER_SIZE 65536
+
+static void putInt(string* buffer, unsigned int value) {
+    buffer->push_back((char) (value >> 24));
+    buffer->push_back((char) (value >> 16));
+    buffer->push_back((char) (value >> 8));
+    buffer->push_back((char) value);
+}
+
+static unsigned int getInt(const char* bytes) {
+    const unsigned char* b = (const unsigned char*) bytes;
+    return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/**
+ * Return the size of the frame at the start of a buffer.
+ * @return the size of the frame, 0 if the buffer does not hold it
+ * entirely yet, or -1 if it is too large
+ */
+static int getFrameSize(const char* bytes, int length) {
+    if (length < 4) return 0;
+    unsigned int size = getInt(bytes) + 4;
+    if (size > MAX_FRAME_SIZE) return -1;
+    return size <= length ? size : 0;
+}
+
+/**
+ * Append a request frame to a buffer. Words longer than 255 bytes,
+ * and words after the 255th, are left out.
+ */
+void encodeRequest(const query_request& request, string* buffer) {
+    int start = buffer->size();
+    putInt(buffer, 0);
+    putInt(buffer, request.id);
+    buffer->push_back((char) request.type);
+    buffer->push_back((char) min(request.maxResults, 255));
+    int numWords = min((int) request.words.size(), 255);
+    buffer->push_back((char) numWords);
+    for (int i = 0; i < numWords; i++) {
+        int length = min((int) request.words[i].length(), 255);
+        buffer->push_back((char) length);
+        buffer->append(request.words[i], 0, length);
+    }
+    unsigned int size = buffer->size() - start - 4;
+    for (int i = 0; i < 4; i++) {
+        (*buffer)[start + i] = (char) (size >> (24 - 8*i));
+    }
+}
+
+/**
+ * Decode the request frame at the start of a buffer.
+ * @param bytes the buffer
+ * @param length the number of bytes in the buffer
+ * @param request a holder for the request
+ * @return the size of the frame, 0 if the buffer does not hold it
+ * entirely yet, or -1 if it is malformed
+ */
+int decodeRequest(const char* bytes, int length, query_request* request) {
+    int size = getFrameSize(bytes, length);
+    if (size <= 0) return size;
+    if (size < 11) return -1;
+    request->id = getInt(bytes + 4);
+    request->type = (unsigned char) bytes[8];
+    request->maxResults = (unsigned char) bytes[9];
+    int numWords = (unsigned char) bytes[10];
+    request->words.resize(numWords);
+    int offset = 11;
+    for (int i = 0; i < numWords; i++) {
+        if (offset >= size) return -1;
+        int wordLength = (unsigned char) bytes[offset];
+        if (offset + 1 + wordLength > size) return -1;
+        request->words[i].assign(bytes + offset + 1, wordLength);
+        offset += 1 + wordLength;
+    }
+    return size;
+}
+
+/**
+ * Append a response frame to a buffer. Results after the 255th are
+ * left out.
+ */
+void encodeResponse(const query_response& response, string* buffer) {
+    int start = buffer->size();
+    putInt(buffer, 0);
+    putInt(buffer, response.id);
+    buffer->push_back((char) response.status);
+    int numResults = min((int) response.results.size(), 255);
+    buffer->push_back((char) numResults);
+    for (int i = 0; i < numResults; i++) {
+        const weighted_string& result = response.results[i];
+        int length = min((int) result.value.length(), 255);
+        buffer->push_back((char) min(max(result.weight, 0), 255));
+        buffer->push_back((char) length);
+        buffer->append(result.value, 0, length);
+    }
+    unsigned int size = buffer->size() - start - 4;
+    for (int i = 0; i < 4; i++) {
+        (*buffer)[start + i] = (char) (size >> (24 - 8*i));
+    }
+}
+
+/**
+ * Decode the response frame at the start of a buffer, cf.
+ * decodeRequest().
+ */
+int decodeResponse(const char* bytes, int length, query_response* response) {
+    int size = getFrameSize(bytes, length);
+    if (size <= 0) return size;
+    if (size < 10) return -1;
+    response->id = getInt(bytes + 4);
+    response->status = (unsigned char) bytes[8];
+    int numResults = (unsigned char) bytes[9];
+    response->results.resize(numResults);
+    int offset = 10;
+    for (int i = 0; i < numResults; i++) {
+        if (offset + 2 > size) return -1;
+        int resultLength = (unsigned char) bytes[offset + 1];
+        if (offset + 2 + resultLength > size) return -1;
+        response->results[i].weight = (unsigned char) bytes[offset];
+        response->results[i].value.assign(bytes + offset + 2, resultLength);
+        offset += 2 + resultLength;
+    }
+    return size;
+}
+
+/**
+ * Connect to a server listening on a Unix socket.
+ * @param path the path of the socket
+ * @return false if the connection failed
+ */
+bool QueryClient::connectUnix(const char * path) {
+    disconnect();
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Connect to a server listening on a loopback TCP port.
+ * @param port the port
+ * @return false if the connection failed
+ */
+bool QueryClient::connectTcp(int port) {
+    disconnect();
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        disconnect();
+        return false;
+    }
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return true;
+}
+
+void QueryClient::disconnect() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    in.clear();
+}
+
+/**
+ * Send encoded request frames.
+ * @return false if the connection failed
+ */
+bool QueryClient::send(const string& frames) {
+    int sent = 0;
+    while (sent < frames.size()) {
+        int n = ::send(fd, frames.data() + sent, frames.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+/**
+ * Wait for the next response.
+ * @return false if the connection failed, or the response is
+ * malformed
+ */
+bool QueryClient::receive(query_response* response) {
+    while (true) {
+        int size = decodeResponse(in.data(), in.size(), response);
+        if (size < 0) return false;
+        if (size > 0) {
+            in.erase(0, size);
+            return true;
+        }
+        char buffer[RECEIVE_BUFFER_SIZE];
+        int n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) return false;
+        in.append(buffer, n);
+    }
+}
+
+/**
+ * Send a request, and wait for its response.
+ * @return false if the connection failed
+ */
+bool QueryClient::query(const query_request& request, query_response* response) {
+    string frame;
+    encodeRequest(request, &frame);
+    return send(frame) && receive(response);
+}
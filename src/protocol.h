@@ -0,0 +1,105 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * The binary protocol of the query server.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string>
+#include <vector>
+#include "bindict.h"
+using namespace std;
+
+/**
+ * Requests and responses are frames of at most MAX_FRAME_SIZE bytes,
+ * starting with the size of the rest of the frame. Integers are big
+ * endian, as in dictionary files.
+ *
+ * ========================================================
+ * Request
+ * --------------------------------------------------------
+ * 0,1,2,3 : size of the rest of the frame
+ * 4..7    : request id, echoed in the response
+ * 8       : type (QUERY_*)
+ * 9       : maximum number of results
+ * 10      : number of words
+ * .       : length of word1
+ * ...     : word1
+ * ...     : wordn
+ * ========================================================
+ * Response
+ * --------------------------------------------------------
+ * 0,1,2,3 : size of the rest of the frame
+ * 4..7    : request id
+ * 8       : status (STATUS_*)
+ * 9       : number of results
+ * .       : weight of result1
+ * .       : length of result1
+ * ...     : result1
+ * ...     : resultn
+ * ========================================================
+ *
+ * The words of a request are the word for QUERY_EXISTS, the context
+ * for QUERY_PREDICTIONS, the context followed by the word to correct
+ * for QUERY_CORRECTIONS, and the prefix for QUERY_COMPLETIONS. An
+ * existing word is returned as the only result of QUERY_EXISTS.
+ * Responses to the requests of a connection are sent in order.
+ */
+
+#define MAX_FRAME_SIZE 65536
+#define QUERY_EXISTS 1
+#define QUERY_PREDICTIONS 2
+#define QUERY_CORRECTIONS 3
+#define QUERY_COMPLETIONS 4
+#define STATUS_OK 0
+#define STATUS_BAD_REQUEST 1
+
+struct query_request {
+    unsigned int id;
+    int type;
+    int maxResults;
+    vector<string> words;
+};
+
+struct query_response {
+    unsigned int id;
+    int status;
+    vector<weighted_string> results;
+};
+
+void encodeRequest(const query_request& request, string* buffer);
+int decodeRequest(const char* bytes, int length, query_request* request);
+void encodeResponse(const query_response& response, string* buffer);
+int decodeResponse(const char* bytes, int length, query_response* response);
+
+/**
+ * A blocking connection to a query server, e.g.
+ *
+ * QueryClient client;
+ * client.connectUnix("/tmp/suggest.sock");
+ * client.query(request, &response);
+ */
+class QueryClient {
+
+private:
+    int fd;
+    string in;
+
+    QueryClient(const QueryClient&);
+    QueryClient& operator=(const QueryClient&);
+
+public:
+    QueryClient() { fd = -1; }
+    ~QueryClient() { disconnect(); }
+
+    bool connectUnix(const char * path);
+    bool connectTcp(int port);
+    void disconnect();
+    bool send(const string& frames);
+    bool receive(query_response* response);
+    bool query(const query_request& request, query_response* response);
+};
+
+#endif
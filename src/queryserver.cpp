@@ -0,0 +1,565 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A server answering dictionary queries over a local socket.
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "queryserver.h"
+
+using namespace std;
+
+#define LISTEN_BACKLOG 128
+#define MAX_EVENTS 64
+#define POLL_TIMEOUT_MILLISECONDS 100
+#define READ_BUFFER_SIZE 65536
+#define DEFAULT_MAX_BATCH_SIZE 256
+#define DEFAULT_MAX_BATCH_WAIT 0
+#define MAX_IOVECS 256
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/**
+ * Orders the requests of a batch by type, then words, so that the
+ * requests with the same context or prefix are answered one after
+ * the other, and identical requests are adjacent.
+ */
+struct request_order {
+    const vector<query_request>* requests;
+
+    bool operator()(int a, int b) const {
+        const query_request& first = (*requests)[a];
+        const query_request& second = (*requests)[b];
+        if (first.type != second.type) return first.type < second.type;
+        if (first.maxResults != second.maxResults) return first.maxResults < second.maxResults;
+        return first.words < second.words;
+    }
+};
+
+/**
+ * Orders the requests of a batch by connection.
+ */
+struct connection_order {
+    const vector<server_connection*>* connections;
+
+    bool operator()(int a, int b) const {
+        return std::less<server_connection*>()((*connections)[a], (*connections)[b]);
+    }
+};
+
+/**
+ * Create a server, and its workers.
+ * @param dictionary the dictionary to query
+ * @param numThreads the number of workers
+ */
+QueryServer::QueryServer(const BinaryDictionary* dictionary, int numThreads) {
+    this->dictionary = dictionary;
+    listener = -1;
+    running = false;
+    stopping = 0;
+    maxBatchSize = DEFAULT_MAX_BATCH_SIZE;
+    maxBatchWait = DEFAULT_MAX_BATCH_WAIT;
+    int numWorkers = numThreads > 0 ? numThreads : 1;
+    for (int i = 0; i < numWorkers; i++) {
+        server_worker* worker = new server_worker();
+        worker->server = this;
+        worker->epoll = epoll_create(MAX_EVENTS);
+        pipe(worker->handoff);
+        setNonBlocking(worker->handoff[0]);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->handoff[0], &event);
+        worker->session = new DictionarySession(dictionary);
+        worker->batchSize = 0;
+        worker->batchDeadline = 0;
+        worker->requests = 0;
+        worker->batches = 0;
+        workers.push_back(worker);
+    }
+}
+
+QueryServer::~QueryServer() {
+    stop();
+    for (int i = 0; i < workers.size(); i++) {
+        close(workers[i]->epoll);
+        close(workers[i]->handoff[0]);
+        close(workers[i]->handoff[1]);
+        delete workers[i]->session;
+        delete workers[i];
+    }
+    if (listener >= 0) {
+        close(listener);
+    }
+    if (!socketPath.empty()) {
+        unlink(socketPath.c_str());
+    }
+}
+
+/**
+ * Listen on a Unix socket, replacing any file at its path.
+ * @param path the path of the socket
+ * @return false if the socket could not be bound
+ */
+bool QueryServer::listenUnix(const char * path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+            listen(listener, LISTEN_BACKLOG) != 0) {
+        return false;
+    }
+    socketPath = path;
+    return true;
+}
+
+/**
+ * Listen on a TCP port of the loopback interface.
+ * @param port the port
+ * @return false if the port could not be bound
+ */
+bool QueryServer::listenTcp(int port) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) return false;
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+            listen(listener, LISTEN_BACKLOG) != 0) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Set the bounds of the batches of requests, before starting the
+ * server. By default, batches have at most 256 requests, and are
+ * answered as soon as the connections which are ready have been
+ * read.
+ * @param maxBatchSize the maximum number of requests of a batch
+ * @param maxBatchWait the maximum time, in milliseconds, a request
+ * waits for other requests to be batched with
+ */
+void QueryServer::setBatching(int maxBatchSize, int maxBatchWait) {
+    this->maxBatchSize = max(maxBatchSize, 1);
+    this->maxBatchWait = max(maxBatchWait, 0);
+}
+
+/**
+ * Start accepting connections, and answering their requests, on
+ * background threads.
+ * @return false if the server does not listen
+ */
+bool QueryServer::start() {
+    if (listener < 0 || running) return false;
+    __sync_lock_release(&stopping);
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_create(&workers[i]->thread, NULL, QueryServer::runWorker, workers[i]);
+    }
+    pthread_create(&acceptThread, NULL, QueryServer::runAccept, this);
+    running = true;
+    return true;
+}
+
+/**
+ * Stop the server, closing all connections.
+ */
+void QueryServer::stop() {
+    if (!running) return;
+    __sync_lock_test_and_set(&stopping, 1);
+    shutdown(listener, SHUT_RDWR);
+    pthread_join(acceptThread, NULL);
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i]->thread, NULL);
+    }
+    running = false;
+}
+
+/**
+ * Return the number of requests answered since the server started.
+ */
+long QueryServer::getRequests() {
+    long requests = 0;
+    for (int i = 0; i < workers.size(); i++) {
+        requests += __sync_fetch_and_add(&workers[i]->requests, 0);
+    }
+    return requests;
+}
+
+/**
+ * Return the number of batches answered since the server started.
+ */
+long QueryServer::getBatches() {
+    long batches = 0;
+    for (int i = 0; i < workers.size(); i++) {
+        batches += __sync_fetch_and_add(&workers[i]->batches, 0);
+    }
+    return batches;
+}
+
+/**
+ * Answer a request with a session.
+ * @param session the session
+ * @param request the request
+ * @param response a holder for the response
+ * @param budget the budget of the request, or NULL for none
+ */
+void QueryServer::execute(DictionarySession* session, const query_request& request, query_response* response, QueryBudget* budget) {
+    response->id = request.id;
+    response->status = STATUS_OK;
+    response->results.clear();
+    int numWords = request.words.size();
+    vector<weighted_string> holder;
+    if (request.type == QUERY_EXISTS && numWords == 1) {
+        if (session->exists(request.words[0])) {
+            weighted_string word;
+            word.value = request.words[0];
+            word.weight = 0;
+            response->results.push_back(word);
+        }
+    } else if (request.type == QUERY_PREDICTIONS && numWords > 0) {
+        vector<string> context(request.words);
+        response->results = session->getPredictions(&context[0], numWords, holder, request.maxResults, budget);
+    } else if (request.type == QUERY_CORRECTIONS && numWords == 1) {
+        response->results = session->getCorrections(request.words[0], holder, request.maxResults, budget);
+    } else if (request.type == QUERY_CORRECTIONS && numWords > 1) {
+        vector<string> context(request.words.begin(), request.words.end() - 1);
+        response->results = session->getCorrections(&context[0], numWords - 1, request.words.back(), holder, request.maxResults, budget);
+    } else if (request.type == QUERY_COMPLETIONS && numWords == 1) {
+        response->results = session->getTopCompletions(request.words[0], holder, request.maxResults, budget);
+    } else {
+        response->status = STATUS_BAD_REQUEST;
+    }
+}
+
+/**
+ * Answer a batch of requests with a session, in the order of their
+ * types and words rather than in the order of the batch, so that
+ * consecutive lookups walk the same nodes, and answering identical
+ * requests once.
+ * @param session the session
+ * @param requests the requests
+ * @param numRequests the number of requests, from the first one
+ * @param responses a holder for the responses, in the order of the
+ * requests
+ * @param order a holder for the order of the requests
+ */
+void QueryServer::execute(DictionarySession* session, const vector<query_request>& requests, int numRequests,
+        vector<query_response>& responses, vector<int>& order) {
+    if (responses.size() < numRequests) responses.resize(numRequests);
+    order.resize(numRequests);
+    for (int i = 0; i < numRequests; i++) {
+        order[i] = i;
+    }
+    request_order comparator;
+    comparator.requests = &requests;
+    sort(order.begin(), order.end(), comparator);
+    for (int i = 0; i < numRequests; i++) {
+        query_response& response = responses[order[i]];
+        if (i > 0 && !comparator(order[i - 1], order[i])) {
+            response = responses[order[i - 1]];
+            response.id = requests[order[i]].id;
+        } else {
+            execute(session, requests[order[i]], &response);
+        }
+    }
+}
+
+/**
+ * Accept connections until the server stops, handing them over to
+ * the workers in turn.
+ */
+void* QueryServer::runAccept(void* arg) {
+    QueryServer* server = (QueryServer*) arg;
+    int next = 0;
+    while (!__sync_fetch_and_add(&server->stopping, 0)) {
+        int fd = accept(server->listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        server_worker* worker = server->workers[next];
+        next = (next + 1) % server->workers.size();
+        if (write(worker->handoff[1], &fd, sizeof(fd)) != sizeof(fd)) {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Poll the connections of a worker until the server stops.
+ */
+void* QueryServer::runWorker(void* arg) {
+    server_worker* worker = (server_worker*) arg;
+    QueryServer* server = worker->server;
+    struct epoll_event events[MAX_EVENTS];
+    while (!__sync_fetch_and_add(&server->stopping, 0)) {
+        int timeout = POLL_TIMEOUT_MILLISECONDS;
+        if (worker->batchSize > 0) {
+            timeout = max(0, (int) ceil(worker->batchDeadline - now()));
+        }
+        int numEvents = epoll_wait(worker->epoll, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < numEvents; i++) {
+            server_connection* connection = (server_connection*) events[i].data.ptr;
+            if (connection == NULL) {
+                server->addConnections(worker);
+                continue;
+            }
+            bool open = true;
+            if (events[i].events & EPOLLOUT) {
+                open = server->writeConnection(worker, connection);
+            } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                open = server->readConnection(worker, connection);
+            }
+            if (!open) {
+                server->closeConnection(worker, connection);
+            }
+        }
+        if (worker->batchSize > 0 && (numEvents <= 0 || now() >= worker->batchDeadline)) {
+            server->flushBatch(worker);
+        }
+    }
+    while (!worker->connections.empty()) {
+        server->closeConnection(worker, *worker->connections.begin());
+    }
+    return NULL;
+}
+
+/**
+ * Start polling the connections handed over to a worker.
+ */
+void QueryServer::addConnections(server_worker* worker) {
+    int fd;
+    while (read(worker->handoff[0], &fd, sizeof(fd)) == sizeof(fd)) {
+        setNonBlocking(fd);
+        server_connection* connection = new server_connection();
+        connection->fd = fd;
+        connection->written = 0;
+        connection->blocked = false;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        epoll_ctl(worker->epoll, EPOLL_CTL_ADD, fd, &event);
+        worker->connections.insert(connection);
+    }
+}
+
+/**
+ * Read the available bytes of a connection, and add the complete
+ * requests in them to the batch of the worker, answering the batch
+ * whenever it is full.
+ * @return false if the connection is closed, or sent a malformed
+ * request
+ */
+bool QueryServer::readConnection(server_worker* worker, server_connection* connection) {
+    char buffer[READ_BUFFER_SIZE];
+    while (true) {
+        int n = recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            connection->in.append(buffer, n);
+            if (n < sizeof(buffer)) break;
+        } else if (n == 0) {
+            return false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    int offset = 0;
+    while (true) {
+        if (worker->batchRequests.size() == worker->batchSize) {
+            worker->batchRequests.resize(worker->batchSize + 1);
+            worker->batchConnections.resize(worker->batchSize + 1);
+        }
+        query_request* request = &worker->batchRequests[worker->batchSize];
+        int size = decodeRequest(connection->in.data() + offset, connection->in.size() - offset, request);
+        if (size < 0) return false;
+        if (size == 0) break;
+        offset += size;
+        if (worker->batchSize == 0) {
+            worker->batchDeadline = now() + maxBatchWait;
+        }
+        worker->batchConnections[worker->batchSize++] = connection;
+        if (worker->batchSize >= maxBatchSize) {
+            flushBatch(worker);
+        }
+    }
+    connection->in.erase(0, offset);
+    return true;
+}
+
+/**
+ * Answer the batch of a worker, and write the responses to each
+ * connection at once. Connections which fail are shut down, and
+ * closed when they are next polled.
+ */
+void QueryServer::flushBatch(server_worker* worker) {
+    int numRequests = worker->batchSize;
+    execute(worker->session, worker->batchRequests, numRequests, worker->batchResponses, worker->batchOrder);
+    if (worker->batchFrames.size() < numRequests) worker->batchFrames.resize(numRequests);
+    for (int i = 0; i < numRequests; i++) {
+        worker->batchFrames[i].clear();
+        encodeResponse(worker->batchResponses[i], &worker->batchFrames[i]);
+    }
+
+    // Group the responses by connection, in the order of the requests
+    vector<int>& order = worker->batchOrder;
+    for (int i = 0; i < numRequests; i++) {
+        order[i] = i;
+    }
+    connection_order comparator;
+    comparator.connections = &worker->batchConnections;
+    stable_sort(order.begin(), order.end(), comparator);
+    vector<int> frames;
+    for (int i = 0; i < numRequests; ) {
+        server_connection* connection = worker->batchConnections[order[i]];
+        frames.clear();
+        while (i < numRequests && worker->batchConnections[order[i]] == connection) {
+            frames.push_back(order[i++]);
+        }
+        if (!writeFrames(worker, connection, frames)) {
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+    }
+
+    worker->batchSize = 0;
+    __sync_add_and_fetch(&worker->requests, numRequests);
+    __sync_add_and_fetch(&worker->batches, 1);
+}
+
+/**
+ * Send responses of the batch of a worker to a connection, with as
+ * few system calls as possible, and keep the bytes which could not
+ * be sent until the connection is writable.
+ * @param frames the indexes of the responses in the batch
+ * @return false if the connection is closed
+ */
+bool QueryServer::writeFrames(server_worker* worker, server_connection* connection, vector<int>& frames) {
+    vector<string>& batchFrames = worker->batchFrames;
+    int numFrames = frames.size();
+    int next = 0;
+    while (!connection->blocked && next < numFrames) {
+        struct iovec vectors[MAX_IOVECS];
+        int numVectors = min(numFrames - next, MAX_IOVECS);
+        for (int i = 0; i < numVectors; i++) {
+            vectors[i].iov_base = (void*) batchFrames[frames[next + i]].data();
+            vectors[i].iov_len = batchFrames[frames[next + i]].size();
+        }
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vectors;
+        message.msg_iovlen = numVectors;
+        int n = sendmsg(connection->fd, &message, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return false;
+        if (n < 0) break;
+        while (next < numFrames && n >= batchFrames[frames[next]].size()) {
+            n -= batchFrames[frames[next++]].size();
+        }
+        if (n > 0) {
+            connection->out.append(batchFrames[frames[next++]], n, string::npos);
+            break;
+        }
+    }
+    for (; next < numFrames; next++) {
+        connection->out.append(batchFrames[frames[next]]);
+    }
+    return connection->out.empty() || writeConnection(worker, connection);
+}
+
+/**
+ * Send the pending responses of a connection, and poll it for
+ * writing if they could not all be sent, or for reading once they
+ * are.
+ * @return false if the connection is closed
+ */
+bool QueryServer::writeConnection(server_worker* worker, server_connection* connection) {
+    while (connection->written < connection->out.size()) {
+        int n = send(connection->fd, connection->out.data() + connection->written,
+                connection->out.size() - connection->written, MSG_NOSIGNAL);
+        if (n > 0) {
+            connection->written += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!connection->blocked) {
+                pollConnection(worker, connection, EPOLLOUT);
+                connection->blocked = true;
+            }
+            return true;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    connection->out.clear();
+    connection->written = 0;
+    if (connection->blocked) {
+        pollConnection(worker, connection, EPOLLIN);
+        connection->blocked = false;
+    }
+    return true;
+}
+
+/**
+ * Change the events a connection is polled for.
+ */
+void QueryServer::pollConnection(server_worker* worker, server_connection* connection, int events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = connection;
+    epoll_ctl(worker->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+/**
+ * Close a connection, and drop its requests from the batch.
+ */
+void QueryServer::closeConnection(server_worker* worker, server_connection* connection) {
+    for (int i = worker->batchSize - 1; i >= 0; i--) {
+        if (worker->batchConnections[i] == connection) {
+            worker->batchConnections.erase(worker->batchConnections.begin() + i);
+            worker->batchRequests.erase(worker->batchRequests.begin() + i);
+            worker->batchSize--;
+        }
+    }
+    epoll_ctl(worker->epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    worker->connections.erase(connection);
+    delete connection;
+}
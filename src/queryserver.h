@@ -0,0 +1,124 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A server answering dictionary queries over a local socket.
+ */
+
+#ifndef QUERYSERVER_H
+#define QUERYSERVER_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <tr1/unordered_set>
+#include "bindict.h"
+#include "session.h"
+#include "protocol.h"
+using namespace std;
+
+class QueryServer;
+
+/**
+ * A connection to the server, with the bytes received and not yet
+ * decoded, and the responses not yet sent. A connection is 'blocked'
+ * while it is polled for writing the rest of its responses.
+ */
+struct server_connection {
+    int fd;
+    string in;
+    string out;
+    int written;
+    bool blocked;
+};
+
+/**
+ * A worker thread of the server, polling its own connections, which
+ * the listening thread hands over through the 'handoff' pipe, and
+ * answering their requests with its own session on the dictionary.
+ * The first 'batchSize' requests of 'batchRequests' are the requests
+ * decoded and not yet answered, with the connection each of them
+ * came from; the holders are kept from one batch to the next.
+ */
+struct server_worker {
+    QueryServer* server;
+    pthread_t thread;
+    int epoll;
+    int handoff[2];
+    DictionarySession* session;
+    std::tr1::unordered_set<server_connection*> connections;
+    int batchSize;
+    vector<server_connection*> batchConnections;
+    vector<query_request> batchRequests;
+    vector<query_response> batchResponses;
+    vector<string> batchFrames;
+    vector<int> batchOrder;
+    double batchDeadline;
+    volatile long requests;
+    volatile long batches;
+};
+
+/**
+ * A query server answers the requests of the binary protocol, cf.
+ * protocol.h, on a Unix socket or a loopback TCP port, e.g.
+ *
+ * QueryServer server(&bindict, 4);
+ * server.listenUnix("/tmp/suggest.sock");
+ * server.start();
+ * ...
+ * server.stop();
+ *
+ * A thread accepts connections, and hands each of them over to one
+ * of the workers, in turn. Each worker runs an epoll event loop on
+ * its connections: it reads the available bytes of the connections
+ * which are ready, and gathers all the complete requests in them,
+ * so that clients can send requests without waiting for the
+ * previous responses. The requests gathered are answered as a batch
+ * once there are 'maxBatchSize' of them, or once the first of them
+ * has waited 'maxBatchWait' milliseconds, cf. setBatching, and the
+ * responses to each connection are then written back with a single
+ * vectored send. While responses of a connection are waiting to be
+ * sent, its requests are not read.
+ */
+class QueryServer {
+
+private:
+    const BinaryDictionary* dictionary;
+    vector<server_worker*> workers;
+    int listener;
+    string socketPath;
+    pthread_t acceptThread;
+    bool running;
+    volatile int stopping;
+    int maxBatchSize;
+    int maxBatchWait;
+
+    QueryServer(const QueryServer&);
+    QueryServer& operator=(const QueryServer&);
+
+    static void* runAccept(void* server);
+    static void* runWorker(void* worker);
+    void addConnections(server_worker* worker);
+    bool readConnection(server_worker* worker, server_connection* connection);
+    void flushBatch(server_worker* worker);
+    bool writeFrames(server_worker* worker, server_connection* connection, vector<int>& frames);
+    bool writeConnection(server_worker* worker, server_connection* connection);
+    void pollConnection(server_worker* worker, server_connection* connection, int events);
+    void closeConnection(server_worker* worker, server_connection* connection);
+
+public:
+    QueryServer(const BinaryDictionary* dictionary, int numThreads);
+    ~QueryServer();
+
+    bool listenUnix(const char * path);
+    bool listenTcp(int port);
+    void setBatching(int maxBatchSize, int maxBatchWait);
+    bool start();
+    void stop();
+    long getRequests();
+    long getBatches();
+    static void execute(DictionarySession* session, const query_request& request, query_response* response, QueryBudget* budget = NULL);
+    static void execute(DictionarySession* session, const vector<query_request>& requests, int numRequests,
+            vector<query_response>& responses, vector<int>& order);
+};
+
+#endif
@@ -0,0 +1,242 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Dictionaries of many locales, opened on demand.
+ */
+
+#include <string>
+#include <list>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "registry.h"
+
+using namespace std;
+
+/**
+ * Create a registry.
+ * @param budget the maximum total size of the opened dictionaries,
+ * in bytes
+ */
+DictionaryRegistry::DictionaryRegistry(long budget) {
+    pthread_mutex_init(&lock, NULL);
+    stats.hits = 0;
+    stats.loads = 0;
+    stats.shared = 0;
+    stats.evictions = 0;
+    stats.dictionaries = 0;
+    stats.size = 0;
+    stats.budget = budget;
+}
+
+/**
+ * Close all dictionaries, which must all have been released.
+ */
+DictionaryRegistry::~DictionaryRegistry() {
+    while (!opened.empty()) {
+        closeEntry(opened.back());
+    }
+    pthread_mutex_destroy(&lock);
+}
+
+/**
+ * Declare the dictionary file of a name, e.g. a locale. The file is
+ * only opened when the name is first acquired.
+ * @param name the name
+ * @param filename the path to the binary dictionary file
+ */
+void DictionaryRegistry::add(string name, string filename) {
+    pthread_mutex_lock(&lock);
+    files[name] = filename;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Get the dictionary of a name, opening it if needed, and keep it
+ * open until it is released.
+ * @param name the name
+ * @return the dictionary, or NULL if the name is unknown or its file
+ * could not be loaded
+ */
+const BinaryDictionary* DictionaryRegistry::acquire(string name) {
+    pthread_mutex_lock(&lock);
+    registry_entry* entry;
+    std::tr1::unordered_map<string, registry_entry*>::iterator it = byName.find(name);
+    if (it != byName.end()) {
+        entry = it->second;
+        stats.hits++;
+    } else {
+        entry = openEntry(name);
+    }
+    if (entry == NULL) {
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+    entry->references++;
+    opened.splice(opened.begin(), opened, entry->position);
+    evict();
+    pthread_mutex_unlock(&lock);
+    return entry->dictionary;
+}
+
+/**
+ * Release a dictionary returned by acquire(), which may then be
+ * closed to stay under the budget.
+ * @param dictionary the dictionary
+ */
+void DictionaryRegistry::release(const BinaryDictionary* dictionary) {
+    pthread_mutex_lock(&lock);
+    std::tr1::unordered_map<const BinaryDictionary*, registry_entry*>::iterator it = byDictionary.find(dictionary);
+    if (it != byDictionary.end() && it->second->references > 0) {
+        it->second->references--;
+        evict();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Change the maximum total size of the opened dictionaries, closing
+ * dictionaries if needed.
+ * @param budget the budget, in bytes
+ */
+void DictionaryRegistry::setBudget(long budget) {
+    pthread_mutex_lock(&lock);
+    stats.budget = budget;
+    evict();
+    pthread_mutex_unlock(&lock);
+}
+
+registry_stats DictionaryRegistry::getStats() {
+    pthread_mutex_lock(&lock);
+    registry_stats current = stats;
+    pthread_mutex_unlock(&lock);
+    return current;
+}
+
+/**
+ * Open the dictionary of a name, or share the opened dictionary with
+ * the same contents, and put it first in the list of opened
+ * dictionaries.
+ * @param name the name
+ * @return the entry of the dictionary, or NULL if it could not be
+ * opened
+ */
+registry_entry* DictionaryRegistry::openEntry(const string& name) {
+    std::tr1::unordered_map<string, string>::iterator file = files.find(name);
+    unsigned long long hash;
+    long size;
+    if (file == files.end() || !hashFile(file->second, &hash, &size)) {
+        return NULL;
+    }
+
+    std::tr1::unordered_map<unsigned long long, registry_entry*>::iterator it = byHash.find(hash);
+    if (it != byHash.end() && it->second->size == size) {
+        registry_entry* entry = it->second;
+        entry->names.push_back(name);
+        byName[name] = entry;
+        stats.shared++;
+        return entry;
+    }
+
+    BinaryDictionary* dictionary = new BinaryDictionary();
+    dictionary->fromFile(file->second.c_str());
+    if (!dictionary->isLoaded()) {
+        delete dictionary;
+        return NULL;
+    }
+    registry_entry* entry = new registry_entry();
+    entry->dictionary = dictionary;
+    entry->hash = hash;
+    entry->size = dictionary->getSize();
+    entry->references = 0;
+    entry->names.push_back(name);
+    opened.push_front(entry);
+    entry->position = opened.begin();
+    byName[name] = entry;
+    byHash[hash] = entry;
+    byDictionary[dictionary] = entry;
+    stats.loads++;
+    stats.dictionaries++;
+    stats.size += entry->size;
+    return entry;
+}
+
+/**
+ * Return the 64 bit FNV-1a hash of the contents of a file, hashing
+ * it only if it changed since it was last hashed.
+ * @param filename the path to the file
+ * @param hash a holder for the hash
+ * @param size a holder for the size of the file
+ * @return false if the file could not be read
+ */
+bool DictionaryRegistry::hashFile(const string& filename, unsigned long long* hash, long* size) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || status.st_size == 0) {
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    std::tr1::unordered_map<string, file_hash>::iterator known = hashes.find(filename);
+    if (known != hashes.end() && known->second.size == status.st_size && known->second.modified == status.st_mtime) {
+        ::close(fd);
+        *hash = known->second.hash;
+        *size = status.st_size;
+        return true;
+    }
+    void* mapped = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    const unsigned char* bytes = (const unsigned char*) mapped;
+    unsigned long long h = 14695981039346656037ULL;
+    for (long i = 0; i < status.st_size; i++) {
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    munmap(mapped, status.st_size);
+
+    file_hash hashed;
+    hashed.size = status.st_size;
+    hashed.modified = status.st_mtime;
+    hashed.hash = h;
+    hashes[filename] = hashed;
+    *hash = h;
+    *size = status.st_size;
+    return true;
+}
+
+/**
+ * Close the least recently used dictionaries which are not acquired,
+ * until the opened dictionaries fit in the budget.
+ */
+void DictionaryRegistry::evict() {
+    list<registry_entry*>::iterator it = opened.end();
+    while (stats.size > stats.budget && it != opened.begin()) {
+        --it;
+        registry_entry* entry = *it;
+        if (entry->references > 0) continue;
+        ++it;
+        closeEntry(entry);
+        stats.evictions++;
+    }
+}
+
+/**
+ * Close a dictionary, which unmaps it, and forget its entry.
+ */
+void DictionaryRegistry::closeEntry(registry_entry* entry) {
+    for (int i = 0; i < entry->names.size(); i++) {
+        byName.erase(entry->names[i]);
+    }
+    if (byHash[entry->hash] == entry) {
+        byHash.erase(entry->hash);
+    }
+    byDictionary.erase(entry->dictionary);
+    opened.erase(entry->position);
+    stats.dictionaries--;
+    stats.size -= entry->size;
+    delete entry->dictionary;
+    delete entry;
+}
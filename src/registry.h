@@ -0,0 +1,113 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Dictionaries of many locales, opened on demand.
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include <tr1/unordered_map>
+#include "bindict.h"
+using namespace std;
+
+/**
+ * A dictionary opened by a registry: the names it was opened for,
+ * the hash of its contents, the number of acquire() calls not yet
+ * released, and its position in the list of opened dictionaries.
+ */
+struct registry_entry {
+    BinaryDictionary* dictionary;
+    unsigned long long hash;
+    long size;
+    int references;
+    vector<string> names;
+    list<registry_entry*>::iterator position;
+};
+
+/**
+ * The hash of the contents of a file, valid as long as the file has
+ * the same size and modification time.
+ */
+struct file_hash {
+    long size;
+    long modified;
+    unsigned long long hash;
+};
+
+/**
+ * Counters of a registry, since it was created.
+ */
+struct registry_stats {
+    long hits;
+    long loads;
+    long shared;
+    long evictions;
+    int dictionaries;
+    long size;
+    long budget;
+};
+
+/**
+ * A registry opens the dictionaries of many locales, or customers,
+ * when they are first queried, and closes the least recently used
+ * ones to stay under a memory budget, e.g.
+ *
+ * DictionaryRegistry registry(256 << 20);
+ * registry.add("en_US", "en_US.dict");
+ * registry.add("fr_FR", "fr_FR.dict");
+ * const BinaryDictionary* bindict = registry.acquire("fr_FR");
+ * bindict->getCorrections("bonjuor", holder, 3);
+ * registry.release(bindict);
+ *
+ * Dictionary files are mapped read-only, so that their pages are
+ * shared with the other processes mapping them. They must thus only
+ * be replaced by renaming another file over them, never rewritten in
+ * place. Files with the same contents, e.g. a locale and its default
+ * variant, are opened once: the contents of a file are hashed before
+ * it is opened, and looked up among the opened dictionaries. Hashes
+ * are kept, so that a file is only hashed again if it changed.
+ *
+ * A dictionary stays open while it is acquired. The size of the
+ * opened dictionaries may thus exceed the budget, if all of them are
+ * acquired, until enough of them are released. Dictionaries are
+ * opened while holding the lock of the registry, which all calls
+ * take.
+ */
+class DictionaryRegistry {
+
+private:
+    std::tr1::unordered_map<string, string> files;
+    std::tr1::unordered_map<string, file_hash> hashes;
+    std::tr1::unordered_map<string, registry_entry*> byName;
+    std::tr1::unordered_map<unsigned long long, registry_entry*> byHash;
+    std::tr1::unordered_map<const BinaryDictionary*, registry_entry*> byDictionary;
+    list<registry_entry*> opened;
+    pthread_mutex_t lock;
+    registry_stats stats;
+
+    // Entries are owned, and locks can't be copied
+    DictionaryRegistry(const DictionaryRegistry&);
+    DictionaryRegistry& operator=(const DictionaryRegistry&);
+
+    bool hashFile(const string& filename, unsigned long long* hash, long* size);
+    registry_entry* openEntry(const string& name);
+    void evict();
+    void closeEntry(registry_entry* entry);
+
+public:
+    DictionaryRegistry(long budget);
+    ~DictionaryRegistry();
+
+    void add(string name, string filename);
+    const BinaryDictionary* acquire(string name);
+    void release(const BinaryDictionary* dictionary);
+    void setBudget(long budget);
+    registry_stats getStats();
+};
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Replacing a dictionary while it is being queried.
+ */
+
+#include <string>
+#include <unistd.h>
+#include "reload.h"
+
+using namespace std;
+
+#define RECLAIM_POLL_MICROSECONDS 1000
+
+ReloadableDictionary::ReloadableDictionary() {
+    current = NULL;
+    version = 0;
+    epoch = 1;
+    numReaders = 0;
+    for (int i = 0; i < MAX_READERS; i++) {
+        readers[i].epoch = 0;
+    }
+    pthread_mutex_init(&reloadLock, NULL);
+    reloading = false;
+    reloaded = false;
+}
+
+/**
+ * Free the current version, once the background reload, if any, is
+ * over. No reader may be left in the dictionary.
+ */
+ReloadableDictionary::~ReloadableDictionary() {
+    waitForReload();
+    delete current;
+    pthread_mutex_destroy(&reloadLock);
+}
+
+/**
+ * Load a dictionary file, and publish it as the current version if
+ * it is valid, cf. BinaryDictionary::fromFile(). The previous version
+ * is freed once the readers which entered the dictionary before it
+ * was replaced have exited, which this waits for.
+ * @param filename the path to the binary dictionary file
+ * @return false if the file could not be loaded, in which case the
+ * current version is kept
+ */
+bool ReloadableDictionary::load(const char * filename) {
+    BinaryDictionary* loaded = new BinaryDictionary();
+    loaded->fromFile(filename);
+    if (!loaded->isLoaded()) {
+        delete loaded;
+        return false;
+    }
+
+    pthread_mutex_lock(&reloadLock);
+    BinaryDictionary* previous = __sync_lock_test_and_set(&current, loaded);
+    __sync_lock_test_and_set(&version, loaded->getVersion());
+    __sync_synchronize();
+    unsigned long published = __sync_add_and_fetch(&epoch, 1);
+    waitForReaders(published);
+    delete previous;
+    pthread_mutex_unlock(&reloadLock);
+    return true;
+}
+
+/**
+ * Wait until no reader is left in an epoch before a given one, i.e.
+ * until the readers which could still hold a replaced version have
+ * exited.
+ * @param published the epoch which the replacement started
+ */
+void ReloadableDictionary::waitForReaders(unsigned long published) {
+    for (int i = 0; i < numReaders; i++) {
+        while (true) {
+            unsigned long entered = __sync_fetch_and_add(&readers[i].epoch, 0);
+            if (entered == 0 || entered >= published) break;
+            usleep(RECLAIM_POLL_MICROSECONDS);
+        }
+    }
+}
+
+/**
+ * Load a dictionary file on a background thread, cf. load().
+ * @param filename the path to the binary dictionary file
+ */
+void ReloadableDictionary::startReload(const char * filename) {
+    waitForReload();
+    reloadFile = filename;
+    reloading = pthread_create(&reloadThread, NULL, ReloadableDictionary::runReload, this) == 0;
+}
+
+/**
+ * Wait for the background reload, if any, to finish.
+ * @return true if the last background reload published a new version
+ */
+bool ReloadableDictionary::waitForReload() {
+    if (reloading) {
+        pthread_join(reloadThread, NULL);
+        reloading = false;
+    }
+    return reloaded;
+}
+
+void* ReloadableDictionary::runReload(void* dictionary) {
+    ReloadableDictionary* reloadable = (ReloadableDictionary*) dictionary;
+    reloadable->reloaded = reloadable->load(reloadable->reloadFile.c_str());
+    return NULL;
+}
+
+/**
+ * Register a reader, i.e. a thread which queries the dictionary.
+ * @return the reader, or -1 if there are already MAX_READERS readers
+ */
+int ReloadableDictionary::registerReader() {
+    int reader = __sync_fetch_and_add(&numReaders, 1);
+    if (reader >= MAX_READERS) {
+        __sync_fetch_and_sub(&numReaders, 1);
+        return -1;
+    }
+    return reader;
+}
+
+/**
+ * Enter the dictionary, i.e. get the current version to query. The
+ * version is not freed until the reader exits.
+ * @param reader the reader, cf. registerReader()
+ * @return the current version, or NULL if none is loaded
+ */
+const BinaryDictionary* ReloadableDictionary::enter(int reader) {
+    __sync_lock_test_and_set(&readers[reader].epoch, __sync_fetch_and_add(&epoch, 0));
+    __sync_synchronize();
+    return __sync_fetch_and_add(&current, 0);
+}
+
+/**
+ * Exit the dictionary, after which the version returned by enter()
+ * must no longer be used.
+ * @param reader the reader, cf. registerReader()
+ */
+void ReloadableDictionary::exit(int reader) {
+    __sync_lock_release(&readers[reader].epoch);
+}
+
+/**
+ * Return the version of the current dictionary, or 0 if none is
+ * loaded, cf. BinaryDictionary::getVersion().
+ */
+int ReloadableDictionary::getVersion() {
+    return __sync_fetch_and_add(&version, 0);
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Replacing a dictionary while it is being queried.
+ */
+
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <string>
+#include <pthread.h>
+#include "bindict.h"
+using namespace std;
+
+#define MAX_READERS 64
+#define CACHE_LINE_SIZE 64
+
+/**
+ * The epoch a reader entered the dictionary in, or 0 if it is not
+ * in it, alone on its cache line so that readers do not write to
+ * each other's lines.
+ */
+struct reader_slot {
+    volatile unsigned long epoch;
+    char padding[CACHE_LINE_SIZE - sizeof(unsigned long)];
+};
+
+/**
+ * A reloadable dictionary holds the current version of a dictionary,
+ * which can be replaced by a newer one while queries are running on
+ * it, e.g.
+ *
+ * ReloadableDictionary dictionary;
+ * dictionary.load("en.dict");
+ * // on each query thread
+ * int reader = dictionary.registerReader();
+ * const BinaryDictionary* bindict = dictionary.enter(reader);
+ * bindict->getCorrections("yuu", holder, 3);
+ * dictionary.exit(reader);
+ * // daily
+ * dictionary.startReload("en.dict");
+ *
+ * A new version is loaded and checked aside, and then published by
+ * swapping the current pointer, so that queries which enter the
+ * dictionary afterwards run on the new version, while the queries
+ * in flight finish on the old one. The old version is unmapped once
+ * they are done, using epoch based reclamation: readers announce the
+ * epoch they entered in, publishing a version starts a new epoch,
+ * and the old version is freed when no reader is left in an earlier
+ * epoch. Entering and exiting thus take no lock, and only write to
+ * the reader's own slot.
+ *
+ * Each version has its own caches, and sessions moved to a new
+ * version clear theirs, cf. DictionarySession::setDictionary().
+ *
+ * Versions are mapped from their files, cf.
+ * BinaryDictionary::fromFile(), so a new version must be written to
+ * another file and renamed over the old one, as makedict.py does,
+ * rather than rewritten in place, which crashes the queries running
+ * on the old version.
+ */
+class ReloadableDictionary {
+
+private:
+    BinaryDictionary* volatile current;
+    volatile int version;
+    volatile unsigned long epoch;
+    reader_slot readers[MAX_READERS];
+    volatile int numReaders;
+    pthread_mutex_t reloadLock;
+    pthread_t reloadThread;
+    bool reloading;
+    string reloadFile;
+    bool reloaded;
+
+    // Versions are owned, and locks can't be copied
+    ReloadableDictionary(const ReloadableDictionary&);
+    ReloadableDictionary& operator=(const ReloadableDictionary&);
+
+    void waitForReaders(unsigned long epoch);
+    static void* runReload(void* dictionary);
+
+public:
+    ReloadableDictionary();
+    ~ReloadableDictionary();
+
+    bool load(const char * filename);
+    void startReload(const char * filename);
+    bool waitForReload();
+    int registerReader();
+    const BinaryDictionary* enter(int reader);
+    void exit(int reader);
+    int getVersion();
+};
+
+#endif
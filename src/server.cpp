@@ -0,0 +1,98 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A server answering dictionary queries over a local socket.
+ *
+ * Usage: ./Server [-j THREADS] [-s SOCKET | -p PORT] [-b BATCH] [-w WAIT] [-m SEGMENT] DICTIONARY
+ *
+ * Listens on the Unix socket SOCKET (by default /tmp/suggest.sock),
+ * or on the loopback TCP port PORT, until interrupted, cf.
+ * queryserver.h and protocol.h. Requests are answered in batches of
+ * at most BATCH requests (by default 256), waiting at most WAIT
+ * milliseconds (by default 0) for a batch to fill. With -m, clients
+ * on the same host can also query the dictionary through the shared
+ * memory segment SEGMENT, e.g. /suggest, cf. shmserver.h.
+ */
+
+#include <signal.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include "bindict.h"
+#include "queryserver.h"
+#include "shmserver.h"
+
+using namespace std;
+
+#define DEFAULT_SOCKET "/tmp/suggest.sock"
+
+int main(int argc, char ** argv) {
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char * socketPath = DEFAULT_SOCKET;
+    int port = 0;
+    int maxBatchSize = 256;
+    int maxBatchWait = 0;
+    const char * segmentName = NULL;
+    int option;
+    const char * usage = " [-j THREADS] [-s SOCKET | -p PORT] [-b BATCH] [-w WAIT] [-m SEGMENT] DICTIONARY";
+    while ((option = getopt(argc, argv, "j:s:p:b:w:m:")) != -1) {
+        switch (option) {
+        case 'j': numThreads = atoi(optarg); break;
+        case 's': socketPath = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'b': maxBatchSize = atoi(optarg); break;
+        case 'w': maxBatchWait = atoi(optarg); break;
+        case 'm': segmentName = optarg; break;
+        default:
+            cerr << "Usage: " << argv[0] << usage << endl;
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return 2;
+    }
+
+    BinaryDictionary bindict;
+    bindict.fromFile(argv[optind]);
+    if (!bindict.isLoaded()) {
+        cerr << "Unable to load " << argv[optind] << endl;
+        return 1;
+    }
+
+    // Signals are waited for by the main thread only
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    QueryServer server(&bindict, numThreads);
+    server.setBatching(maxBatchSize, maxBatchWait);
+    bool listening = port > 0 ? server.listenTcp(port) : server.listenUnix(socketPath);
+    if (!listening || !server.start()) {
+        cerr << "Unable to listen on " << (port > 0 ? "port" : socketPath) << endl;
+        return 1;
+    }
+    cerr << "Listening on ";
+    if (port > 0) cerr << "127.0.0.1:" << port; else cerr << socketPath;
+    cerr << " with " << numThreads << " threads" << endl;
+
+    SharedMemoryServer sharedMemoryServer(&bindict, SHM_CHANNELS);
+    if (segmentName != NULL) {
+        if (!sharedMemoryServer.create(segmentName) || !sharedMemoryServer.start()) {
+            cerr << "Unable to create " << segmentName << endl;
+            return 1;
+        }
+        cerr << "Serving " << SHM_CHANNELS << " channels on " << segmentName << endl;
+    }
+
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+    sharedMemoryServer.stop();
+    cerr << server.getRequests() << " requests in " << server.getBatches() << " batches";
+    if (segmentName != NULL) cerr << ", " << sharedMemoryServer.getRequests() << " through shared memory";
+    cerr << endl;
+    return 0;
+}
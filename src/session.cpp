@@ -0,0 +1,131 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Queries on a shared dictionary from a single thread.
+ */
+
+#include <string>
+#include <vector>
+#include "session.h"
+
+using namespace std;
+
+/**
+ * Create a session with caches of the default capacities.
+ * @param dictionary the dictionary to query, which the session
+ * does not change
+ */
+DictionarySession::DictionarySession(const BinaryDictionary* dictionary)
+        : dictionary(dictionary),
+        version(dictionary->getVersion()),
+        unigramCache(DEFAULT_UNIGRAM_CACHE_CAPACITY),
+        ngramCache(DEFAULT_NGRAM_CACHE_CAPACITY),
+        predictionCache(DEFAULT_PREDICTION_CACHE_CAPACITY),
+        caches(unigramCache, ngramCache, predictionCache) {
+}
+
+/**
+ * Run the next queries of the session on another dictionary.
+ * @param dictionary the dictionary to query
+ */
+void DictionarySession::setDictionary(const BinaryDictionary* dictionary) {
+    this->dictionary = dictionary;
+    checkVersion();
+}
+
+/**
+ * Clear the caches if the dictionary loaded another file since
+ * they were filled, since they hold addresses in the file.
+ */
+void DictionarySession::checkVersion() {
+    if (dictionary->getVersion() != version) {
+        clearCaches();
+        version = dictionary->getVersion();
+    }
+}
+
+/**
+ * Set the maximum number of entries of the caches of the session,
+ * which clears them. A capacity of 0 disables a cache.
+ * @param unigrams the capacity of the unigram cache
+ * @param ngrams the capacity of the ngram cache
+ * @param predictions the capacity of the prediction cache
+ */
+void DictionarySession::setCacheCapacity(int unigrams, int ngrams, int predictions) {
+    unigramCache.setCapacity(unigrams);
+    ngramCache.setCapacity(ngrams);
+    predictionCache.setCapacity(predictions);
+}
+
+/**
+ * Remove all entries of the caches of the session, which refer to
+ * the file the dictionary had loaded.
+ */
+void DictionarySession::clearCaches() {
+    unigramCache.clear();
+    ngramCache.clear();
+    predictionCache.clear();
+}
+
+/**
+ * Cf. BinaryDictionary::exists()
+ */
+bool DictionarySession::exists(string word) {
+    checkVersion();
+    return dictionary->exists(word, &caches);
+}
+
+/**
+ * Cf. BinaryDictionary::getPredictions()
+ */
+vector<weighted_string> DictionarySession::getPredictions(string* words, int numWords, vector<weighted_string> predictions, int maxPredictions, QueryBudget* budget) {
+    checkVersion();
+    return dictionary->getPredictions(words, numWords, predictions, maxPredictions, &caches, budget);
+}
+
+/**
+ * Cf. BinaryDictionary::getCorrections()
+ */
+vector<weighted_string> DictionarySession::getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, QueryBudget* budget) {
+    checkVersion();
+    return dictionary->getCorrections(word, corrections, maxCorrections, &caches, budget);
+}
+
+/**
+ * Cf. BinaryDictionary::getCorrections()
+ */
+vector<weighted_string> DictionarySession::getCorrections(string* words, int numWords, string word, vector<weighted_string> corrections, int maxCorrections, QueryBudget* budget) {
+    checkVersion();
+    return dictionary->getCorrections(words, numWords, word, corrections, maxCorrections, &caches, budget);
+}
+
+/**
+ * Cf. BinaryDictionary::getCorrections()
+ */
+vector<weighted_string> DictionarySession::getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, CorrectionMode mode, int maxDistance, QueryBudget* budget) {
+    checkVersion();
+    return dictionary->getCorrections(word, corrections, maxCorrections, mode, maxDistance, &caches, budget);
+}
+
+/**
+ * Cf. BinaryDictionary::getCompletions()
+ */
+vector<weighted_string> DictionarySession::getCompletions(string word, int depth, vector<weighted_string> completions, int maxCompletions, QueryBudget* budget) {
+    checkVersion();
+    return dictionary->getCompletions(word, depth, completions, maxCompletions, &caches, budget);
+}
+
+/**
+ * Cf. BinaryDictionary::getTopCompletions()
+ */
+vector<weighted_string> DictionarySession::getTopCompletions(string word, vector<weighted_string> completions, int maxCompletions, QueryBudget* budget) {
+    checkVersion();
+    return dictionary->getTopCompletions(word, completions, maxCompletions, &caches, budget);
+}
+
+/**
+ * Cf. BinaryDictionary::getFuzzyCompletions(), which uses no cache.
+ */
+vector<weighted_string> DictionarySession::getFuzzyCompletions(string word, vector<weighted_string> completions, int maxCompletions, int maxDistance, QueryBudget* budget) {
+    return dictionary->getFuzzyCompletions(word, completions, maxCompletions, maxDistance, budget);
+}
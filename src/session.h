@@ -0,0 +1,75 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Queries on a shared dictionary from a single thread.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <vector>
+#include "bindict.h"
+#include "cache.h"
+using namespace std;
+
+typedef Cache<string, int> SessionUnigramCache;
+typedef Cache<ngram_key, int, ngram_key_hash> SessionNgramCache;
+typedef Cache<ngram_key, vector<weighted_string>, ngram_key_hash> SessionPredictionCache;
+
+/**
+ * A dictionary session runs the queries of one thread on a
+ * dictionary shared by several threads, e.g.
+ *
+ * BinaryDictionary bindict;
+ * bindict.fromFile("en.dict");
+ * // on each thread
+ * DictionarySession session(&bindict);
+ * session.getCorrections("yuu", holder, 3);
+ *
+ * It returns the same results as the dictionary, but looks words,
+ * contexts and predictions up in caches of its own, which are not
+ * locked and are not shared with other threads, so that queries on
+ * different threads do not contend. A session must only be used by
+ * one thread at a time. Its caches are cleared whenever the version
+ * of the dictionary changes, i.e. when it loads another file, or when
+ * the session is moved to another dictionary, e.g. a newer version
+ * published by a ReloadableDictionary.
+ */
+class DictionarySession {
+
+private:
+    const BinaryDictionary* dictionary;
+    int version;
+    SessionUnigramCache unigramCache;
+    SessionNgramCache ngramCache;
+    SessionPredictionCache predictionCache;
+    CacheSet<SessionUnigramCache, SessionNgramCache, SessionPredictionCache> caches;
+
+    // The cache set refers to the caches of the session
+    DictionarySession(const DictionarySession&);
+    DictionarySession& operator=(const DictionarySession&);
+
+    void checkVersion();
+
+public:
+    DictionarySession(const BinaryDictionary* dictionary);
+
+    const BinaryDictionary* getDictionary() { return dictionary; }
+    void setDictionary(const BinaryDictionary* dictionary);
+    void setCacheCapacity(int unigrams, int ngrams, int predictions);
+    void clearCaches();
+    cache_stats getUnigramCacheStats() { return unigramCache.getStats(); }
+    cache_stats getNgramCacheStats() { return ngramCache.getStats(); }
+    cache_stats getPredictionCacheStats() { return predictionCache.getStats(); }
+    bool exists(string word);
+    vector<weighted_string> getPredictions(string* words, int numWords, vector<weighted_string> predictions, int maxPredictions, QueryBudget* budget = NULL);
+    vector<weighted_string> getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, QueryBudget* budget = NULL);
+    vector<weighted_string> getCorrections(string* words, int numWords, string word, vector<weighted_string> corrections, int maxCorrections, QueryBudget* budget = NULL);
+    vector<weighted_string> getCorrections(string word, vector<weighted_string> corrections, int maxCorrections, CorrectionMode mode, int maxDistance, QueryBudget* budget = NULL);
+    vector<weighted_string> getCompletions(string word, int depth, vector<weighted_string> completions, int maxCompletions, QueryBudget* budget = NULL);
+    vector<weighted_string> getTopCompletions(string word, vector<weighted_string> completions, int maxCompletions, QueryBudget* budget = NULL);
+    vector<weighted_string> getFuzzyCompletions(string word, vector<weighted_string> completions, int maxCompletions, int maxDistance, QueryBudget* budget = NULL);
+};
+
+#endif
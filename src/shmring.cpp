@@ -0,0 +1,297 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Shared memory rings between the query server and the processes on
+ * the same host.
+ */
+
+#include <string>
+#include <cstring>
+#include <climits>
+#include <ctime>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+using namespace std;
+
+#define SHM_SPIN_COUNT 100
+#define SHM_CLIENT_TIMEOUT_MILLISECONDS 5000
+
+static unsigned int load(volatile unsigned int* counter) {
+    return __sync_fetch_and_add(counter, 0);
+}
+
+static unsigned int getInt(const unsigned char* b) {
+    return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/**
+ * Wait until a counter is no longer 'value', spinning briefly, then
+ * sleeping on it, with the 'waiting' flag raised for the other side
+ * to wake us up. The flag is raised before the counter is checked
+ * again, and the other side changes the counter before checking the
+ * flag, so that either it sees the flag, or we see the change.
+ * @return false if the counter did not change within 'milliseconds'
+ */
+static bool waitChange(volatile unsigned int* counter, volatile int* waiting, unsigned int value, int milliseconds) {
+    for (int i = 0; i < SHM_SPIN_COUNT; i++) {
+        if (load(counter) != value) return true;
+    }
+    struct timespec timeout;
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_nsec = (milliseconds % 1000) * 1000000L;
+    __sync_fetch_and_or(waiting, 1);
+    if (load(counter) == value) {
+        syscall(SYS_futex, counter, FUTEX_WAIT, value, &timeout, NULL, 0);
+    }
+    __sync_fetch_and_and(waiting, 0);
+    return load(counter) != value;
+}
+
+/**
+ * Wake up the other side if it waits on a counter.
+ */
+static void wakeUp(volatile unsigned int* counter, volatile int* waiting) {
+    if (__sync_fetch_and_add(waiting, 0)) {
+        syscall(SYS_futex, counter, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Copy bytes out of a ring, from a position, wrapping around its end.
+ */
+static void ringCopy(shm_ring* ring, unsigned int position, char* bytes, int length) {
+    int offset = position % SHM_RING_SIZE;
+    int first = min(length, SHM_RING_SIZE - offset);
+    memcpy(bytes, ring->data + offset, first);
+    memcpy(bytes + first, ring->data, length - first);
+}
+
+/**
+ * Write bytes to a ring, as the producer, waiting for the consumer
+ * to make room for them.
+ * @param ring the ring
+ * @param bytes the bytes, one or more frames
+ * @param length the number of bytes, at most SHM_RING_SIZE
+ * @param milliseconds the maximum time to wait for room
+ * @return false if there was no room within 'milliseconds'
+ */
+bool ringWrite(shm_ring* ring, const char* bytes, int length, int milliseconds) {
+    if (length > SHM_RING_SIZE) return false;
+    unsigned int head = ring->head;
+    unsigned int tail;
+    while (head - (tail = load(&ring->tail)) + length > SHM_RING_SIZE) {
+        if (!waitChange(&ring->tail, &ring->producerWaiting, tail, milliseconds)) return false;
+    }
+    int offset = head % SHM_RING_SIZE;
+    int first = min(length, SHM_RING_SIZE - offset);
+    memcpy(ring->data + offset, bytes, first);
+    memcpy(ring->data, bytes + first, length - first);
+    __sync_fetch_and_add(&ring->head, length);
+    wakeUp(&ring->head, &ring->consumerWaiting);
+    return true;
+}
+
+/**
+ * Return the next frame of a ring, as the consumer, waiting for the
+ * producer to write it. The frame is returned in place, unless it
+ * wraps around the end of the ring, in which case it is copied to a
+ * holder. Either way, it must be released with ringRelease() once
+ * decoded.
+ * @param ring the ring
+ * @param holder a holder for frames which wrap around
+ * @param length a holder for the size of the frame
+ * @param milliseconds the maximum time to wait for a frame
+ * @return the frame, or NULL if there was none within
+ * 'milliseconds', or the ring holds no valid frame
+ */
+const char* ringPeek(shm_ring* ring, string* holder, int* length, int milliseconds) {
+    unsigned int tail = ring->tail;
+    unsigned int head = load(&ring->head);
+    if (head == tail) {
+        if (!waitChange(&ring->head, &ring->consumerWaiting, tail, milliseconds)) return NULL;
+        head = load(&ring->head);
+    }
+    unsigned char size[4];
+    ringCopy(ring, tail, (char*) size, 4);
+    *length = getInt(size) + 4;
+    if (head - tail < 4 || *length > MAX_FRAME_SIZE || *length > head - tail) {
+        // Frames are written at once, so the ring is corrupt
+        __sync_fetch_and_add(&ring->tail, head - tail);
+        return NULL;
+    }
+    int offset = tail % SHM_RING_SIZE;
+    if (offset + *length <= SHM_RING_SIZE) {
+        return ring->data + offset;
+    }
+    holder->resize(*length);
+    ringCopy(ring, tail, &(*holder)[0], *length);
+    return holder->data();
+}
+
+/**
+ * Release the frame returned by ringPeek(), making room for the
+ * producer.
+ */
+void ringRelease(shm_ring* ring, int length) {
+    __sync_fetch_and_add(&ring->tail, length);
+    wakeUp(&ring->tail, &ring->producerWaiting);
+}
+
+/**
+ * Reset the rings of a channel, as the server, if a client attached
+ * it since they were last reset, and let that client use them.
+ * @return true if the rings were reset, and the frames left in them
+ * by the previous client dropped
+ */
+bool channelReset(shm_channel* channel) {
+    unsigned int generation = load(&channel->generation);
+    if (generation == channel->served) return false;
+    shm_ring* rings[] = {&channel->requests, &channel->responses};
+    for (int i = 0; i < 2; i++) {
+        rings[i]->head = 0;
+        rings[i]->tail = 0;
+        rings[i]->consumerWaiting = 0;
+        rings[i]->producerWaiting = 0;
+    }
+    __sync_synchronize();
+    channel->served = generation;
+    wakeUp(&channel->served, &channel->clientWaiting);
+    return true;
+}
+
+/**
+ * Whether the client owning a channel died without detaching it.
+ */
+static bool isOrphan(int owner) {
+    return owner > 0 && kill(owner, 0) < 0 && errno == ESRCH;
+}
+
+/**
+ * Release the channel of the client, for the next one.
+ */
+static void release(shm_channel* channel) {
+    channel->owner = 0;
+    __sync_lock_release(&channel->attached);
+}
+
+/**
+ * Attach a free channel of the segment of a server, or reclaim the
+ * channel of a client which died, and wait for the server to reset
+ * its rings.
+ * @param name the name of the segment, e.g. "/suggest"
+ * @return false if there is no such segment, no free channel, or the
+ * server did not reset the channel in time
+ */
+bool SharedMemoryClient::attach(const char * name) {
+    detach();
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return false;
+    void* address = mmap(NULL, sizeof(shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) return false;
+    segment = (shm_segment*) address;
+    if (segment->magic != SHM_MAGIC) {
+        detach();
+        return false;
+    }
+    int pid = getpid();
+    for (int i = 0; i < segment->numChannels && channel == NULL; i++) {
+        if (__sync_bool_compare_and_swap(&segment->channels[i].attached, 0, 1)) {
+            channel = &segment->channels[i];
+            channel->owner = pid;
+        }
+    }
+    for (int i = 0; i < segment->numChannels && channel == NULL; i++) {
+        int owner = segment->channels[i].owner;
+        if (isOrphan(owner) && __sync_bool_compare_and_swap(&segment->channels[i].owner, owner, pid)) {
+            channel = &segment->channels[i];
+        }
+    }
+    if (channel == NULL) {
+        detach();
+        return false;
+    }
+    // Wake up the server, which may be waiting for requests
+    unsigned int generation = __sync_add_and_fetch(&channel->generation, 1);
+    wakeUp(&channel->requests.head, &channel->requests.consumerWaiting);
+    unsigned int served;
+    while ((served = load(&channel->served)) != generation) {
+        if (!waitChange(&channel->served, &channel->clientWaiting, served, SHM_CLIENT_TIMEOUT_MILLISECONDS)) {
+            release(channel);
+            channel = NULL;
+            detach();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Detach the channel, once the responses to the requests sent have
+ * been received, or have timed out, for the next client.
+ */
+void SharedMemoryClient::detach() {
+    if (channel != NULL) {
+        query_response response;
+        while (pending > 0 && receive(&response));
+        release(channel);
+        channel = NULL;
+    }
+    if (segment != NULL) {
+        munmap(segment, sizeof(shm_segment));
+        segment = NULL;
+    }
+    pending = 0;
+}
+
+/**
+ * Send encoded request frames.
+ * @return false if the client is not attached, or the server did not
+ * make room for the frames in time
+ */
+bool SharedMemoryClient::send(const string& frames) {
+    if (channel == NULL) return false;
+    int offset = 0;
+    while (offset < frames.size()) {
+        int length = getInt((const unsigned char*) frames.data() + offset) + 4;
+        if (!ringWrite(&channel->requests, frames.data() + offset, length, SHM_CLIENT_TIMEOUT_MILLISECONDS)) {
+            return false;
+        }
+        offset += length;
+        pending++;
+    }
+    return true;
+}
+
+/**
+ * Wait for the next response.
+ * @return false if the client is not attached, or the server did not
+ * answer in time
+ */
+bool SharedMemoryClient::receive(query_response* response) {
+    if (channel == NULL) return false;
+    int length;
+    const char* frame = ringPeek(&channel->responses, &holder, &length, SHM_CLIENT_TIMEOUT_MILLISECONDS);
+    if (frame == NULL) return false;
+    int size = decodeResponse(frame, length, response);
+    ringRelease(&channel->responses, length);
+    pending--;
+    return size > 0;
+}
+
+/**
+ * Send a request, and wait for its response.
+ * @return false if the server did not answer in time
+ */
+bool SharedMemoryClient::query(const query_request& request, query_response* response) {
+    string frame;
+    encodeRequest(request, &frame);
+    return send(frame) && receive(response);
+}
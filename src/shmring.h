@@ -0,0 +1,113 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * Shared memory rings between the query server and the processes on
+ * the same host.
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <string>
+#include "protocol.h"
+using namespace std;
+
+#define SHM_MAGIC 0x4d535452
+#define SHM_CHANNELS 8
+#define SHM_RING_SIZE 262144
+#define SHM_CACHE_LINE 64
+
+/**
+ * A ring carries the frames of the binary protocol, cf. protocol.h,
+ * from a single producer to a single consumer. 'head' is the number
+ * of bytes the producer has written, and 'tail' the number of bytes
+ * the consumer has read, both modulo 2^32; the bytes in between are
+ * at their offset modulo SHM_RING_SIZE in 'data'. Each side waits
+ * for the other on its counter with a futex, raising its 'waiting'
+ * flag first so that the other side only wakes it up when needed.
+ * The counters are on cache lines of their own, since they are
+ * written by different processes.
+ */
+struct shm_ring {
+    volatile unsigned int head;
+    volatile int consumerWaiting;
+    char headPadding[SHM_CACHE_LINE - 8];
+    volatile unsigned int tail;
+    volatile int producerWaiting;
+    char tailPadding[SHM_CACHE_LINE - 8];
+    char data[SHM_RING_SIZE];
+};
+
+/**
+ * A channel is the pair of rings between the server and the client
+ * which attached it. 'owner' is the pid of that client, so that the
+ * channel of a client which died without detaching can be reclaimed.
+ * Each client attaching the channel increments 'generation', and
+ * waits on 'served' until the server has reset the rings for that
+ * generation, dropping any frame left in flight by the previous
+ * client, e.g. when it detached after a timeout.
+ */
+struct shm_channel {
+    volatile int attached;
+    volatile int owner;
+    volatile unsigned int generation;
+    volatile unsigned int served;
+    volatile int clientWaiting;
+    char padding[SHM_CACHE_LINE - 20];
+    shm_ring requests;
+    shm_ring responses;
+};
+
+/**
+ * The shared memory segment of a server.
+ */
+struct shm_segment {
+    unsigned int magic;
+    int numChannels;
+    char padding[SHM_CACHE_LINE - 8];
+    shm_channel channels[SHM_CHANNELS];
+};
+
+bool ringWrite(shm_ring* ring, const char* bytes, int length, int milliseconds);
+const char* ringPeek(shm_ring* ring, string* holder, int* length, int milliseconds);
+void ringRelease(shm_ring* ring, int length);
+bool channelReset(shm_channel* channel);
+
+/**
+ * A connection to a query server through its shared memory segment,
+ * e.g.
+ *
+ * SharedMemoryClient client;
+ * client.attach("/suggest");
+ * client.query(request, &response);
+ *
+ * The client attaches a free channel of the segment, or the channel
+ * of a client which died, until it detaches. Requests are written
+ * to the channel and responses read from it without system calls,
+ * except to wake up the server, or to wait for it, when either side
+ * is idle. Responses which do not wrap around the end of the ring
+ * are decoded in place.
+ */
+class SharedMemoryClient {
+
+private:
+    shm_segment* segment;
+    shm_channel* channel;
+    int pending;
+    string holder;
+
+    SharedMemoryClient(const SharedMemoryClient&);
+    SharedMemoryClient& operator=(const SharedMemoryClient&);
+
+public:
+    SharedMemoryClient() { segment = NULL; channel = NULL; pending = 0; }
+    ~SharedMemoryClient() { detach(); }
+
+    bool attach(const char * name);
+    void detach();
+    bool send(const string& frames);
+    bool receive(query_response* response);
+    bool query(const query_request& request, query_response* response);
+};
+
+#endif
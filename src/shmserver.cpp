@@ -0,0 +1,166 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A server answering dictionary queries through shared memory.
+ */
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "shmserver.h"
+#include "queryserver.h"
+
+using namespace std;
+
+#define POLL_TIMEOUT_MILLISECONDS 100
+
+/**
+ * Create a server, and the sessions of its channels.
+ * @param dictionary the dictionary to query
+ * @param numChannels the maximum number of clients, at most
+ * SHM_CHANNELS
+ */
+SharedMemoryServer::SharedMemoryServer(const BinaryDictionary* dictionary, int numChannels) {
+    this->dictionary = dictionary;
+    segment = NULL;
+    running = false;
+    stopping = 0;
+    numChannels = max(1, min(numChannels, SHM_CHANNELS));
+    for (int i = 0; i < numChannels; i++) {
+        shm_worker* worker = new shm_worker();
+        worker->server = this;
+        worker->channel = NULL;
+        worker->session = new DictionarySession(dictionary);
+        worker->requests = 0;
+        workers.push_back(worker);
+    }
+}
+
+SharedMemoryServer::~SharedMemoryServer() {
+    stop();
+    for (int i = 0; i < workers.size(); i++) {
+        delete workers[i]->session;
+        delete workers[i];
+    }
+    if (segment != NULL) {
+        munmap(segment, sizeof(shm_segment));
+        shm_unlink(name.c_str());
+    }
+}
+
+/**
+ * Create the shared memory segment, replacing any segment with the
+ * same name.
+ * @param name the name of the segment, e.g. "/suggest"
+ * @return false if the segment could not be created
+ */
+bool SharedMemoryServer::create(const char * name) {
+    if (segment != NULL) return false;
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return false;
+    if (ftruncate(fd, sizeof(shm_segment)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* address = mmap(NULL, sizeof(shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+    segment = (shm_segment*) address;
+    this->name = name;
+    segment->numChannels = workers.size();
+    for (int i = 0; i < workers.size(); i++) {
+        workers[i]->channel = &segment->channels[i];
+    }
+    // Clients check the magic number last
+    __sync_synchronize();
+    segment->magic = SHM_MAGIC;
+    return true;
+}
+
+/**
+ * Start serving the channels, on background threads.
+ * @return false if the segment was not created
+ */
+bool SharedMemoryServer::start() {
+    if (segment == NULL || running) return false;
+    __sync_lock_release(&stopping);
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_create(&workers[i]->thread, NULL, SharedMemoryServer::runWorker, workers[i]);
+    }
+    running = true;
+    return true;
+}
+
+/**
+ * Stop serving the channels.
+ */
+void SharedMemoryServer::stop() {
+    if (!running) return;
+    __sync_lock_test_and_set(&stopping, 1);
+    for (int i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i]->thread, NULL);
+    }
+    running = false;
+}
+
+/**
+ * Return the number of requests answered since the server started.
+ */
+long SharedMemoryServer::getRequests() {
+    long requests = 0;
+    for (int i = 0; i < workers.size(); i++) {
+        requests += __sync_fetch_and_add(&workers[i]->requests, 0);
+    }
+    return requests;
+}
+
+/**
+ * Answer the requests of a channel until the server stops. The
+ * rings are reset whenever a new client attaches the channel, and
+ * a response to the previous client is dropped if it can't be
+ * written by then.
+ */
+void* SharedMemoryServer::runWorker(void* arg) {
+    shm_worker* worker = (shm_worker*) arg;
+    SharedMemoryServer* server = worker->server;
+    shm_channel* channel = worker->channel;
+    query_request request;
+    query_response response;
+    string holder;
+    string frame;
+    while (!__sync_fetch_and_add(&server->stopping, 0)) {
+        channelReset(channel);
+        int length;
+        const char* bytes = ringPeek(&channel->requests, &holder, &length, POLL_TIMEOUT_MILLISECONDS);
+        if (bytes == NULL) continue;
+        request.id = 0;
+        bool valid = decodeRequest(bytes, length, &request) > 0;
+        ringRelease(&channel->requests, length);
+        if (valid) {
+            QueryServer::execute(worker->session, request, &response);
+        } else {
+            response.id = request.id;
+            response.status = STATUS_BAD_REQUEST;
+            response.results.clear();
+        }
+        frame.clear();
+        encodeResponse(response, &frame);
+        bool written;
+        while (!(written = ringWrite(&channel->responses, frame.data(), frame.size(), POLL_TIMEOUT_MILLISECONDS))) {
+            if (__sync_fetch_and_add(&server->stopping, 0)) return NULL;
+            if (channelReset(channel)) break;
+        }
+        if (written) {
+            __sync_add_and_fetch(&worker->requests, 1);
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * A server answering dictionary queries through shared memory.
+ */
+
+#ifndef SHMSERVER_H
+#define SHMSERVER_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "bindict.h"
+#include "session.h"
+#include "shmring.h"
+using namespace std;
+
+class SharedMemoryServer;
+
+/**
+ * The thread serving a channel, with its own session.
+ */
+struct shm_worker {
+    SharedMemoryServer* server;
+    shm_channel* channel;
+    pthread_t thread;
+    DictionarySession* session;
+    volatile long requests;
+};
+
+/**
+ * A shared memory server answers the requests of the binary
+ * protocol, cf. protocol.h, of clients on the same host, through a
+ * POSIX shared memory segment, e.g.
+ *
+ * SharedMemoryServer server(&bindict, 4);
+ * server.create("/suggest");
+ * server.start();
+ * ...
+ * server.stop();
+ *
+ * The segment has a channel for each client, cf. shmring.h, which a
+ * thread of the server polls for requests, answering them in order
+ * with the same code as the QueryServer. Requests which do not wrap
+ * around the end of the ring are decoded in place.
+ */
+class SharedMemoryServer {
+
+private:
+    const BinaryDictionary* dictionary;
+    vector<shm_worker*> workers;
+    shm_segment* segment;
+    string name;
+    bool running;
+    volatile int stopping;
+
+    SharedMemoryServer(const SharedMemoryServer&);
+    SharedMemoryServer& operator=(const SharedMemoryServer&);
+
+    static void* runWorker(void* worker);
+
+public:
+    SharedMemoryServer(const BinaryDictionary* dictionary, int numChannels);
+    ~SharedMemoryServer();
+
+    bool create(const char * name);
+    bool start();
+    void stop();
+    long getRequests();
+};
+
+#endif
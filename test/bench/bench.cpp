@@ -0,0 +1,1008 @@
+/**
+ * Copyright 2012 8pen
+ *
+ * BinaryDictionary benchmarks.
+ *
+ * Usage: ./Bench BENCHMARK [DICTIONARY] [UNIGRAMS]
+ *
+ * where DICTIONARY is a binary dictionary (by default the one
+ * built from big.txt in the README), and UNIGRAMS the NSP
+ * unigram file it was generated from, used as a source of
+ * query words.
+ */
+
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "../../bindict.h"
+#include "../../errormodel.h"
+#include "../../completion.h"
+#include "../../corrector.h"
+#include "../../session.h"
+#include "../../batch.h"
+#include "../../reload.h"
+#include "../../registry.h"
+#include "../../protocol.h"
+#include "../../queryserver.h"
+#include "../../shmring.h"
+#include "../../shmserver.h"
+#include "../../executor.h"
+
+using namespace std;
+
+#define DEFAULT_DICTIONARY "../dictionaries/test/big.dict"
+#define DEFAULT_UNIGRAMS "../data/output/unigrams.txt"
+#define DEFAULT_ERROR_MODEL "../scripts/errormodel_qwerty.txt"
+#define NUM_QUERY_WORDS 5000
+#define MAX_WORD_LENGTH 48
+
+/**
+ * Return the current time in milliseconds.
+ */
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/**
+ * Read up to 'limit' words from an NSP unigram file, most
+ * frequent first.
+ */
+static vector<string> readWords(const char * filename, int limit) {
+    vector<string> words;
+    ifstream file (filename);
+    string line;
+    while (words.size() < limit && getline(file, line)) {
+        istringstream tokens(line);
+        int weight;
+        string word;
+        if (tokens >> weight >> word) {
+            words.push_back(word);
+        }
+    }
+    return words;
+}
+
+/**
+ * Return the neighbours of a key on a QWERTY keyboard.
+ */
+static string neighbours(char c) {
+    const char * rows[] = { "qwertyuiop", "asdfghjkl", "zxcvbnm" };
+    string result = "";
+    for (int r = 0; r < 3; r++) {
+        const char * pos = strchr(rows[r], c);
+        if (pos == NULL) continue;
+        int col = pos - rows[r];
+        if (col > 0) result += rows[r][col-1];
+        if (rows[r][col+1] != 0) result += rows[r][col+1];
+        if (r > 0) result += rows[r-1][col];
+        if (r < 2 && col < (int) strlen(rows[r+1])) result += rows[r+1][col];
+    }
+    return result;
+}
+
+/**
+ * Apply a single random typo to a word: mostly neighbouring key
+ * substitutions, and otherwise a deletion, an insertion or a
+ * transposition.
+ */
+static string typo(string word) {
+    int i = rand() % word.length();
+    int kind = rand() % 10;
+    if (kind < 5) {
+        string n = neighbours(word[i]);
+        if (n.length() > 0) {
+            word[i] = n[rand() % n.length()];
+        }
+    } else if (kind < 7) {
+        word.erase(i, 1);
+    } else if (kind < 9) {
+        word.insert(i, 1, (char) ('a' + rand() % 26));
+    } else if (i < word.length() - 1) {
+        char c = word[i];
+        word[i] = word[i+1];
+        word[i+1] = c;
+    }
+    return word;
+}
+
+static bool compareWeight(const weighted_string& a, const weighted_string& b) {
+    return a.weight > b.weight;
+}
+
+/**
+ * Correct a synthetic set of typos, with and without the keyboard
+ * error model, and report throughput for short (up to 4 characters)
+ * and longer typos, along with how often the intended word is ranked
+ * first, or among the first three.
+ */
+static void benchCorrections(BinaryDictionary& bindict, vector<string> words) {
+    srand(42);
+    vector<string> intended;
+    vector<string> typed;
+    for (int i = 0; i < words.size(); i++) {
+        if (words[i].length() < 3) continue;
+        string t = typo(words[i]);
+        if (t == words[i] || bindict.exists(t)) continue;
+        intended.push_back(words[i]);
+        typed.push_back(t);
+    }
+
+    ErrorModel model;
+    model.fromFile(DEFAULT_ERROR_MODEL);
+
+    for (int m = 0; m < 2; m++) {
+        bindict.setErrorModel(m == 0 ? NULL : &model);
+        int top1 = 0, top3 = 0;
+        int numShort = 0;
+        double elapsedShort = 0, elapsedLong = 0;
+        for (int i = 0; i < typed.size(); i++) {
+            vector<weighted_string> holder;
+            double start = now();
+            vector<weighted_string> corrections = bindict.getCorrections(typed[i], holder, 3);
+            double elapsed = now() - start;
+            if (typed[i].length() <= 4) {
+                numShort++;
+                elapsedShort += elapsed;
+            } else {
+                elapsedLong += elapsed;
+            }
+            for (int j = 0; j < corrections.size() && j < 3; j++) {
+                if (corrections[j].value == intended[i]) {
+                    if (j == 0) top1++;
+                    top3++;
+                    break;
+                }
+            }
+        }
+        cout << (m == 0 ? "uniform     " : "error model ")
+             << typed.size() << " typos in " << elapsedShort + elapsedLong << "ms, short "
+             << (int) (numShort / elapsedShort * 1000) << " qps, long "
+             << (int) ((typed.size() - numShort) / elapsedLong * 1000) << " qps, top-1 "
+             << 100.0 * top1 / typed.size() << "%, top-3 "
+             << 100.0 * top3 / typed.size() << "%" << endl;
+    }
+    bindict.setErrorModel(NULL);
+}
+
+/**
+ * Correct words garbled by two random typos, grouped by length, by
+ * applying edits and by using the trigram index, and report
+ * throughput along with how often the intended word is among the
+ * first three corrections.
+ */
+static void benchFuzzy(BinaryDictionary& bindict, vector<string> words) {
+    srand(42);
+    int lengths[] = { 5, 7, 9, 11, 13, MAX_WORD_LENGTH };
+    for (int l = 0; l < 5; l++) {
+        vector<string> intended;
+        vector<string> typed;
+        for (int i = 0; i < words.size(); i++) {
+            if (words[i].length() < lengths[l] || words[i].length() >= lengths[l+1]) continue;
+            string t = typo(typo(words[i]));
+            if (t == words[i] || bindict.exists(t)) continue;
+            intended.push_back(words[i]);
+            typed.push_back(t);
+        }
+        if (typed.size() == 0) continue;
+
+        for (int m = 0; m < 2; m++) {
+            CorrectionMode mode = m == 0 ? CORRECTION_EDITS : CORRECTION_TRIGRAMS;
+            int top3 = 0;
+            double start = now();
+            for (int i = 0; i < typed.size(); i++) {
+                vector<weighted_string> holder;
+                vector<weighted_string> corrections = bindict.getCorrections(typed[i], holder, 3, mode, 2);
+                for (int j = 0; j < corrections.size() && j < 3; j++) {
+                    if (corrections[j].value == intended[i]) {
+                        top3++;
+                        break;
+                    }
+                }
+            }
+            double elapsed = now() - start;
+            cout << "length " << lengths[l] << "-" << lengths[l+1] - 1 << " "
+                 << (m == 0 ? "edits    " : "trigrams ")
+                 << typed.size() << " words in " << elapsed << "ms ("
+                 << (int) (typed.size() / elapsed * 1000) << " qps), top-3 "
+                 << 100.0 * top3 / typed.size() << "%" << endl;
+        }
+    }
+}
+
+/**
+ * Complete the prefixes of the query words, of one to three
+ * characters, by walking the whole subtree below them and by the
+ * best-first search over the unigram max weights, and report
+ * throughput for each prefix length. Then complete prefixes with a
+ * typo, and report how often the intended word is among the first
+ * three completions. Finally, type the query words one character at
+ * a time, and report the time per keystroke at each position.
+ */
+static void benchCompletions(BinaryDictionary& bindict, vector<string> words) {
+    for (int length = 1; length <= 3; length++) {
+        vector<string> prefixes;
+        for (int i = 0; i < words.size(); i++) {
+            if (words[i].length() > length) {
+                prefixes.push_back(words[i].substr(0, length));
+            }
+        }
+        if (prefixes.size() == 0) continue;
+
+        for (int m = 0; m < 2; m++) {
+            double start = now();
+            for (int i = 0; i < prefixes.size(); i++) {
+                vector<weighted_string> holder;
+                if (m == 0) {
+                    bindict.getCompletions(prefixes[i], MAX_WORD_LENGTH, holder, 3);
+                } else {
+                    bindict.getTopCompletions(prefixes[i], holder, 3);
+                }
+            }
+            double elapsed = now() - start;
+            cout << "prefix length " << length << " "
+                 << (m == 0 ? "subtree    " : "best-first ")
+                 << prefixes.size() << " prefixes in " << elapsed << "ms ("
+                 << (int) (prefixes.size() / elapsed * 1000) << " qps)" << endl;
+        }
+    }
+
+    // Prefixes with a typo, completed by correcting them and then
+    // completing each correction, or by a single fuzzy search
+    srand(42);
+    vector<string> intended;
+    vector<string> typed;
+    for (int i = 0; i < words.size(); i++) {
+        if (words[i].length() < 6) continue;
+        string t = typo(words[i].substr(0, 3 + rand() % 3));
+        intended.push_back(words[i]);
+        typed.push_back(t);
+    }
+    for (int m = 0; m < 2; m++) {
+        int top3 = 0;
+        double start = now();
+        for (int i = 0; i < typed.size(); i++) {
+            vector<weighted_string> holder;
+            vector<weighted_string> completions;
+            if (m == 0) {
+                vector<weighted_string> corrections = bindict.getCorrections(typed[i], holder, 3);
+                weighted_string prefix;
+                prefix.value = typed[i];
+                prefix.weight = 0;
+                corrections.insert(corrections.begin(), prefix);
+                for (int j = 0; j < corrections.size(); j++) {
+                    vector<weighted_string> top;
+                    top = bindict.getTopCompletions(corrections[j].value, top, 3);
+                    completions.insert(completions.end(), top.begin(), top.end());
+                }
+                stable_sort(completions.begin(), completions.end(), compareWeight);
+            } else {
+                completions = bindict.getFuzzyCompletions(typed[i], holder, 3, 1);
+            }
+            for (int j = 0; j < completions.size() && j < 3; j++) {
+                if (completions[j].value == intended[i]) {
+                    top3++;
+                    break;
+                }
+            }
+        }
+        double elapsed = now() - start;
+        cout << "typo prefix " << (m == 0 ? "correct+complete " : "fuzzy            ")
+             << typed.size() << " prefixes in " << elapsed << "ms ("
+             << (int) (typed.size() / elapsed * 1000) << " qps), top-3 "
+             << 100.0 * top3 / typed.size() << "%" << endl;
+    }
+
+    // Words typed one character at a time, completed from scratch
+    // at each keystroke or by a completion session
+    for (int m = 0; m < 2; m++) {
+        double elapsed[MAX_WORD_LENGTH] = { 0 };
+        int keystrokes[MAX_WORD_LENGTH] = { 0 };
+        CompletionSession session(&bindict, 3);
+        for (int i = 0; i < words.size(); i++) {
+            session.reset();
+            for (int j = 1; j <= words[i].length() && j < MAX_WORD_LENGTH; j++) {
+                vector<weighted_string> holder;
+                double start = now();
+                if (m == 0) {
+                    bindict.getTopCompletions(words[i].substr(0, j), holder, 3);
+                } else {
+                    session.type(words[i][j-1]);
+                    session.getCompletions(holder);
+                }
+                elapsed[j] += now() - start;
+                keystrokes[j]++;
+            }
+        }
+        cout << "keystroke " << (m == 0 ? "from scratch " : "session      ") << "us per keystroke:";
+        for (int j = 1; j <= 8; j++) {
+            if (keystrokes[j] > 0) cout << " " << j << ":" << 1000 * elapsed[j] / keystrokes[j];
+        }
+        cout << endl;
+    }
+}
+
+/**
+ * Look up the single edit variations of the query words, as the
+ * corrections of a word do when the dictionary holds no unigram max
+ * weights, and report throughput along with the share of variations
+ * which are words. Run it against dictionaries with and without a
+ * Bloom filter.
+ */
+static void benchExists(BinaryDictionary& bindict, vector<string> words) {
+    vector<string> variations;
+    for (int i = 0; i < words.size() && i < 1000; i++) {
+        vector<string> holder;
+        holder = Corrector::variations(words[i], holder);
+        variations.insert(variations.end(), holder.begin(), holder.end());
+    }
+    int found = 0;
+    double start = now();
+    for (int i = 0; i < variations.size(); i++) {
+        if (bindict.exists(variations[i])) found++;
+    }
+    double elapsed = now() - start;
+    cout << variations.size() << " lookups in " << elapsed << "ms ("
+         << (int) (variations.size() / elapsed * 1000) << " qps), "
+         << 100.0 * found / variations.size() << "% words" << endl;
+}
+
+/**
+ * Return a fixed set of contexts of one or two query words, skewed
+ * towards frequent words.
+ */
+static vector<vector<string> > predictionContexts(vector<string>& words) {
+    srand(42);
+    vector<vector<string> > contexts;
+    for (int i = 0; i < NUM_QUERY_WORDS; i++) {
+        vector<string> context;
+        for (int j = 0; j < 1 + rand() % 2; j++) {
+            double r = (double) rand() / RAND_MAX;
+            context.push_back(words[(int) (r * r * (words.size() - 1))]);
+        }
+        contexts.push_back(context);
+    }
+    return contexts;
+}
+
+/**
+ * Run predictions after contexts drawn from a set skewed towards its
+ * first contexts.
+ */
+static void predict(BinaryDictionary& bindict, vector<vector<string> >& contexts, int numQueries) {
+    for (int i = 0; i < numQueries; i++) {
+        double r = (double) rand() / RAND_MAX;
+        vector<string>& context = contexts[(int) (r * r * r * (contexts.size() - 1))];
+        vector<weighted_string> holder;
+        bindict.getPredictions(&context[0], context.size(), holder, 3);
+    }
+}
+
+/**
+ * Predict the next word after contexts of one or two query words,
+ * drawn from a fixed set of contexts skewed towards the first ones,
+ * as repeated contexts are, with caches of increasing capacity, and
+ * report throughput along with the hit rate and size of the caches.
+ */
+static void benchCache(BinaryDictionary& bindict, vector<string> words) {
+    vector<vector<string> > contexts = predictionContexts(words);
+
+    int capacities[] = { 0, 256, 4096, 65536 };
+    for (int c = 0; c < 4; c++) {
+        srand(42);
+        bindict.setCacheCapacity(capacities[c], capacities[c]);
+        bindict.setPredictionCacheCapacity(capacities[c]);
+        int numQueries = 200000;
+        double start = now();
+        predict(bindict, contexts, numQueries);
+        double elapsed = now() - start;
+        cache_stats unigrams = bindict.getUnigramCacheStats();
+        cache_stats ngrams = bindict.getNgramCacheStats();
+        cache_stats results = bindict.getPredictionCacheStats();
+        cout << "capacity " << capacities[c] << " " << numQueries << " predictions in " << elapsed << "ms ("
+             << (int) (numQueries / elapsed * 1000) << " qps), unigram hits "
+             << 100.0 * unigrams.hits / max(1L, unigrams.hits + unigrams.misses) << "% (" << unigrams.size << " entries, "
+             << unigrams.evictions << " evictions), ngram hits "
+             << 100.0 * ngrams.hits / max(1L, ngrams.hits + ngrams.misses) << "% (" << ngrams.size << " entries, "
+             << ngrams.evictions << " evictions), prediction hits "
+             << 100.0 * results.hits / max(1L, results.hits + results.misses) << "% (" << results.size << " entries, "
+             << results.evictions << " evictions)" << endl;
+    }
+}
+
+/**
+ * Save the cache keys of a dictionary which served predictions for
+ * a while, then serve the same predictions from a freshly loaded
+ * dictionary with cold caches, with caches warmed up before serving
+ * and with caches warmed up on a background thread while serving.
+ * Report the mean latency over the first queries, and how many
+ * queries it takes to get within 10% of the steady state latency.
+ */
+static void benchWarmUp(const char * dictionary, vector<string> words) {
+    vector<vector<string> > contexts = predictionContexts(words);
+    const char * keys = "Bench.keys";
+    BinaryDictionary source;
+    source.fromFile(dictionary);
+    predict(source, contexts, 200000);
+    source.saveCacheKeys(keys);
+
+    int windowSize = 2000;
+    int numWindows = 50;
+    for (int m = 0; m < 3; m++) {
+        srand(7);
+        BinaryDictionary bindict;
+        bindict.fromFile(dictionary);
+        double start = now();
+        if (m == 1) {
+            bindict.warmUpCaches(keys);
+        } else if (m == 2) {
+            bindict.startWarmUp(keys);
+        }
+        double warmUp = now() - start;
+
+        double latencies[numWindows];
+        for (int w = 0; w < numWindows; w++) {
+            double windowStart = now();
+            predict(bindict, contexts, windowSize);
+            latencies[w] = (now() - windowStart) * 1000 / windowSize;
+        }
+        bindict.waitForWarmUp();
+
+        // Steady state is the mean of the last 10 windows, reached
+        // once the mean of 5 consecutive windows gets within 10% of it
+        double steady = 0;
+        for (int w = numWindows - 10; w < numWindows; w++) {
+            steady += latencies[w] / 10;
+        }
+        int settled = 0;
+        while (settled < numWindows - 5) {
+            double mean = 0;
+            for (int w = settled; w < settled + 5; w++) {
+                mean += latencies[w] / 5;
+            }
+            if (mean <= 1.1 * steady) break;
+            settled++;
+        }
+        cout << (m == 0 ? "cold       " : m == 1 ? "warm up    " : "background ")
+             << "warm up " << warmUp << "ms, first " << windowSize << " queries "
+             << latencies[0] << "us, steady " << steady << "us after "
+             << settled * windowSize << " queries" << endl;
+    }
+    remove(keys);
+}
+
+/**
+ * The arguments of a benchmark thread.
+ */
+struct thread_args {
+    BinaryDictionary* bindict;
+    bool session;
+    vector<string>* words;
+    int seed;
+    int numQueries;
+};
+
+/**
+ * Run predictions after pairs of query words skewed towards frequent
+ * words, and completions of their prefixes, either on the caches of
+ * the dictionary or on those of a session of the thread.
+ */
+static void* runQueries(void* arg) {
+    thread_args* args = (thread_args*) arg;
+    vector<string>& words = *args->words;
+    unsigned int seed = args->seed;
+    DictionarySession session(args->bindict);
+    for (int i = 0; i < args->numQueries; i++) {
+        string phrase[2];
+        for (int j = 0; j < 2; j++) {
+            double r = (double) rand_r(&seed) / RAND_MAX;
+            phrase[j] = words[(int) (r * r * r * (words.size() - 1))];
+        }
+        vector<weighted_string> holder;
+        if (args->session) {
+            session.getPredictions(phrase, 2, holder, 3);
+            session.getTopCompletions(phrase[1].substr(0, 2), holder, 3);
+        } else {
+            args->bindict->getPredictions(phrase, 2, holder, 3);
+            args->bindict->getTopCompletions(phrase[1].substr(0, 2), holder, 3);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Run queries on 1 up to as many threads as there are cores.
+ */
+static void runThreads(BinaryDictionary& bindict, vector<string>& words, bool session) {
+    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    int numQueries = 100000;
+    double base = 0;
+    cout << (session ? "Sessions" : "Shared caches") << endl;
+    for (int numThreads = 1; numThreads <= numCores; numThreads *= 2) {
+        pthread_t threads[numThreads];
+        thread_args args[numThreads];
+        double start = now();
+        for (int i = 0; i < numThreads; i++) {
+            args[i].bindict = &bindict;
+            args[i].session = session;
+            args[i].words = &words;
+            args[i].seed = 42 + i;
+            args[i].numQueries = numQueries;
+            pthread_create(&threads[i], NULL, runQueries, &args[i]);
+        }
+        for (int i = 0; i < numThreads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        double elapsed = now() - start;
+        double qps = numThreads * numQueries / elapsed * 1000;
+        if (numThreads == 1) base = qps;
+        cout << numThreads << " threads " << numThreads * numQueries << " queries in " << elapsed << "ms ("
+             << (int) qps << " qps, x" << qps / base << ")" << endl;
+        if (numThreads < numCores && numThreads * 2 > numCores) numThreads = numCores / 2;
+    }
+}
+
+/**
+ * Run queries from 1 up to as many threads as there are cores, all
+ * sharing the same dictionary, and report throughput: first with
+ * the caches of the dictionary, shared by the threads, then with a
+ * session per thread.
+ */
+static void benchThreads(BinaryDictionary& bindict, vector<string> words) {
+    runThreads(bindict, words, false);
+    runThreads(bindict, words, true);
+}
+
+/**
+ * Correct a text of query words skewed towards frequent words, one
+ * in five with a typo, serially and then with a batch corrector from
+ * 1 up to as many threads as there are cores, and report throughput.
+ */
+static void benchBatch(BinaryDictionary& bindict, vector<string> words) {
+    int numTokens = 200000;
+    vector<string> tokens;
+    for (int i = 0; i < numTokens; i++) {
+        double r = (double) rand() / RAND_MAX;
+        string word = words[(int) (r * r * r * (words.size() - 1))];
+        tokens.push_back(rand() % 5 == 0 ? typo(word) : word);
+    }
+
+    double start = now();
+    vector<vector<weighted_string> > expected;
+    for (int i = 0; i < numTokens; i++) {
+        vector<weighted_string> holder;
+        expected.push_back(bindict.getCorrections(tokens[i], holder, 3));
+    }
+    double elapsed = now() - start;
+    cout << "serial    " << numTokens << " tokens in " << elapsed << "ms ("
+         << (int) (numTokens / elapsed * 1000) << " tokens/s)" << endl;
+
+    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int numThreads = 1; numThreads <= numCores; numThreads *= 2) {
+        BatchCorrector batch(&bindict, numThreads);
+        vector<vector<weighted_string> > holder;
+        start = now();
+        vector<vector<weighted_string> > corrections = batch.getCorrections(tokens, holder, 3);
+        elapsed = now() - start;
+        int mismatches = 0;
+        for (int i = 0; i < numTokens; i++) {
+            if (corrections[i].size() != expected[i].size() ||
+                    (!expected[i].empty() && corrections[i][0].value != expected[i][0].value)) {
+                mismatches++;
+            }
+        }
+        cout << numThreads << " threads " << numTokens << " tokens in " << elapsed << "ms ("
+             << (int) (numTokens / elapsed * 1000) << " tokens/s, " << mismatches << " mismatches)" << endl;
+        if (numThreads < numCores && numThreads * 2 > numCores) numThreads = numCores / 2;
+    }
+}
+
+/**
+ * The arguments of a reader thread of the reload benchmark.
+ */
+struct reload_args {
+    ReloadableDictionary* dictionary;
+    vector<string>* words;
+    volatile bool* stopping;
+    int seed;
+    long numQueries;
+    double maxLatency;
+};
+
+/**
+ * Complete query words through a session, entering the dictionary
+ * for each query, until stopped.
+ */
+static void* runReloadQueries(void* arg) {
+    reload_args* args = (reload_args*) arg;
+    vector<string>& words = *args->words;
+    unsigned int seed = args->seed;
+    int reader = args->dictionary->registerReader();
+    const BinaryDictionary* bindict = args->dictionary->enter(reader);
+    DictionarySession session(bindict);
+    args->dictionary->exit(reader);
+    while (!*args->stopping) {
+        string word = words[rand_r(&seed) % words.size()];
+        double start = now();
+        session.setDictionary(args->dictionary->enter(reader));
+        vector<weighted_string> holder;
+        session.getTopCompletions(word.substr(0, 2), holder, 3);
+        session.exists(word);
+        args->dictionary->exit(reader);
+        args->maxLatency = max(args->maxLatency, now() - start);
+        args->numQueries++;
+    }
+    return NULL;
+}
+
+/**
+ * Reload the dictionary on a background thread while threads query
+ * it, and report how long reloads take, and the throughput and the
+ * worst query latency, with and without reloads.
+ */
+static void benchReload(const char * dictionary, vector<string> words) {
+    ReloadableDictionary reloadable;
+    reloadable.load(dictionary);
+    int numThreads = max(2, (int) sysconf(_SC_NPROCESSORS_ONLN));
+    int numReloads = 10;
+    for (int reloading = 0; reloading < 2; reloading++) {
+        volatile bool stopping = false;
+        pthread_t threads[numThreads];
+        reload_args args[numThreads];
+        for (int i = 0; i < numThreads; i++) {
+            args[i].dictionary = &reloadable;
+            args[i].words = &words;
+            args[i].stopping = &stopping;
+            args[i].seed = 42 + i;
+            args[i].numQueries = 0;
+            args[i].maxLatency = 0;
+            pthread_create(&threads[i], NULL, runReloadQueries, &args[i]);
+        }
+        double start = now();
+        double reloadTime = 0;
+        for (int i = 0; i < numReloads; i++) {
+            if (reloading) {
+                double reloadStart = now();
+                reloadable.startReload(dictionary);
+                reloadable.waitForReload();
+                reloadTime += now() - reloadStart;
+            }
+            usleep(100000);
+        }
+        stopping = true;
+        long numQueries = 0;
+        double maxLatency = 0;
+        for (int i = 0; i < numThreads; i++) {
+            pthread_join(threads[i], NULL);
+            numQueries += args[i].numQueries;
+            maxLatency = max(maxLatency, args[i].maxLatency);
+        }
+        double elapsed = now() - start;
+        cout << (reloading ? numReloads : 0) << " reloads";
+        if (reloading) cout << " (" << reloadTime / numReloads << "ms each)";
+        cout << ", " << numThreads << " threads " << numQueries << " queries in " << elapsed << "ms ("
+             << (int) (numQueries / elapsed * 1000) << " qps, max latency " << maxLatency << "ms)" << endl;
+    }
+}
+
+/**
+ * Query the dictionaries of 16 locales, copies of the dictionary
+ * with distinct contents, picking locales with a skew towards the
+ * first ones, through registries whose budget holds from all of them
+ * down to 2, and report the latency of queries, including opening
+ * the dictionary when needed.
+ */
+static void benchRegistry(const char * dictionary, vector<string> words) {
+    int numLocales = 16;
+    int numQueries = 20000;
+    vector<string> files;
+    long size = 0;
+    for (int i = 0; i < numLocales; i++) {
+        ostringstream name;
+        name << "registry-" << i << ".dict";
+        files.push_back(name.str());
+        ifstream in(dictionary, ios::binary);
+        ofstream out(name.str().c_str(), ios::binary);
+        char c;
+        for (int j = 0; in.get(c); j++) {
+            out.put(j == 7 ? (char) (i + 1) : c);
+            size = j + 1;
+        }
+    }
+
+    for (int budget = numLocales; budget >= 2; budget /= 2) {
+        DictionaryRegistry registry(budget * size);
+        for (int i = 0; i < numLocales; i++) {
+            ostringstream locale;
+            locale << "locale" << i;
+            registry.add(locale.str(), files[i]);
+        }
+        vector<double> latencies;
+        double start = now();
+        for (int i = 0; i < numQueries; i++) {
+            double r = (double) rand() / RAND_MAX;
+            ostringstream locale;
+            locale << "locale" << (int) (r * r * numLocales);
+            string word = words[rand() % words.size()];
+            double queryStart = now();
+            const BinaryDictionary* bindict = registry.acquire(locale.str());
+            vector<weighted_string> holder;
+            bindict->getTopCompletions(word.substr(0, 2), holder, 3);
+            bindict->exists(word);
+            registry.release(bindict);
+            latencies.push_back(now() - queryStart);
+        }
+        double elapsed = now() - start;
+        sort(latencies.begin(), latencies.end());
+        registry_stats stats = registry.getStats();
+        cout << "budget " << budget << "/" << numLocales << " dictionaries: " << numQueries << " queries in "
+             << elapsed << "ms, p50 " << latencies[numQueries / 2] * 1000 << "us, p99 "
+             << latencies[numQueries * 99 / 100] * 1000 << "us, max " << latencies.back() << "ms, "
+             << stats.loads << " loads, " << stats.evictions << " evictions" << endl;
+    }
+    for (int i = 0; i < numLocales; i++) {
+        remove(files[i].c_str());
+    }
+}
+
+/**
+ * Send completion and existence queries one at a time with a client,
+ * and report their latency.
+ */
+template <class Client> static void runTransport(const char * transport, Client& client, vector<string>& words) {
+    int numQueries = 20000;
+    vector<double> latencies;
+    query_request request;
+    query_response response;
+    request.maxResults = 3;
+    request.words.resize(1);
+    double start = now();
+    for (int i = 0; i < numQueries; i++) {
+        string word = words[rand() % words.size()];
+        request.id = i;
+        request.type = i % 2 == 0 ? QUERY_COMPLETIONS : QUERY_EXISTS;
+        request.words[0] = i % 2 == 0 ? word.substr(0, 2) : word;
+        double queryStart = now();
+        if (!client.query(request, &response)) {
+            cout << transport << ": query failed" << endl;
+            return;
+        }
+        latencies.push_back(now() - queryStart);
+    }
+    double elapsed = now() - start;
+    sort(latencies.begin(), latencies.end());
+    cout << transport << ": " << numQueries << " queries in " << elapsed << "ms, p50 "
+         << latencies[numQueries / 2] * 1000 << "us, p99 " << latencies[numQueries * 99 / 100] * 1000
+         << "us, p99.9 " << latencies[numQueries * 999 / 1000] * 1000 << "us" << endl;
+}
+
+/**
+ * Compare the latency of queries to a server through a Unix socket,
+ * and through shared memory.
+ */
+static void benchIpc(BinaryDictionary& bindict, vector<string> words) {
+    QueryServer socketServer(&bindict, 1);
+    SharedMemoryServer sharedMemoryServer(&bindict, 1);
+    if (!socketServer.listenUnix("bench.sock") || !socketServer.start() ||
+            !sharedMemoryServer.create("/suggest-bench") || !sharedMemoryServer.start()) {
+        cout << "Unable to start the servers" << endl;
+        return;
+    }
+    for (int run = 0; run < 2; run++) {
+        QueryClient socketClient;
+        socketClient.connectUnix("bench.sock");
+        runTransport("unix socket", socketClient, words);
+        SharedMemoryClient sharedMemoryClient;
+        sharedMemoryClient.attach("/suggest-bench");
+        runTransport("shared memory", sharedMemoryClient, words);
+    }
+}
+
+/**
+ * Correct long words garbled by three random typos, with the error
+ * model, without a budget, with deadlines and with node budgets, and
+ * report the latency, how many results were partial, and how often
+ * the intended word is among the first three corrections.
+ */
+static void benchBudget(BinaryDictionary& bindict, vector<string> words) {
+    srand(42);
+    vector<string> intended;
+    vector<string> typed;
+    for (int i = 0; i < words.size(); i++) {
+        if (words[i].length() < 9) continue;
+        string t = typo(typo(typo(words[i])));
+        if (t == words[i] || bindict.exists(t)) continue;
+        intended.push_back(words[i]);
+        typed.push_back(t);
+    }
+    if (typed.size() == 0) return;
+
+    ErrorModel model;
+    model.fromFile(DEFAULT_ERROR_MODEL);
+    bindict.setErrorModel(&model);
+    double deadlines[] = { 0, 2, 0.5, 0, 0 };
+    long maxNodes[] = { 0, 0, 0, 5000, 1000 };
+    for (int b = 0; b < 5; b++) {
+        vector<double> latencies;
+        int partial = 0, top3 = 0;
+        double start = now();
+        for (int i = 0; i < typed.size(); i++) {
+            vector<weighted_string> holder;
+            double queryStart = now();
+            QueryBudget budget(deadlines[b], maxNodes[b]);
+            vector<weighted_string> corrections = bindict.getCorrections(typed[i], holder, 3, NULL, b > 0 ? &budget : NULL);
+            latencies.push_back(now() - queryStart);
+            if (budget.isPartial()) partial++;
+            for (int j = 0; j < corrections.size() && j < 3; j++) {
+                if (corrections[j].value == intended[i]) {
+                    top3++;
+                    break;
+                }
+            }
+        }
+        double elapsed = now() - start;
+        sort(latencies.begin(), latencies.end());
+        int numQueries = typed.size();
+        cout << "deadline " << deadlines[b] << "ms, nodes " << maxNodes[b] << ": " << numQueries << " words in "
+             << elapsed << "ms, p50 " << latencies[numQueries / 2] << "ms, p99 "
+             << latencies[numQueries * 99 / 100] << "ms, max " << latencies.back() << "ms, partial "
+             << 100.0 * partial / numQueries << "%, top-3 " << 100.0 * top3 / numQueries << "%" << endl;
+    }
+    budget_stats stats = bindict.getBudgetStats();
+    cout << stats.budgets << " budgets, " << stats.deadlines << " deadlines hit, "
+         << stats.nodeLimits << " node limits hit" << endl;
+    bindict.setErrorModel(NULL);
+}
+
+/**
+ * A round of queries of the executor benchmark, and the time each of
+ * them finished.
+ */
+struct bench_round {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int finished;
+    vector<double> finish;
+};
+
+static void recordFinish(QueryTask* task, void* arg) {
+    bench_round* round = (bench_round*) arg;
+    pthread_mutex_lock(&round->lock);
+    round->finish[task->response.id] = now();
+    round->finished++;
+    pthread_cond_signal(&round->done);
+    pthread_mutex_unlock(&round->lock);
+}
+
+/**
+ * Submit rounds of one long correction, of a word garbled by three
+ * typos, followed by short completions, to an executor with a single
+ * thread, with and without slicing the queries, and report the
+ * latency of the short queries, and the time taken by all of them.
+ */
+static void benchExecutor(BinaryDictionary& bindict, vector<string> words) {
+    srand(42);
+    vector<string> garbled;
+    vector<string> prefixes;
+    for (int i = 0; i < words.size(); i++) {
+        if (words[i].length() >= 9) {
+            string t = typo(typo(typo(words[i])));
+            if (!bindict.exists(t)) garbled.push_back(t);
+        } else if (words[i].length() >= 3) {
+            prefixes.push_back(words[i].substr(0, 2));
+        }
+    }
+    if (garbled.empty() || prefixes.empty()) return;
+
+    int numShort = 8;
+    int numRounds = min(1000, (int) garbled.size());
+    int sliceNodes[] = { 1 << 30, 1024, 256, 64 };
+    for (int s = 0; s < 4; s++) {
+        QueryExecutor executor(&bindict, 1);
+        executor.setSliceNodes(sliceNodes[s]);
+        executor.start();
+        vector<double> latencies;
+        vector<double> longLatencies;
+        QueryTask tasks[numShort + 1];
+        bench_round round;
+        pthread_mutex_init(&round.lock, NULL);
+        pthread_cond_init(&round.done, NULL);
+        round.finish.resize(numShort + 1);
+        double start = now();
+        for (int r = 0; r < numRounds; r++) {
+            for (int i = 0; i <= numShort; i++) {
+                tasks[i].request.id = i;
+                tasks[i].request.type = i == 0 ? QUERY_CORRECTIONS : QUERY_COMPLETIONS;
+                tasks[i].request.maxResults = 3;
+                tasks[i].request.words.assign(1, i == 0 ? garbled[r] : prefixes[rand() % prefixes.size()]);
+                tasks[i].setCallback(recordFinish, &round);
+            }
+            round.finished = 0;
+            double submitted = now();
+            for (int i = 0; i <= numShort; i++) {
+                executor.submit(&tasks[i]);
+            }
+            pthread_mutex_lock(&round.lock);
+            while (round.finished <= numShort) {
+                pthread_cond_wait(&round.done, &round.lock);
+            }
+            pthread_mutex_unlock(&round.lock);
+            longLatencies.push_back(round.finish[0] - submitted);
+            for (int i = 1; i <= numShort; i++) {
+                latencies.push_back(round.finish[i] - submitted);
+            }
+        }
+        double elapsed = now() - start;
+        sort(latencies.begin(), latencies.end());
+        sort(longLatencies.begin(), longLatencies.end());
+        int numLatencies = latencies.size();
+        ostringstream slice;
+        slice << "slice " << sliceNodes[s] << " nodes";
+        cout << (s == 0 ? string("no slices") : slice.str()) << ": " << numRounds * (numShort + 1) << " queries in " << elapsed << "ms, short p50 "
+             << latencies[numLatencies / 2] << "ms, p99 " << latencies[numLatencies * 99 / 100]
+             << "ms, long p50 " << longLatencies[numRounds / 2] << "ms, " << executor.getSlices() << " slices" << endl;
+        executor.stop();
+        pthread_mutex_destroy(&round.lock);
+        pthread_cond_destroy(&round.done);
+    }
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " corrections|fuzzy|completions|cache|threads|warmup|exists|batch|reload|registry|ipc|budget|executor [DICTIONARY] [UNIGRAMS]" << endl;
+        return 2;
+    }
+    string benchmark = argv[1];
+    const char * dictionary = argc > 2 ? argv[2] : DEFAULT_DICTIONARY;
+    const char * unigrams = argc > 3 ? argv[3] : DEFAULT_UNIGRAMS;
+
+    BinaryDictionary bindict;
+    bindict.fromFile(dictionary);
+    if (!bindict.isLoaded()) {
+        cout << "Unable to load " << dictionary << endl;
+        return 1;
+    }
+    vector<string> words = readWords(unigrams, NUM_QUERY_WORDS);
+
+    if (benchmark == "corrections") {
+        benchCorrections(bindict, words);
+    } else if (benchmark == "fuzzy") {
+        benchFuzzy(bindict, words);
+    } else if (benchmark == "completions") {
+        benchCompletions(bindict, words);
+    } else if (benchmark == "cache") {
+        benchCache(bindict, words);
+    } else if (benchmark == "threads") {
+        benchThreads(bindict, words);
+    } else if (benchmark == "warmup") {
+        benchWarmUp(dictionary, words);
+    } else if (benchmark == "exists") {
+        benchExists(bindict, words);
+    } else if (benchmark == "batch") {
+        benchBatch(bindict, words);
+    } else if (benchmark == "reload") {
+        benchReload(dictionary, words);
+    } else if (benchmark == "registry") {
+        benchRegistry(dictionary, words);
+    } else if (benchmark == "ipc") {
+        benchIpc(bindict, words);
+    } else if (benchmark == "budget") {
+        benchBudget(bindict, words);
+    } else if (benchmark == "executor") {
+        benchExecutor(bindict, words);
+    } else {
+        cout << "Unknown benchmark " << benchmark << endl;
+        return 2;
+    }
+    return 0;
+}
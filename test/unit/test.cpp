@@ -6,8 +6,22 @@
 
 #include <UnitTest++.h>
 #include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <vector>
 #include "../../bindict.h"
+#include "../../completion.h"
+#include "../../cache.h"
+#include "../../session.h"
+#include "../../batch.h"
+#include "../../reload.h"
+#include "../../registry.h"
+#include "../../protocol.h"
+#include "../../queryserver.h"
+#include "../../shmring.h"
+#include "../../shmserver.h"
+#include "../../executor.h"
 
 struct DictionaryTestFixture {
     BinaryDictionary bindict;
@@ -23,6 +37,7 @@ struct DictionaryTestFixture {
      * unigrams['hi'] = 130
      * unigrams['hello'] = 120
      * unigrams['there'] = 140
+     * unigrams['three'] = 150
      * unigrams['how'] = 150
      * unigrams['are'] = 80
      * unigrams['you'] = 200
@@ -34,6 +49,12 @@ struct DictionaryTestFixture {
      * ngrams[['how','are','you']] = 80
      * ngrams[['you','are','there']] = 30
      * ngrams[[are','you',there']] = 30
+     *
+     * misspellings = {'thr': 'there'}
+     *
+     * and the 2 top completions of the nodes with at least 3
+     * words below them, i.e. 'h', and a Bloom filter with a 1%
+     * false positive rate.
      */
     DictionaryTestFixture() {
         bindict.fromFile("../dictionaries/test/test.dict");
@@ -116,13 +137,771 @@ TEST_FIXTURE(DictionaryTestFixture, TestCorrect) {
     CHECK_EQUAL((int) count(correctionStrings2, correctionStrings2 + numCorrections, "yuu"), 0);
 }
 
-// TODO:
-// TEST_FIXTURE(DictionaryTestFixture, test_completions) {
-//     self.assertTrue('you' in self.bindict.get_completions('yo', 1))
-//     self.assertFalse('your' in self.bindict.get_completions('yo', 1))
-//     self.assertTrue('your' in self.bindict.get_completions('yo', 2))
-//     self.assertFalse('yo' in self.bindict.get_completions('y', 1))
-// }
+TEST_FIXTURE(DictionaryTestFixture, TestCorrectBest) {
+    // 'how' and 'hi' are both one edit away from 'hw'
+    vector<weighted_string> holder;
+    vector<weighted_string> corrections = bindict.getCorrections("hw", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 2);
+    CHECK_EQUAL(corrections[0].value, "how");
+    CHECK_EQUAL(corrections[1].value, "hi");
+
+    holder.clear();
+    corrections = bindict.getCorrections("hw", holder, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "how");
+
+    // Edit distance 2
+    holder.clear();
+    corrections = bindict.getCorrections("yuoo", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 2);
+    CHECK_EQUAL(corrections[0].value, "you");
+    CHECK_EQUAL(corrections[1].value, "your");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestCorrectMisspelling) {
+    // Without the listed misspelling, 'three' would come first
+    vector<weighted_string> holder;
+    vector<weighted_string> corrections = bindict.getCorrections("thr", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "there");
+    CHECK_EQUAL(corrections[0].weight, 140);
+
+    // Nor with a context, where 'three' and 'hi' would be candidates
+    string context[] = {"how", "are"};
+    holder.clear();
+    corrections = bindict.getCorrections(context, 2, "thr", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "there");
+    CHECK_EQUAL(corrections[0].weight, 140);
+
+    holder.clear();
+    corrections = bindict.getCorrections("thr", holder, 100, CORRECTION_TRIGRAMS, 2);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "there");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestCorrectTrigrams) {
+    vector<weighted_string> holder;
+    vector<weighted_string> corrections = bindict.getCorrections("helol", holder, 10, CORRECTION_TRIGRAMS, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "hello");
+
+    holder.clear();
+    corrections = bindict.getCorrections("thered", holder, 10, CORRECTION_TRIGRAMS, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "there");
+
+    // Too short for the index, falls back to edits
+    holder.clear();
+    corrections = bindict.getCorrections("yuu", holder, 10, CORRECTION_TRIGRAMS, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "you");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestRankedCorrect) {
+    ErrorModel model;
+    CHECK(model.fromFile("../scripts/errormodel_qwerty.txt"));
+    bindict.setErrorModel(&model);
+
+    // 't' and 'r' are neighbours on the keyboard, which makes
+    // up for 'your' being less frequent than 'you'
+    vector<weighted_string> holder;
+    vector<weighted_string> corrections = bindict.getCorrections("yout", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 2);
+    CHECK_EQUAL(corrections[0].value, "your");
+    CHECK_EQUAL(corrections[1].value, "you");
+
+    holder.clear();
+    corrections = bindict.getCorrections("yout", holder, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "your");
+
+    holder.clear();
+    corrections = bindict.getCorrections("hoe", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "how");
+
+    bindict.setErrorModel(NULL);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestContextCorrect) {
+    // 'three' and 'there' are both one insert away from 'thre'
+    vector<weighted_string> holder;
+    vector<weighted_string> corrections = bindict.getCorrections(NULL, 0, "thre", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 2);
+    CHECK_EQUAL(corrections[0].value, "three");
+
+    string context[] = { "are", "you" };
+    holder.clear();
+    corrections = bindict.getCorrections(context, 2, "thre", holder, 100);
+    CHECK_EQUAL((int) corrections.size(), 2);
+    CHECK_EQUAL(corrections[0].value, "there");
+    CHECK_EQUAL(corrections[1].value, "three");
+
+    holder.clear();
+    corrections = bindict.getCorrections(context, 2, "thre", holder, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "there");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestCompletions) {
+    vector<weighted_string> holder;
+    vector<weighted_string> completions = bindict.getCompletions("yo", 1, holder, 10);
+    CHECK_EQUAL((int) completions.size(), 1);
+    CHECK_EQUAL(completions[0].value, "you");
+
+    holder.clear();
+    completions = bindict.getCompletions("yo", 2, holder, 10);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[0].value, "you");
+    CHECK_EQUAL(completions[1].value, "your");
+
+    holder.clear();
+    completions = bindict.getCompletions("y", 1, holder, 10);
+    CHECK_EQUAL((int) completions.size(), 0);
+
+    // Weight order and limit
+    holder.clear();
+    completions = bindict.getCompletions("h", 4, holder, 2);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[0].value, "how");
+    CHECK_EQUAL(completions[1].value, "hi");
+
+    holder.clear();
+    completions = bindict.getCompletions("h", 3, holder, 10);
+    CHECK_EQUAL((int) completions.size(), 2);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestTopCompletions) {
+    vector<weighted_string> holder;
+    vector<weighted_string> completions = bindict.getTopCompletions("h", holder, 2);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[0].value, "how");
+    CHECK_EQUAL(completions[1].value, "hi");
+
+    // More completions than precomputed for 'h'
+    holder.clear();
+    completions = bindict.getTopCompletions("h", holder, 3);
+    CHECK_EQUAL((int) completions.size(), 3);
+    CHECK_EQUAL(completions[2].value, "hello");
+
+    holder.clear();
+    completions = bindict.getTopCompletions("th", holder, 10);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[0].value, "three");
+    CHECK_EQUAL(completions[0].weight, 150);
+    CHECK_EQUAL(completions[1].value, "there");
+
+    // The word itself is not a completion
+    holder.clear();
+    completions = bindict.getTopCompletions("you", holder, 10);
+    CHECK_EQUAL((int) completions.size(), 1);
+    CHECK_EQUAL(completions[0].value, "your");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestFuzzyCompletions) {
+    vector<weighted_string> holder;
+    vector<weighted_string> completions = bindict.getFuzzyCompletions("teh", holder, 10, 1);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[0].value, "three");
+    CHECK_EQUAL(completions[1].value, "there");
+
+    // Exact completions come first
+    holder.clear();
+    completions = bindict.getFuzzyCompletions("yo", holder, 3, 1);
+    CHECK_EQUAL((int) completions.size(), 3);
+    CHECK_EQUAL(completions[0].value, "you");
+    CHECK_EQUAL(completions[1].value, "your");
+    CHECK_EQUAL(completions[2].value, "how");
+
+    holder.clear();
+    completions = bindict.getFuzzyCompletions("hw", holder, 10, 0);
+    CHECK_EQUAL((int) completions.size(), 0);
+
+    holder.clear();
+    completions = bindict.getFuzzyCompletions("hw", holder, 10, 1);
+    CHECK_EQUAL((int) completions.size(), 3);
+    CHECK_EQUAL(completions[0].value, "how");
+    CHECK_EQUAL(completions[1].value, "hi");
+    CHECK_EQUAL(completions[2].value, "hello");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestQueryBudget) {
+    vector<weighted_string> holder;
+    QueryBudget unlimited(1000, 100000);
+    vector<weighted_string> corrections = bindict.getCorrections("yuoo", holder, 100, NULL, &unlimited);
+    CHECK(!unlimited.isPartial());
+    CHECK(unlimited.getNodes() > 0);
+    CHECK_EQUAL((int) corrections.size(), 2);
+    CHECK_EQUAL(corrections[0].value, "you");
+
+    // Too few nodes to reach edit distance 2
+    holder.clear();
+    QueryBudget small(0, 3);
+    corrections = bindict.getCorrections("yuoo", holder, 100, NULL, &small);
+    CHECK(small.isPartial());
+    CHECK(!small.isLate());
+    CHECK(corrections.size() < 2);
+    budget_stats stats = bindict.getBudgetStats();
+    CHECK_EQUAL(stats.budgets, 2);
+    CHECK_EQUAL(stats.nodeLimits, 1);
+    CHECK_EQUAL(stats.deadlines, 0);
+
+    // A spent budget returns nothing more
+    holder.clear();
+    vector<weighted_string> completions = bindict.getTopCompletions("h", holder, 3, NULL, &small);
+    CHECK_EQUAL((int) completions.size(), 0);
+
+    holder.clear();
+    QueryBudget late(0.000001, 0);
+    usleep(1000);
+    completions = bindict.getFuzzyCompletions("hw", holder, 10, 1, &late);
+    CHECK(late.isPartial());
+    CHECK(late.isLate());
+    CHECK_EQUAL((int) completions.size(), 0);
+    stats = bindict.getBudgetStats();
+    CHECK_EQUAL(stats.budgets, 3);
+    CHECK_EQUAL(stats.deadlines, 1);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestCompletionSession) {
+    CompletionSession session(&bindict, 2);
+    vector<weighted_string> holder;
+    session.type('h');
+    vector<weighted_string> completions = session.getCompletions(holder);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[0].value, "how");
+    CHECK_EQUAL(completions[1].value, "hi");
+
+    session.type('e');
+    completions = session.getCompletions(holder);
+    CHECK_EQUAL((int) completions.size(), 1);
+    CHECK_EQUAL(completions[0].value, "hello");
+
+    session.type('x');
+    completions = session.getCompletions(holder);
+    CHECK_EQUAL((int) completions.size(), 0);
+
+    session.erase();
+    session.erase();
+    CHECK_EQUAL(session.getPrefix(), "h");
+    completions = session.getCompletions(holder);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[1].value, "hi");
+
+    // Words proven before a keystroke are kept after it
+    session.reset();
+    session.getCompletions(holder);
+    session.type('y');
+    session.type('o');
+    completions = session.getCompletions(holder);
+    CHECK_EQUAL((int) completions.size(), 2);
+    CHECK_EQUAL(completions[0].value, "you");
+    CHECK_EQUAL(completions[1].value, "your");
+    session.type('u');
+    completions = session.getCompletions(holder);
+    CHECK_EQUAL((int) completions.size(), 1);
+    CHECK_EQUAL(completions[0].value, "your");
+}
+
+TEST(TestCacheEviction) {
+    Cache<int, int> cache(2);
+    int value;
+    cache.put(1, 10);
+    cache.put(2, 20);
+    CHECK(cache.get(1, &value));
+    CHECK_EQUAL(value, 10);
+
+    // 2 was not read since the hand last passed, so it goes first
+    cache.put(3, 30);
+    CHECK(!cache.get(2, &value));
+    CHECK(cache.get(3, &value));
+    CHECK_EQUAL(value, 30);
+
+    cache_stats stats = cache.getStats();
+    CHECK_EQUAL(stats.size, 2);
+    CHECK_EQUAL(stats.hits, 2);
+    CHECK_EQUAL(stats.misses, 1);
+    CHECK_EQUAL(stats.evictions, 1);
+
+    Cache<int, int> disabled(0);
+    disabled.put(1, 10);
+    CHECK(!disabled.get(1, &value));
+}
+
+TEST(TestShardedCache) {
+    ShardedCache<int, int> cache(10, 4);
+    int value;
+    for (int i = 0; i < 100; i++) {
+        cache.put(i, i);
+    }
+    CHECK(cache.get(99, &value));
+    CHECK_EQUAL(value, 99);
+
+    // Each shard holds up to 3 entries
+    cache_stats stats = cache.getStats();
+    CHECK_EQUAL(stats.capacity, 12);
+    CHECK(stats.size <= 12);
+    CHECK_EQUAL(stats.evictions, 100 - stats.size);
+    CHECK_EQUAL(stats.hits, 1);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestNgramCache) {
+    string phrase[] = { "how", "are" };
+    vector<weighted_string> holder;
+    bindict.setPredictionCacheCapacity(0);
+    bindict.getPredictions(phrase, 2, holder, 5);
+    vector<weighted_string> predictions = bindict.getPredictions(phrase, 2, holder, 5);
+    CHECK_EQUAL((int) predictions.size(), 1);
+    CHECK_EQUAL(predictions[0].value, "you");
+    CHECK_EQUAL(bindict.getNgramCacheStats().hits, 1);
+
+    // 'are' 'how' must not share the key of 'how' 'are'
+    string reversed[] = { "are", "how" };
+    holder.clear();
+    predictions = bindict.getPredictions(reversed, 2, holder, 5);
+    CHECK_EQUAL((int) predictions.size(), 0);
+
+    bindict.setCacheCapacity(0, 0);
+    bindict.getPredictions(phrase, 2, holder, 5);
+    bindict.getPredictions(phrase, 2, holder, 5);
+    CHECK_EQUAL(bindict.getUnigramCacheStats().hits, 0);
+    CHECK_EQUAL(bindict.getUnigramCacheStats().size, 0);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestPredictionCache) {
+    string phrase[] = { "hello" };
+    vector<weighted_string> holder;
+    bindict.getPredictions(phrase, 1, holder, 5);
+    vector<weighted_string> predictions = bindict.getPredictions(phrase, 1, holder, 5);
+    CHECK_EQUAL(bindict.getPredictionCacheStats().hits, 1);
+    CHECK_EQUAL((int) predictions.size(), 2);
+    CHECK_EQUAL(predictions[0].value, "you");
+    CHECK_EQUAL(predictions[1].value, "there");
+
+    // Fewer predictions are a different entry
+    predictions = bindict.getPredictions(phrase, 1, holder, 1);
+    CHECK_EQUAL((int) predictions.size(), 1);
+    CHECK_EQUAL(bindict.getPredictionCacheStats().size, 2);
+
+    // Reloading invalidates the cache
+    bindict.fromFile("../dictionaries/test/test.dict");
+    CHECK_EQUAL(bindict.getPredictionCacheStats().size, 0);
+    predictions = bindict.getPredictions(phrase, 1, holder, 5);
+    CHECK_EQUAL((int) predictions.size(), 2);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestWarmUp) {
+    string phrase[] = { "how", "are" };
+    vector<weighted_string> holder;
+    bindict.getPredictions(phrase, 2, holder, 3);
+    bindict.exists("hello");
+    CHECK(bindict.saveCacheKeys("test.keys"));
+
+    // 'how', 'are', 'hello', 'how are' and the predictions after it
+    BinaryDictionary warm;
+    warm.fromFile("../dictionaries/test/test.dict");
+    CHECK_EQUAL(warm.warmUpCaches("test.keys"), 5);
+    CHECK_EQUAL(warm.getUnigramCacheStats().size, 3);
+    CHECK_EQUAL(warm.getNgramCacheStats().size, 1);
+    CHECK_EQUAL(warm.getPredictionCacheStats().size, 1);
+
+    vector<weighted_string> predictions = warm.getPredictions(phrase, 2, holder, 3);
+    CHECK_EQUAL((int) predictions.size(), 1);
+    CHECK_EQUAL(predictions[0].value, "you");
+    CHECK_EQUAL(warm.getPredictionCacheStats().hits, 1);
+
+    BinaryDictionary background;
+    background.fromFile("../dictionaries/test/test.dict");
+    background.startWarmUp("test.keys");
+    CHECK_EQUAL(background.waitForWarmUp(), 5);
+    CHECK_EQUAL(background.getPredictionCacheStats().size, 1);
+
+    // A unigram key of two words is skipped, and so is the rest of
+    // the file after a key of an unknown type
+    FILE* keys = fopen("test.keys", "ab");
+    fwrite("\x01\x02\x01" "a" "\x01" "a" "\x09\x01\x01" "a" "\x01\x01\x01" "a", 1, 14, keys);
+    fclose(keys);
+    BinaryDictionary malformed;
+    malformed.fromFile("../dictionaries/test/test.dict");
+    CHECK_EQUAL(malformed.warmUpCaches("test.keys"), 5);
+
+    CHECK_EQUAL(warm.warmUpCaches("missing.keys"), -1);
+    remove("test.keys");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestBloomFilter) {
+    string words[] = { "a", "hi", "hello", "there", "three", "how", "are", "you", "your" };
+    for (int i = 0; i < 9; i++) {
+        CHECK(bindict.exists(words[i]));
+    }
+    CHECK(!bindict.exists("helo"));
+    CHECK(!bindict.exists("th"));
+
+    vector<weighted_string> holder;
+    vector<weighted_string> corrections = bindict.getCorrections("helo", holder, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "hello");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestDictionarySession) {
+    DictionarySession session(&bindict);
+    CHECK(session.exists("hello"));
+    CHECK(!session.exists("helo"));
+
+    string phrase[] = { "hello" };
+    vector<weighted_string> holder;
+    session.getPredictions(phrase, 1, holder, 5);
+    vector<weighted_string> predictions = session.getPredictions(phrase, 1, holder, 5);
+    CHECK_EQUAL((int) predictions.size(), 2);
+    CHECK_EQUAL(predictions[0].value, "you");
+    CHECK_EQUAL(session.getPredictionCacheStats().hits, 1);
+
+    vector<weighted_string> corrections = session.getCorrections("yuu", holder, 1);
+    CHECK_EQUAL((int) corrections.size(), 1);
+    CHECK_EQUAL(corrections[0].value, "you");
+
+    // The caches of the dictionary are left alone
+    CHECK_EQUAL(bindict.getUnigramCacheStats().size, 0);
+    CHECK_EQUAL(bindict.getPredictionCacheStats().size, 0);
+    CHECK(session.getUnigramCacheStats().size > 0);
+
+    session.clearCaches();
+    CHECK_EQUAL(session.getUnigramCacheStats().size, 0);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestBatchCorrector) {
+    string tokens[] = { "yuu", "helo", "yuu", "xyzzy", "hello", "helo" };
+    vector<string> words;
+    for (int i = 0; i < 200; i++) {
+        words.push_back(tokens[i % 6]);
+    }
+    BatchCorrector batch(&bindict, 3);
+    vector<vector<weighted_string> > holder;
+    vector<vector<weighted_string> > corrections = batch.getCorrections(words, holder, 1);
+    CHECK_EQUAL((int) corrections.size(), 200);
+    for (int i = 0; i < 200; i++) {
+        vector<weighted_string> single;
+        vector<weighted_string> expected = bindict.getCorrections(words[i], single, 1);
+        CHECK_EQUAL((int) corrections[i].size(), (int) expected.size());
+        if (!expected.empty()) {
+            CHECK_EQUAL(corrections[i][0].value, expected[0].value);
+        }
+    }
+    CHECK_EQUAL(corrections[0][0].value, "you");
+    CHECK_EQUAL(corrections[1][0].value, "hello");
+    CHECK_EQUAL((int) corrections[3].size(), 0);
+
+    // The workers are reused
+    corrections = batch.getCorrections(vector<string>(words.begin(), words.begin() + 2), holder, 1);
+    CHECK_EQUAL((int) corrections.size(), 2);
+    CHECK_EQUAL(corrections[1][0].value, "hello");
+}
+
+TEST(TestReload) {
+    ReloadableDictionary dictionary;
+    CHECK(dictionary.load("../dictionaries/test/test.dict"));
+    int version = dictionary.getVersion();
+    int reader = dictionary.registerReader();
+    const BinaryDictionary* bindict = dictionary.enter(reader);
+    CHECK_EQUAL(bindict->getVersion(), version);
+    DictionarySession session(bindict);
+    CHECK(session.exists("hello"));
+
+    // Queries in flight finish on the old version
+    dictionary.startReload("../dictionaries/test/test.dict");
+    while (dictionary.getVersion() == version) {
+        usleep(1000);
+    }
+    CHECK(bindict->exists("hello"));
+    CHECK(session.exists("hello"));
+    dictionary.exit(reader);
+    CHECK(dictionary.waitForReload());
+
+    bindict = dictionary.enter(reader);
+    CHECK(bindict->getVersion() > version);
+    session.setDictionary(bindict);
+    CHECK_EQUAL(session.getUnigramCacheStats().size, 0);
+    CHECK(session.exists("hello"));
+    dictionary.exit(reader);
+
+    // Invalid files are not published
+    FILE* file = fopen("test.invalid", "wb");
+    fputs("not a dictionary", file);
+    fclose(file);
+    version = dictionary.getVersion();
+    CHECK(!dictionary.load("test.invalid"));
+    CHECK(!dictionary.load("missing.dict"));
+    CHECK_EQUAL(dictionary.getVersion(), version);
+    remove("test.invalid");
+}
+
+TEST(TestRegistry) {
+    // A copy of the test dictionary with other contents, the weight of
+    // the root node, which is not a word
+    FILE* in = fopen("../dictionaries/test/test.dict", "rb");
+    FILE* out = fopen("test.copy", "wb");
+    int c;
+    for (int i = 0; (c = fgetc(in)) != EOF; i++) {
+        fputc(i == 7 ? 1 : c, out);
+    }
+    fclose(in);
+    fclose(out);
+
+    DictionaryRegistry registry(1 << 20);
+    registry.add("en", "../dictionaries/test/test.dict");
+    registry.add("en_US", "../dictionaries/test/test.dict");
+    registry.add("en_GB", "test.copy");
+    registry.add("xx", "missing.dict");
+    CHECK(registry.acquire("xx") == NULL);
+
+    // Identical files are opened once
+    const BinaryDictionary* en = registry.acquire("en");
+    const BinaryDictionary* us = registry.acquire("en_US");
+    CHECK(en != NULL);
+    CHECK(en == us);
+    CHECK(en->exists("hello"));
+    registry_stats stats = registry.getStats();
+    CHECK_EQUAL(stats.loads, 1);
+    CHECK_EQUAL(stats.shared, 1);
+    long size = stats.size;
+    registry.release(en);
+    registry.release(us);
+
+    // The least recently used dictionary is closed, unless acquired
+    registry.setBudget(size);
+    const BinaryDictionary* gb = registry.acquire("en_GB");
+    CHECK(gb->exists("hello"));
+    stats = registry.getStats();
+    CHECK_EQUAL(stats.dictionaries, 1);
+    CHECK_EQUAL(stats.evictions, 1);
+    registry.setBudget(0);
+    CHECK_EQUAL(registry.getStats().dictionaries, 1);
+    registry.release(gb);
+    CHECK_EQUAL(registry.getStats().dictionaries, 0);
+    remove("test.copy");
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestQueryServer) {
+    QueryServer server(&bindict, 2);
+    CHECK(server.listenUnix("test.sock"));
+    CHECK(server.start());
+    QueryClient client;
+    CHECK(client.connectUnix("test.sock"));
+
+    query_request request;
+    query_response response;
+    request.id = 1;
+    request.type = QUERY_EXISTS;
+    request.maxResults = 1;
+    request.words.push_back("hello");
+    CHECK(client.query(request, &response));
+    CHECK_EQUAL(response.id, (unsigned int) 1);
+    CHECK_EQUAL(response.status, STATUS_OK);
+    CHECK_EQUAL((int) response.results.size(), 1);
+
+    request.id = 2;
+    request.type = QUERY_PREDICTIONS;
+    request.maxResults = 4;
+    CHECK(client.query(request, &response));
+    CHECK_EQUAL((int) response.results.size(), 2);
+    CHECK_EQUAL(response.results[0].value, "you");
+
+    request.id = 3;
+    request.type = QUERY_CORRECTIONS;
+    request.maxResults = 3;
+    request.words[0] = "yuu";
+    CHECK(client.query(request, &response));
+    CHECK(response.results.size() > 0);
+    CHECK_EQUAL(response.results[0].value, "you");
+
+    request.id = 4;
+    request.type = QUERY_COMPLETIONS;
+    request.words[0] = "yo";
+    CHECK(client.query(request, &response));
+    CHECK_EQUAL((int) response.results.size(), 2);
+
+    // Unknown types are answered, not dropped
+    request.id = 5;
+    request.type = 42;
+    CHECK(client.query(request, &response));
+    CHECK_EQUAL(response.id, (unsigned int) 5);
+    CHECK_EQUAL(response.status, STATUS_BAD_REQUEST);
+
+    client.disconnect();
+    server.stop();
+    CHECK_EQUAL(server.getRequests(), 5);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestQueryServerPipelining) {
+    QueryServer server(&bindict, 1);
+    server.setBatching(4, 10);
+    CHECK(server.listenUnix("test.sock"));
+    CHECK(server.start());
+    QueryClient client;
+    CHECK(client.connectUnix("test.sock"));
+
+    // Requests sent at once are answered in order, in batches
+    string words[] = { "yo", "hello", "yo", "h", "yo", "hello" };
+    string frames;
+    for (int i = 0; i < 6; i++) {
+        query_request request;
+        request.id = 10 + i;
+        request.type = words[i] == "hello" ? QUERY_EXISTS : QUERY_COMPLETIONS;
+        request.maxResults = 3;
+        request.words.push_back(words[i]);
+        encodeRequest(request, &frames);
+    }
+    CHECK(client.send(frames));
+    query_response responses[6];
+    for (int i = 0; i < 6; i++) {
+        CHECK(client.receive(&responses[i]));
+        CHECK_EQUAL(responses[i].id, (unsigned int) (10 + i));
+        CHECK_EQUAL(responses[i].status, STATUS_OK);
+    }
+    CHECK_EQUAL(responses[0].results.size(), responses[4].results.size());
+    CHECK_EQUAL(responses[0].results[0].value, "you");
+    CHECK_EQUAL(responses[1].results[0].value, "hello");
+    CHECK_EQUAL(responses[3].results.size(), (size_t) 3);
+
+    client.disconnect();
+    server.stop();
+    CHECK_EQUAL(server.getRequests(), 6);
+    CHECK(server.getBatches() >= 2);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestSharedMemoryServer) {
+    SharedMemoryServer server(&bindict, 2);
+    CHECK(server.create("/suggest-test"));
+    CHECK(server.start());
+    SharedMemoryClient first;
+    SharedMemoryClient second;
+    SharedMemoryClient third;
+    CHECK(first.attach("/suggest-test"));
+    CHECK(second.attach("/suggest-test"));
+    CHECK(!third.attach("/suggest-test"));
+
+    query_request request;
+    query_response response;
+    request.id = 1;
+    request.type = QUERY_COMPLETIONS;
+    request.maxResults = 3;
+    request.words.push_back("yo");
+    CHECK(first.query(request, &response));
+    CHECK_EQUAL(response.id, (unsigned int) 1);
+    CHECK_EQUAL(response.results[0].value, "you");
+
+    // Enough requests to wrap around the rings several times
+    string frames;
+    int numRequests = 3 * SHM_RING_SIZE / 20;
+    request.type = QUERY_EXISTS;
+    request.words[0] = "hello";
+    for (int i = 0; i < numRequests; i++) {
+        request.id = i;
+        frames.clear();
+        encodeRequest(request, &frames);
+        CHECK(second.send(frames));
+        CHECK(second.receive(&response));
+        CHECK_EQUAL(response.id, (unsigned int) i);
+        CHECK_EQUAL((int) response.results.size(), 1);
+    }
+
+    // Detached channels are free for other clients
+    first.detach();
+    CHECK(third.attach("/suggest-test"));
+    request.type = 42;
+    CHECK(third.query(request, &response));
+    CHECK_EQUAL(response.status, STATUS_BAD_REQUEST);
+
+    server.stop();
+    CHECK_EQUAL(server.getRequests(), numRequests + 2);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestSharedMemoryReclaim) {
+    SharedMemoryServer server(&bindict, 1);
+    CHECK(server.create("/suggest-reclaim"));
+    CHECK(server.start());
+    query_request request;
+    query_response response;
+    request.type = QUERY_EXISTS;
+    request.maxResults = 1;
+    request.words.push_back("hello");
+    string frames;
+    for (int i = 0; i < 10; i++) {
+        request.id = 100 + i;
+        encodeRequest(request, &frames);
+    }
+
+    // A client dies without detaching, with requests in flight
+    pid_t pid = fork();
+    if (pid == 0) {
+        SharedMemoryClient dead;
+        _exit(dead.attach("/suggest-reclaim") && dead.send(frames) ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // Its channel is reclaimed, without its responses
+    SharedMemoryClient client;
+    CHECK(client.attach("/suggest-reclaim"));
+    request.id = 1;
+    CHECK(client.query(request, &response));
+    CHECK_EQUAL(response.id, (unsigned int) 1);
+    server.stop();
+}
+
+static void recordTask(QueryTask* task, void* order) {
+    ((vector<unsigned int>*) order)->push_back(task->response.id);
+}
+
+TEST_FIXTURE(DictionaryTestFixture, TestQueryExecutor) {
+    QueryExecutor executor(&bindict, 1);
+    executor.setSliceNodes(1);
+    budget_stats before = bindict.getBudgetStats();
+    vector<unsigned int> order;
+    QueryTask tasks[3];
+    tasks[0].request.type = QUERY_CORRECTIONS;
+    tasks[0].request.words.push_back("yuoo");
+    tasks[1].request.type = QUERY_EXISTS;
+    tasks[1].request.words.push_back("hello");
+    tasks[2].request.type = QUERY_COMPLETIONS;
+    tasks[2].request.words.push_back("h");
+    for (int i = 0; i < 3; i++) {
+        tasks[i].request.id = i;
+        tasks[i].request.maxResults = 3;
+        tasks[i].setCallback(recordTask, &order);
+        executor.submit(&tasks[i]);
+    }
+    CHECK(executor.start());
+    executor.stop();
+
+    // The short queries do not wait for the correction
+    CHECK_EQUAL((int) order.size(), 3);
+    CHECK_EQUAL(order[0], (unsigned int) 1);
+    CHECK_EQUAL(order[1], (unsigned int) 2);
+    CHECK_EQUAL(order[2], (unsigned int) 0);
+    CHECK(executor.getSlices() > 3);
+    CHECK_EQUAL((int) tasks[0].response.results.size(), 2);
+    CHECK_EQUAL(tasks[0].response.results[0].value, "you");
+    CHECK_EQUAL((int) tasks[1].response.results.size(), 1);
+    CHECK_EQUAL(tasks[2].response.results[0].value, "how");
+    // Yielding alone does not count as a budget
+    CHECK_EQUAL(bindict.getBudgetStats().budgets, before.budgets);
+
+    QueryTask task;
+    task.request = tasks[0].request;
+    task.setBudget(0, 3);
+    executor.start();
+    executor.submit(&task);
+    executor.wait(&task);
+    CHECK(task.isDone());
+    CHECK(task.isPartial());
+    CHECK(task.response.results.size() < 2);
+    budget_stats after = bindict.getBudgetStats();
+    CHECK_EQUAL(after.budgets, before.budgets + 1);
+    CHECK_EQUAL(after.nodeLimits, before.nodeLimits + 1);
+}
 
 int main() {
     return UnitTest::RunAllTests();